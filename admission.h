@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "hash.h"
+
+// Admission control for 0-RTT packets, checked before the ticket or the
+// replay filter is touched. Refused packets are answered with 0x05 and
+// the client falls back to 1-RTT, so under overload early data is shed
+// first while handshakes and 1-RTT data keep their latency.
+//
+// Three limits, each off when its setting is 0:
+//  - shedding: while the datagram at the head of a receive batch waited
+//    longer than `shed_queue_delay_us` in the socket queue, all early
+//    data is refused, until the wait falls below half of that again;
+//  - per-source rate: each source address gets `source_rate` packets per
+//    second with bursts of `source_burst`;
+//  - global budget: all workers together admit `global_rate` per second.
+//
+// Rates are enforced with GCRA: a bucket is one "theoretical arrival
+// time" that moves one interval per admitted packet, and a packet is
+// refused if that would take it more than a burst ahead of now. The
+// global budget is one atomic shared by the workers; source buckets are
+// per worker, in a 4-way set-associative table. A source evicted from the
+// table comes back with a full burst; the least recently refilled entry
+// is evicted first, and an entry whose bucket has refilled loses nothing.
+
+struct AdmissionConfig {
+    uint64_t shed_queue_delay_us = 0;  // 0: never shed
+    uint32_t source_rate = 0;          // per second per source address, 0: unlimited
+    uint32_t source_burst = 16;
+    size_t sources = 1 << 16;          // source buckets per worker
+    uint32_t global_rate = 0;          // per second for all workers, 0: unlimited
+    uint32_t global_burst = 1024;
+
+    bool enabled() const { return shed_queue_delay_us || source_rate || global_rate; }
+};
+
+enum class AdmissionDecision : uint8_t {
+    Admit,
+    Shed,          // queue delay over target
+    SourceRate,    // source over its rate
+    GlobalBudget,  // all workers together over the global rate
+};
+
+// GCRA limit shared by every worker
+class EarlyDataBudget {
+private:
+    alignas(64) std::atomic<uint64_t> tat_us;
+    uint64_t interval_us;
+    uint64_t limit_us;
+
+public:
+    EarlyDataBudget(uint32_t rate, uint32_t burst)
+        : tat_us(0), interval_us(1000000 / std::max<uint32_t>(1, rate)),
+          limit_us(interval_us * std::max<uint32_t>(1, burst)) {}
+
+    bool take(uint64_t now_us) {
+        uint64_t tat = tat_us.load(std::memory_order_relaxed);
+        for (;;) {
+            uint64_t next = std::max(tat, now_us) + interval_us;
+            if (next - now_us > limit_us) {
+                return false;
+            }
+            if (tat_us.compare_exchange_weak(tat, next, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+};
+
+// One worker's admission state; only its own thread calls it
+class EarlyDataAdmission {
+private:
+    static constexpr size_t kWays = 4;
+
+    struct SourceBucket {
+        uint32_t addr;
+        uint32_t reserved;
+        uint64_t tat_us;  // 0: empty
+    };
+
+    struct alignas(64) SourceSet {
+        SourceBucket ways[kWays];
+    };
+    static_assert(sizeof(SourceSet) == 64, "one set per cache line");
+
+    AdmissionConfig config;
+    std::shared_ptr<EarlyDataBudget> budget;
+    std::vector<SourceSet> sources;
+    uint64_t set_mask;
+    uint64_t seed;
+    uint64_t source_interval_us;
+    uint64_t source_limit_us;
+    bool overloaded;
+    uint64_t overload_episodes;
+
+    // The bucket of `addr`, or a fresh one in place of the least recently
+    // refilled entry of its set
+    SourceBucket& sourceBucket(uint32_t addr, uint64_t now_us) {
+        SourceSet& set = sources[hashMix(addr, seed) & set_mask];
+        SourceBucket* bucket = nullptr;
+        SourceBucket* victim = &set.ways[0];
+        for (SourceBucket& way : set.ways) {
+            if (way.tat_us != 0 && way.addr == addr) {
+                bucket = &way;
+                break;
+            }
+            if (way.tat_us < victim->tat_us) {
+                victim = &way;
+            }
+        }
+        if (!bucket) {
+            bucket = victim;
+            bucket->addr = addr;
+            bucket->tat_us = now_us;
+        }
+        return *bucket;
+    }
+
+public:
+    // `budget` is shared by the workers, null without a global rate
+    EarlyDataAdmission(const AdmissionConfig& admission_config, std::shared_ptr<EarlyDataBudget> global_budget)
+        : config(admission_config), budget(std::move(global_budget)), set_mask(0), seed(randomSeed()),
+          source_interval_us(1000000 / std::max<uint32_t>(1, config.source_rate)),
+          source_limit_us(source_interval_us * std::max<uint32_t>(1, config.source_burst)),
+          overloaded(false), overload_episodes(0) {
+        if (config.source_rate) {
+            size_t sets = 1;
+            while (sets * kWays < config.sources) {
+                sets <<= 1;
+            }
+            sources.resize(sets);
+            set_mask = sets - 1;
+        }
+    }
+
+    // Feed the queue delay of the datagram at the head of each receive
+    // batch; decides whether the batch sheds early data
+    void observeQueueDelay(uint64_t delay_us) {
+        if (!config.shed_queue_delay_us) {
+            return;
+        }
+        if (delay_us > config.shed_queue_delay_us) {
+            overload_episodes += !overloaded;
+            overloaded = true;
+        } else if (delay_us < config.shed_queue_delay_us / 2) {
+            overloaded = false;
+        }
+    }
+
+    // `addr` is the source IPv4 address; the port is left out so that a
+    // client cannot get a fresh bucket by changing it. A packet is charged
+    // to its source only once the global budget has taken it too, so a
+    // refusal never costs a limit that did not refuse.
+    AdmissionDecision admit(uint32_t addr, uint64_t now_us) {
+        if (overloaded) {
+            return AdmissionDecision::Shed;
+        }
+        SourceBucket* bucket = nullptr;
+        uint64_t next = 0;
+        if (config.source_rate) {
+            bucket = &sourceBucket(addr, now_us);
+            next = std::max(bucket->tat_us, now_us) + source_interval_us;
+            if (next - now_us > source_limit_us) {
+                return AdmissionDecision::SourceRate;
+            }
+        }
+        if (budget && !budget->take(now_us)) {
+            return AdmissionDecision::GlobalBudget;
+        }
+        if (bucket) {
+            bucket->tat_us = next;
+        }
+        return AdmissionDecision::Admit;
+    }
+
+    bool isOverloaded() const { return overloaded; }
+    uint64_t overloadEpisodes() const { return overload_episodes; }
+    size_t memoryBytes() const { return sources.size() * sizeof(SourceSet); }
+};
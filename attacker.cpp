@@ -1,94 +1,645 @@
 // attacker.cpp
+#if !defined(HAVE_PCAP) && __has_include(<pcap.h>)
+#define HAVE_PCAP 1
+#endif
+#if HAVE_PCAP
 #include <pcap.h>
+#endif
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <iostream>
+#include <cerrno>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #include <arpa/inet.h>
-#include <netinet/ip.h>
-#include <netinet/udp.h>
 #include <sys/socket.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
+#include "logger.h"
+#include "datagram_batch.h"
+#include "packet_capture.h"
+#include "quic_protocol.h"
 
+// Replay engine: captures 0-RTT packets off the wire into a pool, then
+// replays every pooled packet a configurable number of times at a
+// configurable rate, in sendmmsg batches, and counts how the server
+// answered each replay (0x04 accepted, 0x05 rejected). With --read it
+// instead streams recorded pcap/pcapng files at the server.
+
+// A captured UDP payload, kept whole so it can be sent in place
+struct CapturedPacket {
+    uint16_t len;
+    uint8_t data[kMaxDatagramSize];
+};
+
+enum class CaptureBackend {
+    Ring,  // AF_PACKET TPACKET_V3 ring (Linux)
+    Pcap,
+};
+
+struct ReplayConfig {
+#if defined(__linux__)
+    std::string interface = "lo";
+    CaptureBackend backend = CaptureBackend::Ring;
+#else
+    std::string interface = "lo0";
+    CaptureBackend backend = CaptureBackend::Pcap;
+#endif
+    struct sockaddr_in target;
+    size_t capture_count = 1;  // packets to pool before replaying
+    uint64_t multiplicity = 1;  // replays per captured packet, 0 = until --duration
+    double rate = 0;  // replays per second over all threads, 0 = unpaced
+    uint64_t jitter_us = 0;  // each gap is randomised by up to this much either way
+    unsigned threads = 1;
+    unsigned ports = 1;  // source ports (sockets) per thread
+    size_t batch_size = kDefaultBatchSize;
+    double duration_s = 0;  // 0 = until every replay is sent
+    uint64_t linger_ms = 500;  // how long to wait for late answers
+    std::vector<std::string> files;  // offline replay of these captures, in order
+    bool all_types = false;  // offline: replay every packet type, not only 0-RTT
+    bool original_timing = false;  // offline: keep the captured inter-packet gaps
+};
+
+std::atomic<bool> g_stop{false};
+
+void signal_handler(int signal) {
+    (void)signal;
+    g_stop.store(true, std::memory_order_relaxed);
+}
+
+// A well-formed 0-RTT packet, with or without a request id
+bool is_early_data(const uint8_t* payload, size_t len) {
+    PacketHeader header;
+    Packet<PacketType::EarlyData> body;
+    return parseHeader(payload, len, header) && decode(header, body);
+}
+
+// Capture state shared by every capture backend
+struct CaptureContext {
+    std::vector<CapturedPacket>* pool;
+    size_t wanted;
+    LinkType link;
+};
+
+// Pool the UDP payload of `frame` if it is a 0-RTT packet. This is the
+// only copy a captured packet gets.
+void capture_frame(CaptureContext& ctx, const uint8_t* frame, size_t caplen) {
+    UdpView udp;
+    if (ctx.pool->size() >= ctx.wanted || !parseUdpFrame(ctx.link, frame, caplen, udp)) {
+        return;
+    }
+
+    if (udp.len <= kMaxDatagramSize && is_early_data(udp.payload, udp.len)) {
+        ctx.pool->emplace_back();
+        CapturedPacket& captured_packet = ctx.pool->back();
+        captured_packet.len = static_cast<uint16_t>(udp.len);
+        memcpy(captured_packet.data, udp.payload, udp.len);
+        QLOG_INFO("Captured 0‑RTT packet, payload length: {} ({}/{})", udp.len,
+                  ctx.pool->size(), ctx.wanted);
+    }
+}
+
+#if HAVE_PCAP
 // Callback function that is called for each captured packet.
 void packet_handler(u_char *user, const struct pcap_pkthdr *header, const u_char *packet) {
-    // On macOS, the loopback (lo0) interface uses DLT_NULL.
-    // The first 4 bytes indicate the protocol family, so we start after them.
-    int offset = 4;
-
-    // Get the IP header.
-    struct ip *ip_hdr = (struct ip *)(packet + offset);
-    int ip_header_length = ip_hdr->ip_hl * 4;
-
-    // Get the UDP header.
-    struct udphdr *udp_hdr = (struct udphdr *)(packet + offset + ip_header_length);
-    const int udp_header_length = 8;
-
-    // Calculate payload pointer and length.
-    const u_char *udp_payload = packet + offset + ip_header_length + udp_header_length;
-    int payload_length = ntohs(udp_hdr->uh_ulen) - udp_header_length;
-
-    // Check for the 0-RTT packet type.
-    if (payload_length > 0 && udp_payload[0] == 0x03) {
-        std::cout << "Captured 0‑RTT packet, payload length: " << payload_length << std::endl;
-
-        // Create a UDP socket to replay the packet.
-        int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sock_fd < 0) {
-            std::cerr << "Failed to create UDP socket for replay" << std::endl;
+    capture_frame(*reinterpret_cast<CaptureContext*>(user), packet, header->caplen);
+}
+
+// Fill the pool through libpcap. pcap_dispatch returns at least once per
+// read timeout so Ctrl-C is noticed.
+bool capture_pcap(const ReplayConfig& config, CaptureContext& ctx) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *handle = pcap_open_live(config.interface.c_str(), BUFSIZ, 1, 1000, errbuf);
+    if (handle == NULL) {
+        QLOG_ERROR("Could not open interface {}: {}", config.interface, errbuf);
+        return false;
+    }
+
+    // Parse by what the interface actually delivers: DLT_NULL on macOS
+    // lo0, Ethernet on Linux lo, cooked headers on "any"
+    ctx.link = linkTypeFromDlt(pcap_datalink(handle));
+    if (ctx.link == LinkType::Unsupported) {
+        QLOG_ERROR("Unsupported datalink type {} on {}", pcap_datalink(handle), config.interface);
+        pcap_close(handle);
+        return false;
+    }
+
+    // Compile a filter expression to capture only UDP packets on the target port.
+    struct bpf_program filter;
+    std::string filter_expr = "udp dst port " + std::to_string(ntohs(config.target.sin_port));
+    if (pcap_compile(handle, &filter, filter_expr.c_str(), 0, PCAP_NETMASK_UNKNOWN) == -1) {
+        QLOG_ERROR("Error compiling filter: {}", pcap_geterr(handle));
+        pcap_close(handle);
+        return false;
+    }
+    if (pcap_setfilter(handle, &filter) == -1) {
+        QLOG_ERROR("Error setting filter: {}", pcap_geterr(handle));
+        pcap_freecode(&filter);
+        pcap_close(handle);
+        return false;
+    }
+
+    bool ok = true;
+    while (ctx.pool->size() < ctx.wanted && !g_stop.load()) {
+        if (pcap_dispatch(handle, -1, packet_handler, reinterpret_cast<u_char*>(&ctx)) < 0) {
+            QLOG_ERROR("Capture failed: {}", pcap_geterr(handle));
+            ok = false;
+            break;
+        }
+    }
+    pcap_freecode(&filter);
+    pcap_close(handle);
+    return ok;
+}
+#endif
+
+#if defined(__linux__)
+// Fill the pool from a TPACKET_V3 ring. The kernel filter only lets the
+// target port through and frames are parsed where the kernel put them.
+bool capture_ring(const ReplayConfig& config, CaptureContext& ctx) {
+    PacketRing ring;
+    if (!ring.open(config.interface.c_str(), ntohs(config.target.sin_port))) {
+        return false;
+    }
+    ctx.link = ring.linkType();
+
+    while (ctx.pool->size() < ctx.wanted && !g_stop.load()) {
+        if (ring.dispatch(100, [&ctx](const uint8_t* frame, size_t caplen) {
+                capture_frame(ctx, frame, caplen);
+            }) < 0) {
+            QLOG_ERROR("Capture failed: {}", strerror(errno));
+            return false;
+        }
+    }
+
+    uint64_t packets, drops;
+    if (ring.stats(packets, drops)) {
+        QLOG_INFO("Capture ring: {} frame(s) matched the filter, {} dropped", packets, drops);
+    }
+    return true;
+}
+#endif
+
+// Per-thread replay totals
+struct ReplayStats {
+    uint64_t sent = 0;
+    uint64_t send_drops = 0;
+    uint64_t queued[128] = {};  // by packet type, id bits masked off
+    uint64_t answers[128] = {};  // by response type; 0x04 means the server took early data again
+    uint64_t send_ns = 0;  // time spent sending, without the linger
+
+    uint64_t answered() const {
+        uint64_t total = 0;
+        for (uint64_t count : answers) {
+            total += count;
+        }
+        return total;
+    }
+
+    void merge(const ReplayStats& other) {
+        sent += other.sent;
+        send_drops += other.send_drops;
+        for (size_t i = 0; i < 128; i++) {
+            queued[i] += other.queued[i];
+            answers[i] += other.answers[i];
+        }
+        send_ns = std::max(send_ns, other.send_ns);
+    }
+};
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The sending side of one replay thread. It owns `ports` sockets, each
+// with its own source port, rotates batches across them and tallies what
+// the server answers.
+class ReplaySender {
+private:
+    const ReplayConfig& config;
+    std::vector<int> sockets;
+    std::vector<struct pollfd> poll_fds;
+    SendBatch tx;
+    RecvBatch rx;
+    size_t next_socket;
+    ReplayStats totals;
+
+public:
+    explicit ReplaySender(const ReplayConfig& config)
+        : config(config), tx(config.batch_size), rx(config.batch_size), next_socket(0) {}
+
+    ~ReplaySender() {
+        for (int fd : sockets) {
+            close(fd);
+        }
+    }
+
+    ReplaySender(const ReplaySender&) = delete;
+    ReplaySender& operator=(const ReplaySender&) = delete;
+
+    bool init() {
+        for (unsigned i = 0; i < config.ports; i++) {
+            int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                QLOG_ERROR("Failed to create UDP socket for replay: {}", strerror(errno));
+                return false;
+            }
+            // Answers arrive as fast as replays go out; give them room
+            int rcvbuf = 4 << 20;
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+            sockets.push_back(fd);
+            poll_fds.push_back({fd, POLLIN, 0});
+        }
+        return true;
+    }
+
+    bool full() const { return tx.full(); }
+
+    // Queue a payload to be sent in place; it must stay valid until the
+    // next flush(). `len` is at least 1.
+    void queue(const uint8_t* payload, size_t len) {
+        tx.prepare(config.target, sizeof(config.target));
+        tx.attach(payload, len);
+        tx.commit(0);
+        totals.queued[payload[0] & kPacketTypeMask]++;
+    }
+
+    void flush() {
+        if (!tx.empty()) {
+            tx.flush(sockets[next_socket]);
+            next_socket = (next_socket + 1) % sockets.size();
+        }
+    }
+
+    void collectResponses() {
+        for (int fd : sockets) {
+            while (rx.receive(fd) > 0) {
+                for (const Datagram& dgram : rx) {
+                    PacketHeader header;
+                    if (parseHeader(dgram.data, dgram.len, header)) {
+                        totals.answers[header.type]++;
+                    }
+                }
+            }
+        }
+    }
+
+    // Sleep until `deadline_ns` at most, waking early for responses
+    void waitForResponses(uint64_t deadline_ns) {
+        uint64_t now = now_ns();
+        if (deadline_ns <= now) {
             return;
         }
+        uint64_t wait_ns = std::min<uint64_t>(deadline_ns - now, 10000000);
+        struct timespec ts = {static_cast<time_t>(wait_ns / 1000000000), static_cast<long>(wait_ns % 1000000000)};
+        if (ppoll(poll_fds.data(), poll_fds.size(), &ts, nullptr) > 0) {
+            collectResponses();
+        }
+    }
 
-        // Set up the server address (localhost:4433).
-        struct sockaddr_in server_addr;
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(4433);
-        inet_pton(AF_INET, "127.0.0.1", &server_addr.sin_addr);
+    // Stop the send clock, then wait out the linger for late answers
+    void finish(uint64_t start_ns) {
+        flush();
+        totals.send_ns = now_ns() - start_ns;
 
-        // Replay the captured UDP payload to the server.
-        ssize_t sent = sendto(sock_fd, udp_payload, payload_length, 0,
-                              (struct sockaddr *)&server_addr, sizeof(server_addr));
-        if (sent < 0) {
-            std::cerr << "Failed to send replay packet" << std::endl;
-        } else {
-            std::cout << "Replayed 0‑RTT packet to server" << std::endl;
+        uint64_t linger_end = now_ns() + config.linger_ms * 1000000;
+        while (now_ns() < linger_end && !g_stop.load(std::memory_order_relaxed)) {
+            waitForResponses(linger_end);
+        }
+        collectResponses();
+
+        totals.sent = tx.stats().datagrams();
+        totals.send_drops = tx.droppedCount();
+    }
+
+    const ReplayStats& stats() const { return totals; }
+};
+
+// One replay thread working through the captured pool
+class ReplayWorker {
+private:
+    const ReplayConfig& config;
+    const std::vector<CapturedPacket>& pool;
+    unsigned index;
+    ReplaySender sender;
+    uint64_t rng;
+
+    uint64_t nextRandom() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng;
+    }
+
+    // Gap until the next replay: the pacing interval plus uniform jitter
+    uint64_t nextGap(double interval_ns) {
+        double gap = interval_ns;
+        if (config.jitter_us > 0) {
+            uint64_t span = 2 * config.jitter_us * 1000;
+            gap += static_cast<double>(nextRandom() % (span + 1)) - static_cast<double>(span / 2);
+        }
+        return gap > 0 ? static_cast<uint64_t>(gap) : 0;
+    }
+
+public:
+    ReplayWorker(const ReplayConfig& config, const std::vector<CapturedPacket>& pool, unsigned index)
+        : config(config), pool(pool), index(index), sender(config), rng(0x9E3779B97F4A7C15ULL * (index + 1)) {}
+
+    bool init() { return sender.init(); }
+
+    void run(uint64_t start_ns) {
+        // Split the copies of every packet across threads
+        uint64_t copies = config.multiplicity == 0
+            ? UINT64_MAX
+            : config.multiplicity / config.threads + (index < config.multiplicity % config.threads ? 1 : 0);
+        uint64_t total = copies > UINT64_MAX / pool.size() ? UINT64_MAX : copies * pool.size();
+        double interval_ns = config.rate > 0 ? 1e9 * config.threads / config.rate : 0;
+        uint64_t end_ns = config.duration_s > 0 ? start_ns + static_cast<uint64_t>(config.duration_s * 1e9)
+                                                : UINT64_MAX;
+
+        uint64_t next_ns = start_ns;
+        uint64_t queued = 0;
+        while (queued < total && !g_stop.load(std::memory_order_relaxed)) {
+            uint64_t now = now_ns();
+            if (now >= end_ns) {
+                break;
+            }
+
+            // Copy-major order, so replays of one packet are spread out.
+            // Payloads are sent in place from the pool.
+            while (queued < total && next_ns <= now && !sender.full()) {
+                const CapturedPacket& packet = pool[queued % pool.size()];
+                sender.queue(packet.data, packet.len);
+                queued++;
+                next_ns += nextGap(interval_ns);
+            }
+
+            sender.flush();
+            sender.collectResponses();
+            sender.waitForResponses(std::min(next_ns, end_ns));
+        }
+        sender.finish(start_ns);
+    }
+
+    const ReplayStats& stats() const { return sender.stats(); }
+};
+
+// Offline replay: streams capture files in order and sends the UDP
+// payload of every matching frame straight out of the file mapping,
+// either as fast as possible or on the capture's own clock. One thread,
+// so the same files always produce the same send order.
+class FileReplayer {
+private:
+    const ReplayConfig& config;
+    ReplaySender sender;
+    uint64_t frames;
+    uint64_t skipped;  // not IPv4/UDP to the target port, or filtered by type
+
+    bool wanted(const CaptureRecord& rec, UdpView& udp) const {
+        if (!parseUdpFrame(rec.link, rec.frame, rec.caplen, udp) || udp.len == 0 || udp.len > kMaxDatagramSize ||
+            udp.dst_port != ntohs(config.target.sin_port)) {
+            return false;
+        }
+        return config.all_types || is_early_data(udp.payload, udp.len);
+    }
+
+    bool replayFile(const std::string& path) {
+        CaptureFile file;
+        if (!file.open(path.c_str())) {
+            return false;
+        }
+
+        // With --original-timing each file starts its own timeline:
+        // frame N goes out at file start + (ts[N] - ts[0])
+        uint64_t base_ns = now_ns();
+        uint64_t first_ts = 0;
+        bool have_first = false;
+        CaptureRecord rec;
+        while (!g_stop.load(std::memory_order_relaxed) && file.next(rec)) {
+            frames++;
+            UdpView udp;
+            if (!wanted(rec, udp)) {
+                skipped++;
+                continue;
+            }
+
+            if (config.original_timing && rec.ts_ns != 0) {
+                if (!have_first) {
+                    first_ts = rec.ts_ns;
+                    have_first = true;
+                }
+                uint64_t due = base_ns + (rec.ts_ns > first_ts ? rec.ts_ns - first_ts : 0);
+                if (now_ns() < due) {
+                    sender.flush();
+                    file.release();
+                    while (now_ns() < due && !g_stop.load(std::memory_order_relaxed)) {
+                        sender.waitForResponses(due);
+                    }
+                }
+            }
+
+            sender.queue(udp.payload, udp.len);
+            if (sender.full()) {
+                sender.flush();
+                file.release();
+                sender.collectResponses();
+            }
+        }
+        // Nothing may point into the mapping once it goes away
+        sender.flush();
+        return true;
+    }
+
+public:
+    explicit FileReplayer(const ReplayConfig& config) : config(config), sender(config), frames(0), skipped(0) {}
+
+    bool init() { return sender.init(); }
+
+    bool run(uint64_t start_ns) {
+        bool ok = true;
+        for (const std::string& path : config.files) {
+            if (!replayFile(path)) {
+                ok = false;
+                break;
+            }
         }
+        sender.finish(start_ns);
+        return ok;
+    }
 
-        close(sock_fd);
+    uint64_t frameCount() const { return frames; }
+    uint64_t skippedCount() const { return skipped; }
+    const ReplayStats& stats() const { return sender.stats(); }
+};
 
-        // Optionally, stop the capture after replaying one packet.
-        exit(0);
+// Summary of what was sent and how the server answered
+void report(const ReplayStats& total) {
+    static const char* const kTypeNames[128] = {
+        nullptr, "handshake", "ticket", "0-RTT", "0-RTT accepted", "0-RTT rejected", "regular", "regular echo",
+    };
+    double sending_s = std::max(1e-9, total.send_ns / 1e9);
+    uint64_t answered = total.answered();
+    uint64_t accepted = total.answers[static_cast<size_t>(PacketType::EarlyDataAccepted)];
+    uint64_t rejected = total.answers[static_cast<size_t>(PacketType::EarlyDataRejected)];
+
+    QLOG_INFO("Replays sent: {} in {:.2f}s ({:.0f}/s sustained), {} dropped by the kernel", total.sent,
+              sending_s, total.sent / sending_s, total.send_drops);
+    for (size_t type = 0; type < 128; type++) {
+        if (total.queued[type] > 0 || total.answers[type] > 0) {
+            char code[8];
+            snprintf(code, sizeof(code), "0x%02zx", type);
+            QLOG_INFO("  {} ({}): sent {}, received {}", code, kTypeNames[type] ? kTypeNames[type] : "unknown",
+                      total.queued[type], total.answers[type]);
+        }
     }
+    QLOG_INFO("Server accepted {} ({:.2f}%), rejected {} ({:.2f}%), other {}, unanswered {}",
+              accepted, total.sent ? 100.0 * accepted / total.sent : 0.0,
+              rejected, total.sent ? 100.0 * rejected / total.sent : 0.0,
+              answered - accepted - rejected, total.sent > answered ? total.sent - answered : 0);
 }
 
-int main() {
-    char errbuf[PCAP_ERRBUF_SIZE];
-    
-    // Open the loopback interface (lo0) for packet capture.
-    // On macOS the loopback interface is usually "lo0".
-    pcap_t *handle = pcap_open_live("lo0", BUFSIZ, 1, 1000, errbuf);
-    if (handle == NULL) {
-        std::cerr << "Could not open interface lo0: " << errbuf << std::endl;
-        return 2;
+int main(int argc, char* argv[]) {
+    ReplayConfig config;
+    memset(&config.target, 0, sizeof(config.target));
+    config.target.sin_family = AF_INET;
+    config.target.sin_port = htons(4433);
+    inet_pton(AF_INET, "127.0.0.1", &config.target.sin_addr);
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--interface" && i + 1 < argc) {
+            config.interface = argv[++i];
+        } else if (arg == "--backend" && i + 1 < argc) {
+            std::string backend = argv[++i];
+            if (backend == "ring") {
+                config.backend = CaptureBackend::Ring;
+            } else if (backend == "pcap") {
+                config.backend = CaptureBackend::Pcap;
+            } else {
+                QLOG_ERROR("Unknown capture backend: {}", backend);
+                return 1;
+            }
+        } else if (arg == "--target" && i + 1 < argc) {
+            if (inet_pton(AF_INET, argv[++i], &config.target.sin_addr) != 1) {
+                QLOG_ERROR("Invalid target address: {}", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--port" && i + 1 < argc) {
+            config.target.sin_port = htons(static_cast<uint16_t>(std::atoi(argv[++i])));
+        } else if (arg == "--capture" && i + 1 < argc) {
+            config.capture_count = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--multiplicity" && i + 1 < argc) {
+            config.multiplicity = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--rate" && i + 1 < argc) {
+            config.rate = std::atof(argv[++i]);
+        } else if (arg == "--jitter" && i + 1 < argc) {
+            config.jitter_us = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            config.threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--ports" && i + 1 < argc) {
+            config.ports = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--batch" && i + 1 < argc) {
+            config.batch_size = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--duration" && i + 1 < argc) {
+            config.duration_s = std::atof(argv[++i]);
+        } else if (arg == "--linger" && i + 1 < argc) {
+            config.linger_ms = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--read" && i + 1 < argc) {
+            config.files.push_back(argv[++i]);
+        } else if (arg == "--all-types") {
+            config.all_types = true;
+        } else if (arg == "--original-timing") {
+            config.original_timing = true;
+        } else {
+            QLOG_ERROR("Usage: {} [--interface IF] [--backend ring|pcap] [--target IP] [--port N] [--capture PACKETS]"
+                       " [--multiplicity N] [--rate REPLAYS_PER_SEC] [--jitter US] [--threads N]"
+                       " [--ports N] [--batch N] [--duration SECONDS] [--linger MS]"
+                       " [--read FILE]... [--all-types] [--original-timing]",
+                       argv[0]);
+            return 1;
+        }
+    }
+    if (config.multiplicity == 0 && config.duration_s <= 0 && config.files.empty()) {
+        QLOG_ERROR("--multiplicity 0 replays forever and needs --duration");
+        return 1;
     }
 
-    // Compile a filter expression to capture only UDP packets on port 4433.
-    struct bpf_program filter;
-    if (pcap_compile(handle, &filter, "udp port 4433", 0, PCAP_NETMASK_UNKNOWN) == -1) {
-        std::cerr << "Error compiling filter: " << pcap_geterr(handle) << std::endl;
-        return 2;
+    signal(SIGINT, signal_handler);
+
+    if (!config.files.empty()) {
+        FileReplayer replayer(config);
+        if (!replayer.init()) {
+            return 1;
+        }
+        QLOG_INFO("Replaying {} capture file(s) {} to UDP port {}, {} packets", config.files.size(),
+                  config.original_timing ? "with the original timing" : "as fast as possible",
+                  ntohs(config.target.sin_port), config.all_types ? "all" : "0-RTT");
+        bool ok = replayer.run(now_ns());
+        QLOG_INFO("Read {} frame(s), {} skipped", replayer.frameCount(), replayer.skippedCount());
+        report(replayer.stats());
+        return ok ? 0 : 2;
     }
-    if (pcap_setfilter(handle, &filter) == -1) {
-        std::cerr << "Error setting filter: " << pcap_geterr(handle) << std::endl;
+
+    QLOG_INFO("Attacker running. Waiting for {} 0‑RTT packet(s) on UDP port {}...",
+              config.capture_count, ntohs(config.target.sin_port));
+
+    std::vector<CapturedPacket> pool;
+    pool.reserve(config.capture_count);
+    CaptureContext ctx = {&pool, config.capture_count, LinkType::Unsupported};
+    bool captured = false;
+    if (config.backend == CaptureBackend::Ring) {
+#if defined(__linux__)
+        captured = capture_ring(config, ctx);
+#else
+        QLOG_ERROR("The ring capture backend needs Linux");
+#endif
+    } else {
+#if HAVE_PCAP
+        captured = capture_pcap(config, ctx);
+#else
+        QLOG_ERROR("Built without libpcap");
+#endif
+    }
+    if (!captured) {
         return 2;
     }
+    if (pool.empty()) {
+        return 1;
+    }
 
-    std::cout << "Attacker running. Waiting for a 0‑RTT packet on UDP port 4433..." << std::endl;
+    std::vector<std::unique_ptr<ReplayWorker>> workers;
+    for (unsigned i = 0; i < config.threads; i++) {
+        workers.push_back(std::make_unique<ReplayWorker>(config, pool, i));
+        if (!workers.back()->init()) {
+            return 1;
+        }
+    }
 
-    // Start the packet capture loop. This call will block until a matching packet is captured.
-    pcap_loop(handle, 0, packet_handler, NULL);
+    QLOG_INFO("Replaying {} packet(s) x {} at {} over {} thread(s), {} source port(s) each",
+              pool.size(), config.multiplicity == 0 ? std::string("unlimited") : std::to_string(config.multiplicity),
+              config.rate > 0 ? std::to_string(static_cast<uint64_t>(config.rate)) + "/s" : std::string("full speed"),
+              config.threads, config.ports);
 
-    pcap_close(handle);
+    uint64_t start_ns = now_ns();
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        threads.emplace_back([&worker, start_ns]() { worker->run(start_ns); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ReplayStats total;
+    for (auto& worker : workers) {
+        total.merge(worker->stats());
+    }
+    report(total);
     return 0;
 }
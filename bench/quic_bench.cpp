@@ -0,0 +1,348 @@
+// Benchmark suite for the server's hot paths.
+//
+// Microbenchmarks time generateSessionTicket and validateSessionTicket
+// (store-based, stateless, and a store held at its size cap), the wire
+// codec's parsers and the
+// packet-type dispatch QuicServer runs for every received datagram. The end-to-end benchmark starts a
+// QuicServer in-process on an ephemeral loopback port, drives it with a
+// pipelined QuicClient and reports requests/s and latency percentiles for
+// each packet type.
+//
+// Build: cmake --build <dir> --target bench
+// Usage: ./bench [--micro] [--e2e] [--iterations N] [--requests N]
+//                [--window N] [--io-uring] [--sqpoll] [--csv]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "metrics.h"
+#include "quic_client.h"
+#include "quic_server.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+struct BenchConfig {
+    bool micro = true;
+    bool e2e = true;
+    size_t iterations = 200000;  // per microbenchmark
+    size_t requests = 20000;  // per packet type, end to end
+    size_t window = 32;  // end-to-end requests in flight
+    IoBackend io_backend = IoBackend::Socket;  // of the end-to-end server
+    bool sqpoll = false;
+    bool csv = false;
+};
+
+static bool g_csv = false;
+
+static double elapsedNs(BenchClock::time_point start) {
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+}
+
+static void reportMicro(const char* name, size_t ops, double ns, size_t failures) {
+    if (g_csv) {
+        printf("micro,%s,%.1f,%.2f,,,,,%zu\n", name, ops / ns * 1e9, ns / ops, failures);
+        return;
+    }
+    printf("%-28s %10.2f Mops/s %8.1f ns/op%s\n", name, ops / ns * 1e3, ns / ops,
+           failures ? "  (FAILURES)" : "");
+}
+
+// Client address as a datagram's source; distinct per index
+static struct sockaddr_in clientAddr(size_t i) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0x7F000001 + static_cast<uint32_t>(i >> 16));
+    addr.sin_port = htons(static_cast<uint16_t>(i & 0xFFFF));
+    return addr;
+}
+
+// Mint and validate through the server's own entry points
+static size_t benchTickets(const char* label, QuicServer& server, size_t iterations) {
+    std::vector<SessionTicket> tickets(iterations);
+    std::string name = std::string(label) + " generate";
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        tickets[i] = server.generateSessionTicket(addressKey(clientAddr(i)));
+    }
+    reportMicro(name.c_str(), iterations, elapsedNs(start), 0);
+
+    // Random order so lookups are not cache-friendly by accident
+    std::vector<size_t> order(iterations);
+    for (size_t i = 0; i < iterations; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+
+    size_t failures = 0;
+    name = std::string(label) + " validate";
+    start = BenchClock::now();
+    for (size_t i : order) {
+        failures += !server.validateSessionTicket(tickets[i].data(), tickets[i].size());
+    }
+    reportMicro(name.c_str(), iterations, elapsedNs(start), failures);
+    return failures;
+}
+
+// Mint into a shard that is already at its cap, so every batch of
+// handshakes evicts the oldest tickets. A failure is a shard over its cap.
+static size_t benchTicketEviction(QuicServer& server, size_t cap, size_t iterations) {
+    TicketLifetimeConfig lifetime;
+    lifetime.max_tickets = cap;
+    server.setTicketLifetime(lifetime);
+    for (size_t i = 0; i < cap; i++) {
+        server.generateSessionTicket(addressKey(clientAddr(i)));
+    }
+
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        server.generateSessionTicket(addressKey(clientAddr(cap + i)));
+    }
+    size_t failures = server.ticketStoreUsage().first > cap;
+    reportMicro("ticket store full generate", iterations, elapsedNs(start), failures);
+    return failures;
+}
+
+static std::vector<uint8_t> encoded(size_t len, const uint8_t* buf) {
+    return std::vector<uint8_t>(buf, buf + len);
+}
+
+static std::vector<uint8_t> handshakePacket(RequestId id = {}) {
+    uint8_t buf[kMaxDatagramSize];
+    return encoded(encode(buf, sizeof(buf), Packet<PacketType::Handshake>{std::string_view("client1")}, id), buf);
+}
+
+static std::vector<uint8_t> earlyDataPacket(const uint8_t* ticket, size_t ticket_len, RequestId id = {}) {
+    uint8_t buf[kMaxDatagramSize];
+    Packet<PacketType::EarlyData> body{{ticket, ticket_len}, std::string_view("early data for the benchmark"), {}};
+    return encoded(encode(buf, sizeof(buf), body, id), buf);
+}
+
+static std::vector<uint8_t> regularPacket(RequestId id = {}) {
+    uint8_t buf[kMaxDatagramSize];
+    return encoded(encode(buf, sizeof(buf), Packet<PacketType::Regular>{std::string_view("regular")}, id), buf);
+}
+
+// Codec parse cost: single packets per type, and a mixed receive batch
+// through the batch validator the server uses
+static size_t benchCodec(size_t iterations) {
+    uint8_t ticket[kTicketHeaderSize + 8] = {'T', 'K', 'T'};
+    struct Case {
+        const char* name;
+        std::vector<uint8_t> packet;
+    };
+    std::vector<Case> cases = {
+        {"parse handshake", handshakePacket()},
+        {"parse 0-rtt", earlyDataPacket(ticket, sizeof(ticket))},
+        {"parse 0-rtt numbered", earlyDataPacket(ticket, sizeof(ticket), 42)},
+        {"parse regular", regularPacket()},
+    };
+
+    size_t total_failures = 0;
+    for (const Case& c : cases) {
+        size_t failures = 0;
+        ParsedPacket parsed;
+        auto start = BenchClock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            failures += !parsePacket(c.packet.data(), c.packet.size(), parsed);
+            asm volatile("" : : "r"(parsed.payload.data) : "memory");
+        }
+        reportMicro(c.name, iterations, elapsedNs(start), failures);
+        total_failures += failures;
+    }
+
+    // A full batch cycling through the packet types
+    std::vector<Datagram> batch(kDefaultBatchSize);
+    for (size_t i = 0; i < batch.size(); i++) {
+        const std::vector<uint8_t>& packet = cases[i % cases.size()].packet;
+        batch[i] = {packet.data(), packet.size(), {}, 0, 0};
+    }
+    std::vector<ParsedPacket> parsed(batch.size());
+    size_t rounds = std::max<size_t>(1, iterations / batch.size());
+    size_t failures = 0;
+    auto start = BenchClock::now();
+    for (size_t i = 0; i < rounds; i++) {
+        failures += batch.size() - parseBatch(batch.begin(), batch.end(), parsed.data());
+        asm volatile("" : : "r"(parsed.data()) : "memory");
+    }
+    reportMicro("parse batch (per packet)", rounds * batch.size(), elapsedNs(start), failures);
+    return total_failures + failures;
+}
+
+// Packet-type dispatch: one pre-built datagram per type, run through the
+// server's handlers with the socket I/O left out
+static size_t benchDispatch(size_t iterations) {
+    QuicServer server;
+    SessionTicket ticket = server.generateSessionTicket(addressKey(clientAddr(0)));
+    uint8_t bad_ticket[kTicketHeaderSize + 8] = {};
+
+    struct Case {
+        const char* name;
+        std::vector<uint8_t> packet;
+        PacketKind expected;
+    };
+    std::vector<Case> cases = {
+        {"dispatch handshake", handshakePacket(), PacketKind::Handshake},
+        {"dispatch 0-rtt accepted", earlyDataPacket(ticket.data(), ticket.size()), PacketKind::EarlyDataAccepted},
+        {"dispatch 0-rtt rejected", earlyDataPacket(bad_ticket, sizeof(bad_ticket)), PacketKind::EarlyDataRejected},
+        {"dispatch regular", regularPacket(), PacketKind::Regular},
+    };
+
+    size_t total_failures = 0;
+    for (const Case& c : cases) {
+        size_t failures = 0;
+        auto start = BenchClock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            // Handshakes from distinct addresses, so each mints a fresh ticket
+            struct sockaddr_in from = clientAddr(c.expected == PacketKind::Handshake ? i : 0);
+            failures += server.dispatch(c.packet.data(), c.packet.size(), from) != c.expected;
+        }
+        reportMicro(c.name, iterations, elapsedNs(start), failures);
+        total_failures += failures;
+    }
+    return total_failures;
+}
+
+static size_t runMicro(const BenchConfig& config) {
+    size_t failures = 0;
+    {
+        QuicServer server;
+        failures += benchTickets("ticket store", server, config.iterations);
+    }
+    {
+        QuicServer server;
+        server.enableStatelessTickets(std::make_shared<TicketKeyring>(3600 * 1000, 7200 * 1000, monotonicMs()));
+        failures += benchTickets("ticket stateless", server, config.iterations);
+    }
+    {
+        QuicServer server;
+        failures += benchTicketEviction(server, std::max<size_t>(1, config.iterations / 4), config.iterations);
+    }
+    failures += benchCodec(config.iterations * 10);
+    failures += benchDispatch(config.iterations);
+    return failures;
+}
+
+// Keeps `window` requests of one type in flight until `requests` have
+// completed, recording each request's latency
+static size_t runE2eType(QuicClient& client, const char* name, size_t requests, size_t window,
+                         void (*issue)(QuicClient&, QuicClient::ResponseHandler)) {
+    auto latency = std::make_unique<LatencyHistogram>();
+    size_t issued = 0;
+    size_t completed = 0;
+    size_t failures = 0;
+    auto handler = [&](const QuicResponse& response) {
+        completed++;
+        if (response.status == QuicResponse::Status::Ok) {
+            latency->record(response.latency.count());
+        } else {
+            failures++;
+        }
+    };
+
+    auto start = BenchClock::now();
+    while (completed < requests) {
+        while (issued < requests && issued - completed < window) {
+            issue(client, handler);
+            issued++;
+        }
+        client.poll(std::chrono::milliseconds(100));
+    }
+    double seconds = elapsedNs(start) / 1e9;
+
+    auto snapshot = std::make_unique<LatencyHistogram::Snapshot>();
+    latency->addTo(*snapshot);
+    double p50 = snapshot->quantile(0.5) / 1e3;
+    double p99 = snapshot->quantile(0.99) / 1e3;
+    double p999 = snapshot->quantile(0.999) / 1e3;
+    double max = snapshot->quantile(1.0) / 1e3;
+    if (g_csv) {
+        printf("e2e,%s,%.1f,,%.1f,%.1f,%.1f,%.1f,%zu\n", name, requests / seconds, p50, p99, p999, max, failures);
+    } else {
+        printf("%-28s %10.0f req/s  p50 %7.1f us  p99 %7.1f us  p99.9 %7.1f us  max %8.1f us%s\n", name,
+               requests / seconds, p50, p99, p999, max, failures ? "  (FAILURES)" : "");
+    }
+    return failures;
+}
+
+static size_t runE2e(const BenchConfig& config) {
+    QuicServer server;
+    server.setIoBackend(config.io_backend, config.sqpoll);
+    if (!server.init(0)) {
+        return 1;
+    }
+    std::thread server_thread([&server]() { server.run(); });
+
+    QuicClient client;
+    size_t failures = 0;
+    if (!client.init("127.0.0.1", server.port()) || !client.connectWithFullHandshake()) {
+        failures++;
+    } else {
+        failures += runE2eType(client, "e2e handshake", config.requests, config.window,
+            [](QuicClient& c, QuicClient::ResponseHandler h) { c.connectWithFullHandshakeAsync(std::move(h)); });
+        failures += runE2eType(client, "e2e 0-rtt", config.requests, config.window,
+            [](QuicClient& c, QuicClient::ResponseHandler h) { c.connectWith0RTTAsync("early data", std::move(h)); });
+        failures += runE2eType(client, "e2e regular", config.requests, config.window,
+            [](QuicClient& c, QuicClient::ResponseHandler h) { c.sendRegularDataAsync("regular data", std::move(h)); });
+    }
+
+    server.stop();
+    server_thread.join();
+    return failures;
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    bool only_micro = false;
+    bool only_e2e = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--micro") {
+            only_micro = true;
+        } else if (arg == "--e2e") {
+            only_e2e = true;
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            config.iterations = std::max(1ULL, std::strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--requests" && i + 1 < argc) {
+            config.requests = std::max(1ULL, std::strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--window" && i + 1 < argc) {
+            config.window = std::max(1ULL, std::strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--io-uring") {
+            config.io_backend = IoBackend::IoUring;
+        } else if (arg == "--sqpoll") {
+            config.io_backend = IoBackend::IoUring;
+            config.sqpoll = true;
+        } else if (arg == "--csv") {
+            config.csv = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--micro] [--e2e] [--iterations N] [--requests N] [--window N]"
+                    " [--io-uring] [--sqpoll] [--csv]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    // Either flag alone selects that part; neither (or both) runs everything
+    if (only_micro != only_e2e) {
+        config.micro = only_micro;
+        config.e2e = only_e2e;
+    }
+    g_csv = config.csv;
+
+    if (g_csv) {
+        printf("kind,name,ops_per_s,ns_per_op,p50_us,p99_us,p999_us,max_us,failures\n");
+    }
+    size_t failures = 0;
+    if (config.micro) {
+        failures += runMicro(config);
+    }
+    if (config.e2e) {
+        failures += runE2e(config);
+    }
+    return failures ? 1 : 0;
+}
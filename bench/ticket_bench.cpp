@@ -0,0 +1,100 @@
+// Microbenchmark: mint and validate throughput of store-based session
+// tickets (TicketTable behind a shard lock, as in QuicServer) versus
+// stateless tickets sealed with a TicketKeyring.
+//
+// Build: cmake --build <dir> --target ticket_bench
+// Usage: ./ticket_bench [clients]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <vector>
+#include "session_ticket.h"
+#include "ticket_table.h"
+
+using BenchClock = std::chrono::steady_clock;
+
+static double elapsedNs(BenchClock::time_point start) {
+    return std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+}
+
+static void report(const char* name, size_t ops, double ns, size_t failures) {
+    printf("%-22s %10.2f Mops/s %8.1f ns/op%s\n", name, ops / ns * 1e3, ns / ops,
+           failures ? "  (FAILURES)" : "");
+}
+
+int main(int argc, char* argv[]) {
+    size_t clients = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+
+    // Client ids as the server packs them: address << 16 | port
+    std::vector<uint64_t> ids(clients);
+    for (size_t i = 0; i < clients; i++) {
+        ids[i] = (static_cast<uint64_t>(16777343 + (i >> 16)) << 16) | (i & 0xFFFF);
+    }
+
+    // Validate in a random order so lookups are not cache-friendly by accident
+    std::vector<size_t> order(clients);
+    for (size_t i = 0; i < clients; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin(), order.end(), std::mt19937_64(42));
+
+    std::vector<SessionTicket> tickets(clients);
+    uint32_t timestamp = static_cast<uint32_t>(time(nullptr));
+    size_t failures = 0;
+    size_t total_failures = 0;
+
+    printf("%zu clients\n", clients);
+
+    // Store-based path
+    {
+        std::shared_mutex mutex;
+        TicketTable table(kTicketHeaderSize);
+
+        auto start = BenchClock::now();
+        for (size_t i = 0; i < clients; i++) {
+            const uint8_t* id = reinterpret_cast<const uint8_t*>(&ids[i]);
+            tickets[i] = makeStoredTicket(id, sizeof(ids[i]), 0, timestamp);
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            table.insert(tickets[i].data(), tickets[i].size());
+        }
+        report("store mint", clients, elapsedNs(start), 0);
+
+        failures = 0;
+        start = BenchClock::now();
+        for (size_t i : order) {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            failures += !table.contains(tickets[i].data(), tickets[i].size());
+        }
+        report("store validate", clients, elapsedNs(start), failures);
+        total_failures += failures;
+        printf("%-22s %10.1f MiB\n", "store memory", table.memoryBytes() / 1048576.0);
+    }
+
+    // Stateless path
+    {
+        TicketKeyring keys(3600 * 1000, 7200 * 1000, 0);
+
+        auto start = BenchClock::now();
+        for (size_t i = 0; i < clients; i++) {
+            const uint8_t* id = reinterpret_cast<const uint8_t*>(&ids[i]);
+            tickets[i] = keys.mint(id, sizeof(ids[i]), timestamp, 0);
+        }
+        report("stateless mint", clients, elapsedNs(start), 0);
+
+        failures = 0;
+        start = BenchClock::now();
+        for (size_t i : order) {
+            failures += !keys.verify(tickets[i].data(), tickets[i].size(), 0);
+        }
+        report("stateless validate", clients, elapsedNs(start), failures);
+        total_failures += failures;
+        printf("%-22s %10.1f MiB\n", "stateless memory", sizeof(TicketKeyring) / 1048576.0);
+    }
+
+    return total_failures ? 1 : 0;
+}
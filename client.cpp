@@ -1,333 +1,659 @@
-#include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <chrono>
 #include <thread>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
+#include <atomic>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include "logger.h"
+#include "metrics.h"
+#include "quic_client.h"
 
-// Simple QUIC client implementation using a basic socket-based approach
-// This demonstrates the concept without requiring complex libraries
+// Open-loop load generator built on QuicClient.
+//
+// Each thread owns a slice of the simulated clients, each with its own
+// socket (the server keys tickets by client address). Operations are
+// issued on a fixed schedule regardless of how fast the server answers,
+// and latency is measured from the moment an operation was *scheduled*,
+// not from when it actually went out. A generator that falls behind
+// therefore still charges the server for the wait, which corrects for
+// coordinated omission. The uncorrected numbers are reported alongside.
 
-class QuicClient {
+enum class LoadOp : uint8_t { Handshake, ZeroRtt, Regular, Count };
+
+static constexpr size_t kLoadOps = static_cast<size_t>(LoadOp::Count);
+static constexpr const char* kLoadOpNames[kLoadOps] = {"handshake", "0-rtt", "regular"};
+
+struct LoadConfig {
+    const char* server_ip = "127.0.0.1";
+    uint16_t server_port = 4433;
+    unsigned threads = 1;
+    unsigned clients = 100;
+    double rate = 1000;  // operations per second, all threads together
+    double duration_s = 10;
+    unsigned mix[kLoadOps] = {1, 8, 1};  // relative weights
+    size_t payload_size = 32;
+    uint64_t timeout_ms = 1000;
+    const char* ticket_cache = nullptr;  // resume from (and save to) this cache file
+};
+
+struct LoadResults {
+    uint64_t sent[kLoadOps] = {};
+    uint64_t completed[kLoadOps] = {};
+    uint64_t rejected[kLoadOps] = {};  // 0-RTT answered with 0x05
+    uint64_t timeouts[kLoadOps] = {};
+    uint64_t send_errors = 0;
+    uint64_t late_sends = 0;  // sent more than 1 ms after their slot
+    LatencyHistogram corrected[kLoadOps];
+    LatencyHistogram uncorrected[kLoadOps];
+};
+
+class LoadWorker {
 private:
-    int sock_fd;
-    struct sockaddr_in server_addr;
-    std::vector<uint8_t> session_ticket;
-    bool has_ticket;
+    using Clock = std::chrono::steady_clock;
 
-public:
-    QuicClient() : sock_fd(-1), has_ticket(false) {}
+    // Requests a client has in flight, oldest first. A request's id is
+    // its sequence number on the client plus one, so the response's echoed
+    // id leads straight to its slot.
+    struct Pending {
+        uint64_t intended_ns;
+        uint64_t sent_ns;
+        uint32_t request_id;
+        LoadOp op;
+        bool done;
+    };
+
+    static constexpr size_t kMaxPending = 256;  // power of two
+    static constexpr size_t kMaxRegularData = 1200;
+
+    struct SimClient {
+        QuicClient client;
+        Pending pending[kMaxPending];
+        uint32_t head = 0;
+        uint32_t tail = 0;
+    };
 
-    ~QuicClient() {
-        if (sock_fd >= 0) {
-            close(sock_fd);
+    const LoadConfig& config;
+    unsigned index;
+    TicketCache* cache;
+    std::vector<std::unique_ptr<SimClient>> clients;
+    int epoll_fd;
+    uint64_t rng;
+    uint64_t sequence;
+    size_t next_client;
+    std::unique_ptr<LoadResults> results;
+    std::vector<char> payload;  // early data is built here, up to kMaxEarlyDataSize
+
+    static uint64_t nowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    uint64_t nextRandom() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng;
+    }
+
+    LoadOp pickOp() {
+        unsigned total = config.mix[0] + config.mix[1] + config.mix[2];
+        uint64_t r = nextRandom() % total;
+        for (size_t op = 0; op < kLoadOps; op++) {
+            if (r < config.mix[op]) {
+                return static_cast<LoadOp>(op);
+            }
+            r -= config.mix[op];
         }
+        return LoadOp::Regular;
     }
 
-    bool init() {
-        // Create UDP socket
-        sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sock_fd < 0) {
-            std::cerr << "Failed to create socket" << std::endl;
-            return false;
+    void issue(SimClient& sim, LoadOp op, uint64_t intended_ns) {
+        if (sim.tail - sim.head == kMaxPending) {
+            results->send_errors++;
+            return;
         }
 
-        // Make socket non-blocking
-        int flags = fcntl(sock_fd, F_GETFL, 0);
-        fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK);
+        // Unique early data so the server's replay filter never fires. It
+        // is split over several datagrams if it does not fit in one;
+        // 1-RTT data is cut to one datagram.
+        char* data = payload.data();
+        int prefix = snprintf(data, payload.size(), "load %u-%llu ", index,
+                              static_cast<unsigned long long>(sequence++));
+        size_t data_len = std::max(static_cast<size_t>(prefix), config.payload_size);
+        memset(data + prefix, 'x', data_len - prefix);
 
-        // Set server address
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(4433);
-        server_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        uint8_t packet[QuicClient::kMaxPacketSize];
+        size_t len = 0;
+        bool sent = false;
+        uint32_t request_id = sim.tail + 1;
+        if (op == LoadOp::ZeroRtt && !sim.client.hasTicket()) {
+            op = LoadOp::Handshake;  // its warm-up handshake was lost
+        }
+        uint64_t sent_ns = nowNs();
+        switch (op) {
+            case LoadOp::Handshake:
+                len = sim.client.buildHandshakePacket(packet, request_id);
+                break;
+            case LoadOp::ZeroRtt:
+                sent = sim.client.send0RttData(std::string_view(data, data_len), request_id);
+                break;
+            default:
+                len = sim.client.buildRegularPacket(packet, std::string_view(data, std::min(data_len, kMaxRegularData)),
+                                                    request_id);
+                break;
+        }
 
-        return true;
+        if (len > 0) {
+            sent = sim.client.sendPacket(packet, len);
+        }
+        if (!sent) {
+            results->send_errors++;
+            return;
+        }
+        if (sent_ns - intended_ns > 1000000) {
+            results->late_sends++;
+        }
+        results->sent[static_cast<size_t>(op)]++;
+        sim.pending[sim.tail++ % kMaxPending] = {intended_ns, sent_ns, request_id, op, false};
     }
 
-    // Save session ticket to a file
-    bool saveSessionTicket(const std::string& filename) {
-        if (session_ticket.empty()) {
-            std::cerr << "No session ticket to save" << std::endl;
-            return false;
+    void complete(SimClient& sim, const uint8_t* buf, size_t len, uint64_t now_ns) {
+        PacketHeader view;
+        if (!parseHeader(buf, len, view)) {
+            return;
         }
-        
-        std::ofstream file(filename, std::ios::binary);
-        if (!file) {
-            std::cerr << "Failed to open file for writing: " << filename << std::endl;
-            return false;
+        if (view.type == static_cast<uint8_t>(PacketType::PathChallenge)) {
+            sim.client.answerPathChallenge(view);
+            return;
+        }
+        if (view.request_id.value_or(kNoRequestId) == kNoRequestId) {
+            return;
         }
-        
-        file.write(reinterpret_cast<const char*>(session_ticket.data()), session_ticket.size());
-        std::cout << "Session ticket saved to " << filename << std::endl;
-        return true;
-    }
 
-    // Load session ticket from a file
-    bool loadSessionTicket(const std::string& filename) {
-        std::ifstream file(filename, std::ios::binary | std::ios::ate);
-        if (!file) {
-            std::cerr << "Failed to open file for reading: " << filename << std::endl;
-            return false;
+        // Ignore answers whose slot has expired and been reused
+        uint32_t seq = *view.request_id - 1;
+        Pending& pending = sim.pending[seq % kMaxPending];
+        if (seq - sim.head >= sim.tail - sim.head || pending.request_id != *view.request_id || pending.done) {
+            return;
+        }
+
+        pending.done = true;
+        size_t k = static_cast<size_t>(pending.op);
+        results->completed[k]++;
+        if (view.type == static_cast<uint8_t>(PacketType::EarlyDataRejected)) {
+            results->rejected[k]++;
+        }
+        if (view.type == static_cast<uint8_t>(PacketType::HandshakeResponse)) {
+            sim.client.acceptTicket(view);
+        }
+        results->corrected[k].record(now_ns - pending.intended_ns);
+        results->uncorrected[k].record(now_ns - pending.sent_ns);
+
+        while (sim.head != sim.tail && sim.pending[sim.head % kMaxPending].done) {
+            sim.head++;
         }
-        
-        size_t size = file.tellg();
-        file.seekg(0, std::ios::beg);
-        
-        session_ticket.resize(size);
-        file.read(reinterpret_cast<char*>(session_ticket.data()), size);
-        
-        has_ticket = true;
-        std::cout << "Session ticket loaded from " << filename << std::endl;
-        return true;
     }
 
-    // Connect with full handshake to get session ticket
-    bool connectWithFullHandshake() {
-        std::cout << "Initiating full handshake with server..." << std::endl;
-        
-        // Send initial handshake packet
-        uint8_t packet[1500];
-        packet[0] = 0x01;  // Initial handshake packet type
-        
-        // Simply send client identifier for demo purposes
-        std::string client_id = "client1";
-        memcpy(packet + 1, client_id.c_str(), client_id.length());
-        
-        ssize_t sent = sendto(sock_fd, packet, 1 + client_id.length(), 0,
-                           (struct sockaddr *)&server_addr, sizeof(server_addr));
-        
-        if (sent < 0) {
-            std::cerr << "Failed to send handshake packet: " << strerror(errno) << std::endl;
-            return false;
+    // Wait up to `timeout_ns` and drain every readable socket; returns
+    // the number of responses. epoll_pwait2 gives sub-millisecond waits,
+    // so the generator does not have to spin between closely spaced slots.
+    size_t poll(uint64_t timeout_ns) {
+        struct epoll_event events[64];
+        int n;
+#ifdef SYS_epoll_pwait2
+        struct timespec timeout = {static_cast<time_t>(timeout_ns / 1000000000),
+                                   static_cast<long>(timeout_ns % 1000000000)};
+        n = static_cast<int>(syscall(SYS_epoll_pwait2, epoll_fd, events, 64, &timeout, nullptr, 0));
+        if (n < 0 && errno == ENOSYS)
+#endif
+        {
+            n = epoll_wait(epoll_fd, events, 64, static_cast<int>((timeout_ns + 999999) / 1000000));
         }
-        
-        // Wait for handshake response with session ticket
-        auto start_time = std::chrono::steady_clock::now();
-        
-        while (true) {
-            uint8_t buf[1500];
-            struct sockaddr_in peer_addr;
-            socklen_t peer_addr_len = sizeof(peer_addr);
-            
-            ssize_t recv_len = recvfrom(sock_fd, buf, sizeof(buf), 0,
-                                    (struct sockaddr *)&peer_addr, &peer_addr_len);
-            
-            if (recv_len < 0) {
-                if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                    // No data available, check timeout
-                    auto current_time = std::chrono::steady_clock::now();
-                    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-                        current_time - start_time).count();
-                    
-                    if (elapsed > 5) {
-                        std::cerr << "Handshake timeout" << std::endl;
-                        return false;
-                    }
-                    
-                    // Wait a bit before trying again
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    continue;
+        size_t responses = 0;
+        for (int i = 0; i < n; i++) {
+            SimClient& sim = *clients[events[i].data.u64];
+            uint8_t buf[QuicClient::kMaxPacketSize];
+            while (true) {
+                ssize_t len = recv(sim.client.fd(), buf, sizeof(buf), 0);
+                if (len <= 0) {
+                    break;
                 }
-                
-                std::cerr << "Failed to receive data: " << strerror(errno) << std::endl;
-                continue;
+                complete(sim, buf, len, nowNs());
+                responses++;
             }
-            
-            // Check if this is a handshake response
-            if (recv_len >= 1 && buf[0] == 0x02) {
-                if (recv_len < 3) {
-                    std::cerr << "Invalid handshake response" << std::endl;
-                    return false;
-                }
-                
-                // Extract session ticket
-                uint16_t ticket_len = (buf[1] << 8) | buf[2];
-                if (recv_len < 3 + ticket_len) {
-                    std::cerr << "Invalid handshake response (truncated ticket)" << std::endl;
-                    return false;
+        }
+        return responses;
+    }
+
+    void expire(uint64_t now_ns) {
+        uint64_t timeout_ns = config.timeout_ms * 1000000;
+        for (auto& sim : clients) {
+            while (sim->head != sim->tail) {
+                Pending& pending = sim->pending[sim->head % kMaxPending];
+                if (!pending.done) {
+                    if (now_ns < pending.sent_ns + timeout_ns) {
+                        break;
+                    }
+                    results->timeouts[static_cast<size_t>(pending.op)]++;
                 }
-                
-                session_ticket.assign(buf + 3, buf + 3 + ticket_len);
-                has_ticket = true;
-                
-                std::cout << "Handshake completed, received session ticket of " 
-                         << ticket_len << " bytes" << std::endl;
-                
-                // Send a regular data packet
-                sendRegularData("Hello after full handshake!");
-                
-                return true;
+                sim->head++;
             }
         }
-        
-        return false;
     }
 
-    // Send regular data after handshake
-    bool sendRegularData(const std::string& data) {
-        std::cout << "Sending regular data: " << data << std::endl;
-        
-        uint8_t packet[1500];
-        packet[0] = 0x06;  // Regular data packet type
-        
-        memcpy(packet + 1, data.c_str(), data.length());
-        
-        ssize_t sent = sendto(sock_fd, packet, 1 + data.length(), 0,
-                           (struct sockaddr *)&server_addr, sizeof(server_addr));
-        
-        if (sent < 0) {
-            std::cerr << "Failed to send data packet: " << strerror(errno) << std::endl;
-            return false;
+    size_t outstanding() const {
+        size_t n = 0;
+        for (const auto& sim : clients) {
+            n += sim->tail - sim->head;
         }
-        
-        // Wait for response
-        return receiveResponse();
+        return n;
     }
 
-    // Connect with 0-RTT using session ticket
-    bool connectWith0RTT(const std::string& early_data) {
-        if (!has_ticket) {
-            std::cerr << "No session ticket available for 0-RTT" << std::endl;
-            return false;
+public:
+    LoadWorker(const LoadConfig& config, unsigned index, TicketCache* cache)
+        : config(config), index(index), cache(cache), epoll_fd(-1), rng(0x9E3779B97F4A7C15ULL * (index + 1)),
+          sequence(0), next_client(0), results(std::make_unique<LoadResults>()), payload(kMaxEarlyDataSize) {}
+
+    ~LoadWorker() {
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
         }
-        
-        std::cout << "Attempting 0-RTT connection with early data: " << early_data << std::endl;
-        
-        // Create 0-RTT packet with session ticket and early data
-        uint8_t packet[1500];
-        packet[0] = 0x03;  // 0-RTT packet type
-        
-        // Add ticket length and ticket
-        uint16_t ticket_len = session_ticket.size();
-        packet[1] = (ticket_len >> 8) & 0xFF;
-        packet[2] = ticket_len & 0xFF;
-        
-        memcpy(packet + 3, session_ticket.data(), ticket_len);
-        
-        // Add early data
-        memcpy(packet + 3 + ticket_len, early_data.c_str(), early_data.length());
-        
-        ssize_t sent = sendto(sock_fd, packet, 3 + ticket_len + early_data.length(), 0,
-                           (struct sockaddr *)&server_addr, sizeof(server_addr));
-        
-        if (sent < 0) {
-            std::cerr << "Failed to send 0-RTT packet: " << strerror(errno) << std::endl;
+    }
+
+    std::string identity(size_t client) const {
+        return "load-" + std::to_string(index) + "-" + std::to_string(client);
+    }
+
+    // Open `count` clients and give each a ticket: from the cache if it has
+    // one, otherwise with one untimed handshake
+    bool init(unsigned count) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            QLOG_ERROR("Failed to create epoll instance: {}", strerror(errno));
             return false;
         }
-        
-        // Wait for response
-        return receiveResponse();
+
+        for (unsigned i = 0; i < count; i++) {
+            auto sim = std::make_unique<SimClient>();
+            if (!sim->client.init(config.server_ip, config.server_port)) {
+                return false;
+            }
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.u64 = clients.size();
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sim->client.fd(), &ev) < 0) {
+                QLOG_ERROR("Failed to register client socket: {}", strerror(errno));
+                return false;
+            }
+            clients.push_back(std::move(sim));
+        }
+
+        size_t cached = 0;
+        for (size_t i = 0; i < clients.size(); i++) {
+            if (cache && clients[i]->client.loadSessionTicket(*cache, identity(i))) {
+                cached++;
+                continue;
+            }
+            issue(*clients[i], LoadOp::Handshake, nowNs());
+        }
+        uint64_t deadline = nowNs() + config.timeout_ms * 1000000;
+        while (outstanding() > 0 && nowNs() < deadline) {
+            poll(10000000);
+        }
+        expire(UINT64_MAX);
+        if (cache) {
+            QLOG_INFO("Load thread {}: {} of {} tickets resumed from the cache", index, cached, clients.size());
+            saveTickets();
+        }
+
+        // Warm-up is not part of the measurement
+        results = std::make_unique<LoadResults>();
+        return true;
     }
 
-private:
-    // Wait for and process server response
-    bool receiveResponse() {
-        auto start_time = std::chrono::steady_clock::now();
-        
+    // Issue operations on a fixed schedule from `start_ns` for the
+    // configured duration, then wait for stragglers up to the timeout
+    void run(uint64_t start_ns, double rate) {
+        if (clients.empty() || rate <= 0) {
+            return;
+        }
+        double interval_ns = 1e9 / rate;
+        uint64_t end_ns = start_ns + static_cast<uint64_t>(config.duration_s * 1e9);
+        uint64_t next_expire = start_ns;
+        uint64_t slot = 0;
+
         while (true) {
-            uint8_t buf[1500];
-            struct sockaddr_in peer_addr;
-            socklen_t peer_addr_len = sizeof(peer_addr);
-            
-            ssize_t recv_len = recvfrom(sock_fd, buf, sizeof(buf), 0,
-                                    (struct sockaddr *)&peer_addr, &peer_addr_len);
-            
-            if (recv_len < 0) {
-                if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                    // No data available, check timeout
-                    auto current_time = std::chrono::steady_clock::now();
-                    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
-                        current_time - start_time).count();
-                    
-                    if (elapsed > 5) {
-                        std::cerr << "Response timeout" << std::endl;
-                        return false;
-                    }
-                    
-                    // Wait a bit before trying again
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    continue;
-                }
-                
-                std::cerr << "Failed to receive data: " << strerror(errno) << std::endl;
-                continue;
+            uint64_t now = nowNs();
+            uint64_t intended = start_ns + static_cast<uint64_t>(slot * interval_ns);
+            if (intended >= end_ns) {
+                break;
             }
-            
-            // Process response based on type
-            if (recv_len >= 1) {
-                uint8_t response_type = buf[0];
-                
-                switch (response_type) {
-                    case 0x04: {  // 0-RTT response
-                        std::string response(reinterpret_cast<char*>(buf + 1), recv_len - 1);
-                        std::cout << "Received 0-RTT response: " << response << std::endl;
-                        return true;
-                    }
-                    
-                    case 0x05: {  // 0-RTT rejection
-                        std::cout << "0-RTT data rejected by server" << std::endl;
-                        return false;
-                    }
-                    
-                    case 0x07: {  // Regular data response
-                        std::string response(reinterpret_cast<char*>(buf + 1), recv_len - 1);
-                        std::cout << "Received regular response: " << response << std::endl;
-                        return true;
-                    }
-                    
-                    default:
-                        std::cerr << "Unknown response type: " << (int)response_type << std::endl;
-                        return false;
-                }
+
+            // Catch up on every slot that is due; never skip one
+            while (intended <= now && intended < end_ns) {
+                issue(*clients[next_client], pickOp(), intended);
+                next_client = (next_client + 1) % clients.size();
+                slot++;
+                intended = start_ns + static_cast<uint64_t>(slot * interval_ns);
+            }
+
+            if (now >= next_expire) {
+                expire(now);
+                next_expire = now + 10000000;
             }
+
+            poll(intended > now ? intended - now : 0);
         }
-        
-        return false;
+
+        uint64_t deadline = nowNs() + config.timeout_ms * 1000000;
+        while (outstanding() > 0 && nowNs() < deadline) {
+            poll(10000000);
+            expire(nowNs());
+        }
+        expire(UINT64_MAX);
     }
+
+    // Write every client's latest ticket to the cache
+    void saveTickets() {
+        for (size_t i = 0; cache && i < clients.size(); i++) {
+            clients[i]->client.saveSessionTicket(*cache, identity(i));
+        }
+    }
+
+    const LoadResults& stats() const { return *results; }
 };
 
-int main() {
+inline std::string formatLatency(uint64_t ns) {
+    char buf[32];
+    if (ns < 1000) {
+        snprintf(buf, sizeof(buf), "%lluns", static_cast<unsigned long long>(ns));
+    } else if (ns < 1000000) {
+        snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    } else {
+        snprintf(buf, sizeof(buf), "%.2fms", ns / 1e6);
+    }
+    return buf;
+}
+
+int runLoad(const LoadConfig& config) {
+    // Every simulated client holds a socket
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < config.clients + 64u) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, config.clients + 64u);
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    // One mapping shared by every thread; slot updates are atomic
+    std::unique_ptr<TicketCache> cache;
+    if (config.ticket_cache) {
+        cache = std::make_unique<TicketCache>();
+        if (!cache->open(config.ticket_cache)) {
+            return 1;
+        }
+    }
+
+    unsigned threads = std::max(1u, std::min(config.threads, config.clients));
+    std::vector<std::unique_ptr<LoadWorker>> workers;
+    for (unsigned i = 0; i < threads; i++) {
+        workers.push_back(std::make_unique<LoadWorker>(config, i, cache.get()));
+    }
+
+    QLOG_INFO("Load: {} clients on {} threads, {:.0f} ops/s for {:.1f}s, mix handshake:0-rtt:regular = {}:{}:{}",
+              config.clients, threads, config.rate, config.duration_s,
+              config.mix[0], config.mix[1], config.mix[2]);
+
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> failed{false};
+    std::atomic<uint64_t> start_ns{0};
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++) {
+        pool.emplace_back([&, i]() {
+            unsigned count = config.clients / threads + (i < config.clients % threads ? 1 : 0);
+            if (!workers[i]->init(count)) {
+                failed = true;
+            }
+            ready.fetch_add(1);
+            while (start_ns.load() == 0) {
+                std::this_thread::yield();
+            }
+            if (!failed) {
+                workers[i]->run(start_ns.load(), config.rate / threads);
+                workers[i]->saveTickets();
+            }
+        });
+    }
+    while (ready.load() < threads) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // Common start a little in the future so every thread begins on time
+    start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count() + 10000000;
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    if (failed) {
+        QLOG_ERROR("Failed to set up load clients");
+        return 1;
+    }
+
+    auto corrected = std::make_unique<LatencyHistogram::Snapshot>();
+    auto uncorrected = std::make_unique<LatencyHistogram::Snapshot>();
+    uint64_t send_errors = 0;
+    uint64_t late_sends = 0;
+    for (auto& worker : workers) {
+        send_errors += worker->stats().send_errors;
+        late_sends += worker->stats().late_sends;
+    }
+
+    for (size_t op = 0; op < kLoadOps; op++) {
+        uint64_t sent = 0, completed = 0, rejected = 0, timeouts = 0;
+        corrected->clear();
+        uncorrected->clear();
+        for (auto& worker : workers) {
+            const LoadResults& r = worker->stats();
+            sent += r.sent[op];
+            completed += r.completed[op];
+            rejected += r.rejected[op];
+            timeouts += r.timeouts[op];
+            r.corrected[op].addTo(*corrected);
+            r.uncorrected[op].addTo(*uncorrected);
+        }
+        if (sent == 0) {
+            continue;
+        }
+        QLOG_INFO("{}: {} sent, {} completed ({:.1f}/s), {} rejected, {} timed out", kLoadOpNames[op],
+                  sent, completed, completed / config.duration_s, rejected, timeouts);
+        QLOG_INFO("  latency p50 {} p99 {} p999 {} max {}", formatLatency(corrected->quantile(0.5)),
+                  formatLatency(corrected->quantile(0.99)), formatLatency(corrected->quantile(0.999)),
+                  formatLatency(corrected->quantile(1.0)));
+        QLOG_INFO("  uncorrected p50 {} p99 {} p999 {} max {}", formatLatency(uncorrected->quantile(0.5)),
+                  formatLatency(uncorrected->quantile(0.99)), formatLatency(uncorrected->quantile(0.999)),
+                  formatLatency(uncorrected->quantile(1.0)));
+    }
+    QLOG_INFO("{} send errors, {} operations sent more than 1 ms late", send_errors, late_sends);
+    return 0;
+}
+
+// Parses "H:Z:R" weights for handshake, 0-RTT and regular data
+bool parseMix(const char* text, unsigned mix[kLoadOps]) {
+    unsigned values[kLoadOps];
+    if (sscanf(text, "%u:%u:%u", &values[0], &values[1], &values[2]) != 3 ||
+        values[0] + values[1] + values[2] == 0) {
+        return false;
+    }
+    std::copy(values, values + kLoadOps, mix);
+    return true;
+}
+
+int runDemo() {
     QuicClient client;
     
     if (!client.init()) {
-        std::cerr << "Failed to initialize client" << std::endl;
+        QLOG_ERROR("Failed to initialize client");
         return 1;
     }
     
     // First connect with full handshake to get session ticket
-    std::cout << "Starting full handshake connection..." << std::endl;
+    QLOG_INFO("Starting full handshake connection...");
     if (!client.connectWithFullHandshake()) {
-        std::cerr << "Failed to connect with full handshake" << std::endl;
+        QLOG_ERROR("Failed to connect with full handshake");
         return 1;
     }
     
     // Save session ticket for future use
-    client.saveSessionTicket("session_ticket.bin");
+    TicketCache cache;
+    if (!cache.open("session_tickets.cache") || !client.saveSessionTicket(cache, "demo")) {
+        QLOG_ERROR("Failed to save session ticket");
+        return 1;
+    }
+    QLOG_INFO("Session ticket saved to session_tickets.cache");
     std::this_thread::sleep_for(std::chrono::seconds(10));
-    std::cout << "\n--------------------------------------\n" << std::endl;
+    QLOG_INFO("\n--------------------------------------\n");
     
     // Wait a bit before trying 0-RTT
 
-    std::cout << "wait for 10 seconds before sending the 0-RTT early data" << std::endl;
+    QLOG_INFO("wait for 10 seconds before sending the 0-RTT early data");
     // Load the ticket (in a real scenario, this would be done in a separate client instance)
-    if (!client.loadSessionTicket("session_ticket.bin")) {
-        std::cerr << "Failed to load session ticket" << std::endl;
+    if (!client.loadSessionTicket(cache, "demo")) {
+        QLOG_ERROR("Failed to load session ticket");
         return 1;
     }
+    QLOG_INFO("Session ticket loaded from session_tickets.cache");
     
     // Now try 0-RTT connection with early data
-    std::cout << "Starting 0-RTT connection..." << std::endl;
+    QLOG_INFO("Starting 0-RTT connection...");
     std::string early_data = "This is early data sent in 0-RTT!";
     if (!client.connectWith0RTT(early_data)) {
-        std::cerr << "Failed to connect with 0-RTT" << std::endl;
+        QLOG_ERROR("Failed to connect with 0-RTT");
         return 1;
     }
     
-    std::cout << "0-RTT demonstration completed successfully!" << std::endl;
+    QLOG_INFO("0-RTT demonstration completed successfully!");
     
     return 0;
-}
\ No newline at end of file
+}
+
+// Time to first application response with a full handshake (handshake,
+// then data: two round trips) against 0-RTT resumption (one round trip)
+int runCompare(unsigned rounds) {
+    QuicClient client;
+    if (!client.init()) {
+        QLOG_ERROR("Failed to initialize client");
+        return 1;
+    }
+
+    auto full = std::make_unique<LatencyHistogram>();
+    auto resumed = std::make_unique<LatencyHistogram>();
+    unsigned failures = 0;
+    for (unsigned i = 0; i < rounds; i++) {
+        std::string data = "compare " + std::to_string(i);
+
+        auto start = QuicClient::Clock::now();
+        auto handshake = client.connectWithFullHandshakeAsync();
+        if (client.await(handshake).status != QuicResponse::Status::Ok) {
+            failures++;
+            continue;
+        }
+        auto regular = client.sendRegularDataAsync(data);
+        if (client.await(regular).status != QuicResponse::Status::Ok) {
+            failures++;
+            continue;
+        }
+        full->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            QuicClient::Clock::now() - start).count());
+
+        // Timed the same way: from before the first send to the answer
+        start = QuicClient::Clock::now();
+        auto early = client.connectWith0RTTAsync(data);
+        if (client.await(early).status != QuicResponse::Status::Ok) {
+            failures++;
+            continue;
+        }
+        resumed->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            QuicClient::Clock::now() - start).count());
+    }
+
+    auto snapshot = std::make_unique<LatencyHistogram::Snapshot>();
+    const std::pair<const char*, LatencyHistogram*> paths[] = {
+        {"1-RTT (handshake + data)", full.get()}, {"0-RTT (early data)", resumed.get()},
+    };
+    for (const auto& path : paths) {
+        snapshot->clear();
+        path.second->addTo(*snapshot);
+        QLOG_INFO("{}: p50 {} p99 {} max {} over {} rounds", path.first,
+                  formatLatency(snapshot->quantile(0.5)), formatLatency(snapshot->quantile(0.99)),
+                  formatLatency(snapshot->quantile(1.0)), snapshot->total);
+    }
+    QLOG_INFO("{} rounds failed", failures);
+    return failures == rounds ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 1) {
+        return runDemo();
+    }
+
+    LoadConfig config;
+    bool load = false;
+    unsigned compare_rounds = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--load") {
+            load = true;
+        } else if (arg == "--compare" && i + 1 < argc) {
+            compare_rounds = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--threads" && i + 1 < argc) {
+            config.threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--clients" && i + 1 < argc) {
+            config.clients = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--rate" && i + 1 < argc) {
+            config.rate = std::atof(argv[++i]);
+        } else if (arg == "--duration" && i + 1 < argc) {
+            config.duration_s = std::atof(argv[++i]);
+        } else if (arg == "--mix" && i + 1 < argc && parseMix(argv[i + 1], config.mix)) {
+            i++;
+        } else if (arg == "--size" && i + 1 < argc) {
+            config.payload_size = std::min<size_t>(std::strtoull(argv[++i], nullptr, 10), kMaxEarlyDataSize);
+        } else if (arg == "--timeout" && i + 1 < argc) {
+            config.timeout_ms = std::max(1ULL, std::strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--server" && i + 1 < argc) {
+            config.server_ip = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            config.server_port = static_cast<uint16_t>(std::atoi(argv[++i]));
+        } else if (arg == "--ticket-cache" && i + 1 < argc) {
+            config.ticket_cache = argv[++i];
+        } else {
+            load = false;
+            compare_rounds = 0;
+            break;
+        }
+    }
+    if (compare_rounds > 0 && !load) {
+        return runCompare(compare_rounds);
+    }
+    if (!load || config.rate <= 0 || config.duration_s <= 0) {
+        QLOG_ERROR("Usage: {} [--compare ROUNDS | --load [--threads N] [--clients N] [--rate OPS_PER_SEC]"
+                   " [--duration SECONDS] [--mix HANDSHAKE:0RTT:REGULAR] [--size BYTES] [--timeout MS]"
+                   " [--server IP] [--port N] [--ticket-cache FILE]]",
+                   argv[0]);
+        return 1;
+    }
+    return runLoad(config);
+}
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "hash.h"
+#include "session_ticket.h"
+
+// Connections of all workers, keyed by the 64-bit connection id the
+// server hands out with each handshake. Clients echo the id, so a client
+// whose address changes (NAT rebinding, a new network) keeps its state,
+// and SO_REUSEPORT may deliver it to any worker afterwards. The id alone
+// does not move a connection: anyone can put another source address on
+// it. The new address first has to echo a token sent to it, see migrate().
+//
+// Index: one open-addressed array of (id, record) pairs shared by every
+// worker. Ids are a keyed SipHash of a per-worker counter: unguessable,
+// and cheap to draw per handshake. A new one is never already present; it is
+// claimed by CAS on the id and then published by storing the record.
+// Removal leaves a tombstone that later inserts reuse. Every probe is
+// capped at kMaxProbe slots, so neither misses nor a table full of
+// tombstones can turn into a long scan; an insert that finds no slot
+// within the cap leaves that client untracked.
+//
+// Records: each worker owns a fixed slice of one pool and opens,
+// idles out and frees only its own records, through a free list no other
+// worker touches. Any worker may read a record found through the index,
+// so a record is not reused as soon as it is removed: it is retired with
+// the current epoch and freed once every worker has passed that epoch.
+// Workers announce the epoch when they start a batch and go quiescent
+// when they leave it, so a worker waiting in epoll holds nothing back.
+
+struct ConnectionTableConfig {
+    size_t max_connections = 1 << 16;  // for all workers together
+    uint32_t idle_timeout_ms = 30000;
+};
+
+// State of one connection. Counters are updated by whichever worker the
+// packet reached, so they are atomic; the id is fixed while the record
+// is in the index.
+struct alignas(64) ConnectionRecord {
+    std::atomic<uint64_t> id;
+    std::atomic<uint64_t> address;  // addressKey() of the client's validated address
+    std::atomic<uint64_t> last_active_ms;
+    std::atomic<uint64_t> packets;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint32_t> early_data_accepted;
+    std::atomic<uint32_t> migrations;
+    union {                  // owner only
+        uint32_t next_free;     // while on the free list
+        uint64_t retire_epoch;  // while retired
+    };
+};
+static_assert(sizeof(ConnectionRecord) == 64, "one record per cache line");
+
+class ConnectionTable {
+public:
+    static constexpr uint32_t kNoRecord = UINT32_MAX;
+
+private:
+    static constexpr uint64_t kEmptyId = 0;
+    static constexpr uint64_t kTombstone = 1;
+    static constexpr size_t kMaxProbe = 64;
+    static constexpr uint64_t kQuiescent = UINT64_MAX;
+
+    struct Slot {
+        std::atomic<uint64_t> id;
+        std::atomic<uint32_t> record;  // kNoRecord until published
+    };
+
+    // One worker's slice of the pool, and its place in the epoch scheme
+    struct alignas(64) Worker {
+        std::atomic<uint64_t> announced{kQuiescent};
+        uint32_t first = 0;
+        uint32_t count = 0;
+        uint32_t free_head = kNoRecord;
+        uint32_t sweep_cursor = 0;
+        uint64_t ids_drawn = 0;
+        std::vector<uint32_t> retired;  // removed from the index, not yet free
+        std::atomic<uint64_t> open{0};
+    };
+
+    ConnectionTableConfig config;
+    std::unique_ptr<Slot[]> slots;
+    uint64_t slot_mask;
+    std::unique_ptr<ConnectionRecord[]> records;
+    std::unique_ptr<Worker[]> workers;
+    size_t worker_count;
+    uint64_t id_key[2];
+    alignas(64) std::atomic<uint64_t> epoch;
+
+    // Unpredictable, and never one of the two reserved ids
+    uint64_t newId(size_t worker_id) {
+        uint64_t input[2] = {worker_id, 0};
+        uint8_t out[16];
+        uint64_t id;
+        do {
+            input[1] = workers[worker_id].ids_drawn++;
+            sipHash128(id_key[0], id_key[1], reinterpret_cast<const uint8_t*>(input), sizeof(input), out);
+            memcpy(&id, out, sizeof(id));
+        } while (id == kEmptyId || id == kTombstone);
+        return id;
+    }
+
+    // Ids are already uniform, so their low bits place them
+    uint64_t home(uint64_t id) const { return id & slot_mask; }
+
+    bool insert(uint64_t id, uint32_t record) {
+        uint64_t slot = home(id);
+        for (size_t probe = 0; probe < kMaxProbe; probe++, slot = (slot + 1) & slot_mask) {
+            uint64_t current = slots[slot].id.load(std::memory_order_relaxed);
+            while (current == kEmptyId || current == kTombstone) {
+                if (slots[slot].id.compare_exchange_weak(current, id, std::memory_order_relaxed)) {
+                    slots[slot].record.store(record, std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void remove(uint64_t id) {
+        uint64_t slot = home(id);
+        for (size_t probe = 0; probe < kMaxProbe; probe++, slot = (slot + 1) & slot_mask) {
+            uint64_t current = slots[slot].id.load(std::memory_order_relaxed);
+            if (current == id) {
+                slots[slot].record.store(kNoRecord, std::memory_order_relaxed);
+                slots[slot].id.store(kTombstone, std::memory_order_release);
+                return;
+            }
+            if (current == kEmptyId) {
+                return;
+            }
+        }
+    }
+
+    // Free what every worker has moved past. The fence pairs with the one
+    // in enter(): a worker either sees the removal from the index or has
+    // announced an epoch that holds its record back.
+    void reclaim(Worker& worker) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t safe = kQuiescent;
+        for (size_t i = 0; i < worker_count; i++) {
+            safe = std::min(safe, workers[i].announced.load(std::memory_order_acquire));
+        }
+        size_t kept = 0;
+        for (uint32_t r : worker.retired) {
+            if (records[r].retire_epoch < safe) {
+                records[r].next_free = worker.free_head;
+                worker.free_head = r;
+            } else {
+                worker.retired[kept++] = r;
+            }
+        }
+        worker.retired.resize(kept);
+    }
+
+public:
+    ConnectionTable(const ConnectionTableConfig& table_config, size_t worker_count)
+        : config(table_config), worker_count(std::max<size_t>(1, worker_count)), epoch(1) {
+        id_key[0] = randomSeed();
+        id_key[1] = randomSeed();
+        size_t per_worker = std::max<size_t>(1, config.max_connections / this->worker_count);
+        size_t total = per_worker * this->worker_count;
+        size_t slot_count = 16;
+        while (slot_count < total * 2) {
+            slot_count <<= 1;
+        }
+        slots.reset(new Slot[slot_count]);
+        for (size_t i = 0; i < slot_count; i++) {
+            slots[i].id.store(kEmptyId, std::memory_order_relaxed);
+            slots[i].record.store(kNoRecord, std::memory_order_relaxed);
+        }
+        slot_mask = slot_count - 1;
+        records.reset(new ConnectionRecord[total]);
+        workers.reset(new Worker[this->worker_count]);
+        for (size_t w = 0; w < this->worker_count; w++) {
+            Worker& worker = workers[w];
+            worker.first = static_cast<uint32_t>(w * per_worker);
+            worker.count = static_cast<uint32_t>(per_worker);
+            worker.retired.reserve(per_worker);
+            for (uint32_t i = 0; i < worker.count; i++) {
+                uint32_t r = worker.first + worker.count - 1 - i;
+                records[r].id.store(kEmptyId, std::memory_order_relaxed);
+                records[r].next_free = worker.free_head;
+                worker.free_head = r;
+            }
+        }
+    }
+
+    ConnectionTable(const ConnectionTable&) = delete;
+    ConnectionTable& operator=(const ConnectionTable&) = delete;
+
+    // Bracket each batch a worker handles; records looked up inside stay
+    // valid until leave()
+    void enter(size_t worker) {
+        workers[worker].announced.store(epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void leave(size_t worker) {
+        workers[worker].announced.store(kQuiescent, std::memory_order_release);
+    }
+
+    // Open a connection for a client at `address` that was issued `ticket`.
+    // Returns its id, or 0 if this worker's slice is full or the index has
+    // no room near its slot.
+    uint64_t open(size_t worker_id, uint64_t address, uint64_t now_ms) {
+        Worker& worker = workers[worker_id];
+        if (worker.free_head == kNoRecord) {
+            reclaim(worker);
+            if (worker.free_head == kNoRecord) {
+                return 0;
+            }
+        }
+        uint32_t r = worker.free_head;
+        ConnectionRecord& record = records[r];
+        uint64_t id = newId(worker_id);
+        record.id.store(id, std::memory_order_relaxed);
+        record.address.store(address, std::memory_order_relaxed);
+        record.last_active_ms.store(now_ms, std::memory_order_relaxed);
+        record.packets.store(1, std::memory_order_relaxed);
+        record.bytes.store(0, std::memory_order_relaxed);
+        record.early_data_accepted.store(0, std::memory_order_relaxed);
+        record.migrations.store(0, std::memory_order_relaxed);
+        if (!insert(id, r)) {
+            record.id.store(kEmptyId, std::memory_order_relaxed);
+            return 0;
+        }
+        worker.free_head = record.next_free;
+        worker.open.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+
+    // The record of connection `id`, or null. Only valid between enter()
+    // and leave() of the calling worker.
+    ConnectionRecord* find(uint64_t id) {
+        if (id == kEmptyId || id == kTombstone) {
+            return nullptr;
+        }
+        uint64_t slot = home(id);
+        for (size_t probe = 0; probe < kMaxProbe; probe++, slot = (slot + 1) & slot_mask) {
+            uint64_t current = slots[slot].id.load(std::memory_order_acquire);
+            if (current == id) {
+                uint32_t r = slots[slot].record.load(std::memory_order_acquire);
+                if (r == kNoRecord || records[r].id.load(std::memory_order_relaxed) != id) {
+                    return nullptr;  // being published or removed
+                }
+                return &records[r];
+            }
+            if (current == kEmptyId) {
+                return nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    // Note a packet on `record`, from whatever address
+    static void touch(ConnectionRecord& record, size_t bytes, uint64_t now_ms) {
+        record.last_active_ms.store(now_ms, std::memory_order_relaxed);
+        record.packets.fetch_add(1, std::memory_order_relaxed);
+        record.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // Token that `address` must echo before `record` moves there. Keyed
+    // like the ids, so only a host that received it knows it; it changes
+    // with every move, so an old echo cannot move the connection back.
+    uint64_t pathToken(const ConnectionRecord& record, uint64_t address) const {
+        uint64_t input[3] = {record.id.load(std::memory_order_relaxed), address,
+                             record.migrations.load(std::memory_order_relaxed)};
+        uint8_t out[16];
+        sipHash128(id_key[1], id_key[0], reinterpret_cast<const uint8_t*>(input), sizeof(input), out);
+        uint64_t token;
+        memcpy(&token, out, sizeof(token));
+        return token;
+    }
+
+    // Move `record` to `address` on a path response from there that echoes
+    // its token. Returns true if the address changed.
+    bool migrate(ConnectionRecord& record, uint64_t address, uint64_t token) {
+        if (record.address.load(std::memory_order_relaxed) == address || token != pathToken(record, address)) {
+            return false;
+        }
+        record.address.store(address, std::memory_order_relaxed);
+        record.migrations.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Close this worker's connections idle for longer than the timeout,
+    // looking at no more than `budget` records, and free the ones retired
+    // earlier that no worker can still see. Returns how many were closed.
+    size_t sweep(size_t worker_id, uint64_t now_ms, size_t budget) {
+        Worker& worker = workers[worker_id];
+        uint64_t retire_epoch = epoch.load(std::memory_order_relaxed);
+        size_t closed = 0;
+        for (size_t i = 0; i < std::min<size_t>(budget, worker.count); i++) {
+            uint32_t r = worker.first + worker.sweep_cursor;
+            worker.sweep_cursor = (worker.sweep_cursor + 1) % worker.count;
+            ConnectionRecord& record = records[r];
+            uint64_t id = record.id.load(std::memory_order_relaxed);
+            // Another worker may have stamped a slightly later time
+            if (id == kEmptyId ||
+                record.last_active_ms.load(std::memory_order_relaxed) + config.idle_timeout_ms > now_ms) {
+                continue;
+            }
+            remove(id);
+            record.id.store(kEmptyId, std::memory_order_relaxed);
+            record.retire_epoch = retire_epoch;
+            worker.retired.push_back(r);
+            closed++;
+        }
+        worker.open.fetch_sub(closed, std::memory_order_relaxed);
+        // Workers that announce from here on cannot find what was removed
+        epoch.fetch_add(1, std::memory_order_acq_rel);
+        reclaim(worker);
+        return closed;
+    }
+
+    size_t openConnections(size_t worker) const { return workers[worker].open.load(std::memory_order_relaxed); }
+    size_t capacity() const { return workers[0].count * worker_count; }
+    size_t memoryBytes() const { return (slot_mask + 1) * sizeof(Slot) + capacity() * sizeof(ConnectionRecord); }
+};
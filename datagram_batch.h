@@ -0,0 +1,470 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#include <time.h>
+#include "logger.h"
+
+// Batched UDP I/O on top of recvmmsg/sendmmsg. Both sides own a
+// preallocated ring of MTU-sized buffers so the packet loop never
+// allocates; the buffers are reused for every batch.
+//
+// Where the kernel supports UDP segmentation offload, both sides can also
+// move several datagrams per message: with GSO, SendBatch coalesces
+// consecutive datagrams to the same destination into one super-datagram
+// that the kernel (or the NIC) splits again; with GRO, the kernel hands
+// RecvBatch runs of same-sized datagrams from one peer as a single buffer,
+// which receive() splits back before anyone sees them. Both are opt-in per
+// socket and fall back to one datagram per message.
+
+static constexpr size_t kMaxDatagramSize = 1500;  // Standard MTU size
+static constexpr size_t kDefaultBatchSize = 32;
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// Limits of one GSO/GRO message: UDP_MAX_SEGMENTS in the kernel, and the
+// largest UDP payload over IPv4
+static constexpr size_t kMaxSegments = 64;
+static constexpr size_t kMaxCoalescedSize = 65507;
+
+// Counts how many datagrams each recvmmsg/sendmmsg call moved
+class BatchHistogram {
+private:
+    std::vector<uint64_t> counts;  // counts[n] = calls that moved n datagrams
+
+public:
+    explicit BatchHistogram(size_t max_batch) : counts(max_batch + 1, 0) {}
+
+    void record(size_t n) {
+        counts[n < counts.size() ? n : counts.size() - 1]++;
+    }
+
+    uint64_t calls() const {
+        uint64_t total = 0;
+        for (uint64_t c : counts) {
+            total += c;
+        }
+        return total;
+    }
+
+    uint64_t datagrams() const {
+        uint64_t total = 0;
+        for (size_t n = 0; n < counts.size(); n++) {
+            total += n * counts[n];
+        }
+        return total;
+    }
+
+    void print(const char* name) const {
+        uint64_t total_calls = calls();
+        QLOG_INFO("{}: {} calls, {} datagrams, mean batch {:.2f}", name, total_calls, datagrams(),
+                  total_calls > 0 ? static_cast<double>(datagrams()) / total_calls : 0.0);
+
+        for (size_t n = 1; n < counts.size(); n++) {
+            if (counts[n] == 0) {
+                continue;
+            }
+            QLOG_INFO("  {}: {} ({:.1f}%)", n, counts[n], 100.0 * counts[n] / total_calls);
+        }
+    }
+};
+
+// A received datagram; `data` points into the batch's buffer ring and is
+// only valid until the next receive()
+struct Datagram {
+    const uint8_t* data;
+    size_t len;
+    struct sockaddr_in addr;
+    socklen_t addr_len;
+    uint64_t rx_time_ns;  // kernel arrival time (CLOCK_REALTIME), 0 if unknown
+};
+
+class RecvBatch {
+private:
+    static constexpr size_t kControlSize = CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(int));
+
+    size_t capacity;
+    size_t slot_size;  // kMaxDatagramSize, or kMaxCoalescedSize with GRO
+    std::vector<uint8_t> buffers;
+    std::vector<struct iovec> iovecs;
+    std::vector<struct sockaddr_in> addrs;
+    std::vector<uint8_t> controls;  // kControlSize per datagram
+    std::vector<struct mmsghdr> msgs;
+    std::vector<Datagram> datagrams;
+    size_t count;
+    BatchHistogram histogram;
+
+    void allocate(size_t slot) {
+        slot_size = slot;
+        buffers.assign(capacity * slot_size, 0);
+        for (size_t i = 0; i < capacity; i++) {
+            iovecs[i].iov_base = buffers.data() + i * slot_size;
+            iovecs[i].iov_len = slot_size;
+        }
+    }
+
+public:
+    // Kernel arrival time, 0 if unknown, and the GRO segment size, 0 if
+    // the message holds a single datagram
+    static void readControl(struct msghdr& hdr, uint64_t& rx_time_ns, size_t& segment_size) {
+        rx_time_ns = 0;
+        segment_size = 0;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                rx_time_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+            } else if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO) {
+                int size;
+                memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                segment_size = size > 0 ? static_cast<size_t>(size) : 0;
+            }
+        }
+    }
+
+    explicit RecvBatch(size_t capacity = kDefaultBatchSize)
+        : capacity(capacity), slot_size(0), iovecs(capacity), addrs(capacity),
+          controls(capacity * kControlSize), msgs(capacity), datagrams(capacity), count(0),
+          histogram(capacity) {
+        allocate(kMaxDatagramSize);
+    }
+
+    // Drain up to `capacity` messages without blocking. Returns the number
+    // of messages received, 0 when the socket is empty, or -1 on error
+    // (errno is set). With GRO a message may hold several datagrams;
+    // size() counts datagrams.
+    int receive(int fd) {
+        for (size_t i = 0; i < capacity; i++) {
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = controls.data() + i * kControlSize;
+            msgs[i].msg_hdr.msg_controllen = kControlSize;
+        }
+
+        int n = recvmmsg(fd, msgs.data(), capacity, MSG_DONTWAIT, nullptr);
+        if (n < 0) {
+            count = 0;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+
+        count = 0;
+        for (int i = 0; i < n; i++) {
+            uint64_t rx_time_ns;
+            size_t segment_size;
+            readControl(msgs[i].msg_hdr, rx_time_ns, segment_size);
+
+            // Split a GRO message back into its datagrams; all but the
+            // last are exactly `segment_size` bytes
+            const uint8_t* data = static_cast<const uint8_t*>(iovecs[i].iov_base);
+            size_t remaining = msgs[i].msg_len;
+            size_t step = segment_size > 0 ? segment_size : remaining;
+            do {
+                Datagram& dgram = datagrams[count++];
+                dgram.data = data;
+                dgram.len = remaining < step ? remaining : step;
+                dgram.addr = addrs[i];
+                dgram.addr_len = msgs[i].msg_hdr.msg_namelen;
+                dgram.rx_time_ns = rx_time_ns;
+                data += dgram.len;
+                remaining -= dgram.len;
+            } while (remaining > 0 && count < datagrams.size());
+        }
+        histogram.record(count);
+        return n;
+    }
+
+    // Ask the kernel to stamp every datagram with its arrival time
+    static bool enableTimestamps(int fd) {
+        int on = 1;
+        return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0;
+    }
+
+    // Accept GRO super-datagrams on `fd`. Grows every slot to the largest
+    // UDP payload, so call it once before the first receive(). Returns
+    // false, and leaves the batch as it was, if the kernel lacks UDP_GRO.
+    bool enableGro(int fd) {
+        int on = 1;
+        if (setsockopt(fd, IPPROTO_UDP, UDP_GRO, &on, sizeof(on)) != 0) {
+            return false;
+        }
+        allocate(kMaxCoalescedSize);
+        datagrams.resize(capacity * kMaxSegments);
+        histogram = BatchHistogram(datagrams.size());
+        return true;
+    }
+
+    const Datagram* begin() const { return datagrams.data(); }
+    const Datagram* end() const { return datagrams.data() + count; }
+    size_t size() const { return count; }
+    size_t maxSize() const { return capacity; }
+    size_t maxDatagrams() const { return datagrams.size(); }
+    const BatchHistogram& stats() const { return histogram; }
+};
+
+// Outgoing datagrams are scatter-gather: the first iovec points at the
+// slot's own buffer, and attach() adds iovecs that reference caller memory
+// in place. That memory, such as a payload still in the RecvBatch ring,
+// must stay valid until flush().
+class SendBatch {
+private:
+    static constexpr size_t kMaxIovecs = 4;
+    static constexpr size_t kSegmentControlSize = CMSG_SPACE(sizeof(uint16_t));
+
+    size_t capacity;
+    std::vector<uint8_t> buffers;
+    std::vector<struct iovec> iovecs;  // kMaxIovecs per datagram
+    std::vector<struct sockaddr_in> addrs;
+    std::vector<struct mmsghdr> msgs;
+    std::vector<uint32_t> lengths;  // bytes per datagram, all iovecs
+    size_t count;
+    uint64_t dropped;
+    BatchHistogram histogram;
+
+    // GSO: flush() rewrites the batch into these, one message per run of
+    // datagrams to the same destination
+    bool gso;
+    std::vector<struct mmsghdr> gso_msgs;
+    std::vector<struct iovec> gso_iovecs;
+    std::vector<uint8_t> gso_controls;  // kSegmentControlSize per message
+    std::vector<uint32_t> gso_first;    // first datagram of each message
+    std::vector<uint32_t> gso_segments;  // datagrams in each message
+    uint64_t coalesced;  // datagrams that left inside a multi-segment message
+
+    bool sameDestination(size_t a, size_t b) const {
+        return msgs[a].msg_hdr.msg_namelen == msgs[b].msg_hdr.msg_namelen &&
+               addrs[a].sin_addr.s_addr == addrs[b].sin_addr.s_addr &&
+               addrs[a].sin_port == addrs[b].sin_port;
+    }
+
+    // Build gso_msgs from the queued datagrams. A run shares one
+    // destination and one segment size; only its last datagram may be
+    // shorter. Order is kept. Returns the number of messages.
+    size_t coalesce() {
+        size_t out = 0;
+        size_t iov_used = 0;
+        for (size_t first = 0; first < count;) {
+            size_t segment = lengths[first];
+            size_t total = segment;
+            size_t end = first + 1;
+            while (segment > 0 && end < count && end - first < kMaxSegments &&
+                   lengths[end] > 0 && lengths[end] <= segment &&
+                   total + lengths[end] <= kMaxCoalescedSize && sameDestination(first, end)) {
+                total += lengths[end];
+                if (lengths[end++] < segment) {
+                    break;
+                }
+            }
+
+            struct mmsghdr& msg = gso_msgs[out];
+            msg = msgs[first];
+            if (end - first > 1) {
+                struct iovec* iov = &gso_iovecs[iov_used];
+                size_t iov_count = 0;
+                for (size_t i = first; i < end; i++) {
+                    const struct msghdr& hdr = msgs[i].msg_hdr;
+                    memcpy(iov + iov_count, hdr.msg_iov, hdr.msg_iovlen * sizeof(struct iovec));
+                    iov_count += hdr.msg_iovlen;
+                }
+                iov_used += iov_count;
+                msg.msg_hdr.msg_iov = iov;
+                msg.msg_hdr.msg_iovlen = iov_count;
+
+                uint8_t* control = gso_controls.data() + out * kSegmentControlSize;
+                memset(control, 0, kSegmentControlSize);
+                msg.msg_hdr.msg_control = control;
+                msg.msg_hdr.msg_controllen = kSegmentControlSize;
+                struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg.msg_hdr);
+                cmsg->cmsg_level = IPPROTO_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t segment_size = static_cast<uint16_t>(segment);
+                memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+            }
+            gso_first[out] = static_cast<uint32_t>(first);
+            gso_segments[out] = static_cast<uint32_t>(end - first);
+            out++;
+            first = end;
+        }
+        return out;
+    }
+
+    // sendmmsg() `n` single-datagram messages
+    void sendAll(int fd, struct mmsghdr* batch, size_t n) {
+        size_t sent = 0;
+        while (sent < n) {
+            int k = sendmmsg(fd, batch + sent, n - sent, MSG_DONTWAIT);
+            if (k < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    QLOG_ERROR("Failed to send batch: {}", strerror(errno));
+                }
+                // Skip the datagram at the head so one bad destination
+                // cannot stall the rest of the batch
+                dropped++;
+                sent++;
+                continue;
+            }
+            histogram.record(k);
+            sent += k;
+        }
+    }
+
+    // sendmmsg() the coalesced messages. Returns the first datagram that
+    // still has to go out one by one because the kernel refused GSO for
+    // it, or `count` when everything was handled.
+    size_t sendCoalesced(int fd, size_t n) {
+        size_t sent = 0;
+        while (sent < n) {
+            int k = sendmmsg(fd, gso_msgs.data() + sent, n - sent, MSG_DONTWAIT);
+            if (k < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // The socket accepted UDP_SEGMENT but the route cannot
+                // segment (no checksum offload, say)
+                if (gso_segments[sent] > 1 && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP)) {
+                    return gso_first[sent];
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    QLOG_ERROR("Failed to send batch: {}", strerror(errno));
+                }
+                dropped += gso_segments[sent];
+                sent++;
+                continue;
+            }
+            size_t datagrams = 0;
+            for (size_t i = sent; i < sent + k; i++) {
+                datagrams += gso_segments[i];
+                coalesced += gso_segments[i] > 1 ? gso_segments[i] : 0;
+            }
+            histogram.record(datagrams);
+            sent += k;
+        }
+        return count;
+    }
+
+public:
+    explicit SendBatch(size_t capacity = kDefaultBatchSize)
+        : capacity(capacity), buffers(capacity * kMaxDatagramSize), iovecs(capacity * kMaxIovecs),
+          addrs(capacity), msgs(capacity), lengths(capacity), count(0), dropped(0),
+          histogram(capacity), gso(false), coalesced(0) {}
+
+    // Coalesce datagrams to the same destination with UDP_SEGMENT. Returns
+    // false, and keeps sending one datagram per message, if the kernel
+    // lacks UDP GSO.
+    bool enableGso(int fd) {
+        int segment = 0;
+        socklen_t len = sizeof(segment);
+        if (getsockopt(fd, IPPROTO_UDP, UDP_SEGMENT, &segment, &len) != 0) {
+            return false;
+        }
+        gso_msgs.resize(capacity);
+        gso_iovecs.resize(capacity * kMaxIovecs);
+        gso_controls.resize(capacity * kSegmentControlSize);
+        gso_first.resize(capacity);
+        gso_segments.resize(capacity);
+        gso = true;
+        return true;
+    }
+
+    bool gsoEnabled() const { return gso; }
+
+    bool full() const { return count == capacity; }
+    bool empty() const { return count == 0; }
+
+    // Reserve the next transmit slot; the caller writes at most
+    // kMaxDatagramSize bytes into it and then calls commit()
+    uint8_t* prepare(const struct sockaddr_in& addr, socklen_t addr_len) {
+        memset(&msgs[count], 0, sizeof(msgs[count]));
+        addrs[count] = addr;
+        struct iovec* iov = &iovecs[count * kMaxIovecs];
+        msgs[count].msg_hdr.msg_name = &addrs[count];
+        msgs[count].msg_hdr.msg_namelen = addr_len;
+        msgs[count].msg_hdr.msg_iov = iov;
+        msgs[count].msg_hdr.msg_iovlen = 1;
+        iov[0].iov_base = buffers.data() + count * kMaxDatagramSize;
+        return static_cast<uint8_t*>(iov[0].iov_base);
+    }
+
+    // Append caller-owned bytes after the slot's own bytes. Returns false
+    // if the datagram already has the maximum number of iovecs.
+    bool attach(const void* data, size_t len) {
+        struct msghdr& hdr = msgs[count].msg_hdr;
+        if (hdr.msg_iovlen == kMaxIovecs) {
+            return false;
+        }
+        if (len > 0) {
+            hdr.msg_iov[hdr.msg_iovlen].iov_base = const_cast<void*>(data);
+            hdr.msg_iov[hdr.msg_iovlen].iov_len = len;
+            hdr.msg_iovlen++;
+        }
+        return true;
+    }
+
+    // `len` is the number of bytes written into the slot's own buffer
+    void commit(size_t len) {
+        const struct msghdr& hdr = msgs[count].msg_hdr;
+        hdr.msg_iov[0].iov_len = len;
+        size_t total = 0;
+        for (size_t i = 0; i < hdr.msg_iovlen; i++) {
+            total += hdr.msg_iov[i].iov_len;
+        }
+        lengths[count] = static_cast<uint32_t>(total);
+        count++;
+    }
+
+    // Send everything queued with as few sendmmsg calls as possible.
+    // Datagrams the kernel will not take right now are dropped and counted.
+    void flush(int fd) {
+        size_t first = 0;
+        if (gso && count > 1) {
+            first = sendCoalesced(fd, coalesce());
+            if (first < count) {
+                QLOG_WARN("UDP GSO refused by the kernel ({}), sending datagrams one by one",
+                          strerror(errno));
+                gso = false;
+            }
+        }
+        if (first < count) {
+            sendAll(fd, msgs.data() + first, count - first);
+        }
+        count = 0;
+    }
+
+    // Forget everything queued without sending it
+    void discard() { count = 0; }
+
+    // The queued datagrams, one message each, for a caller that sends
+    // them by other means; it then reports back through completed()
+    struct mmsghdr* messages() { return msgs.data(); }
+    size_t size() const { return count; }
+
+    void completed(size_t sent, size_t failed) {
+        histogram.record(sent);
+        dropped += failed;
+        count = 0;
+    }
+
+    uint64_t droppedCount() const { return dropped; }
+    uint64_t coalescedCount() const { return coalesced; }
+    const BatchHistogram& stats() const { return histogram; }
+};
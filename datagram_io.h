@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "datagram_batch.h"
+
+// The server's I/O engine: where received datagrams come from and how a
+// SendBatch of responses leaves. The packet handlers only see a batch of
+// Datagram views and write into a SendBatch, so they are the same for
+// every backend.
+//
+// The server watches pollFd() for EPOLLIN (edge-triggered) and then calls
+// receive() until it returns a short batch. Views returned by begin() stay
+// valid until the next receive(); flush() must have sent every response
+// that refers to them before that.
+
+enum class IoBackend : uint8_t {
+    Socket,   // recvmmsg/sendmmsg, with UDP GSO/GRO where available
+    IoUring,  // multishot recvmsg into provided buffers, batched sendmsg
+};
+
+class DatagramIo {
+public:
+    virtual ~DatagramIo() = default;
+
+    // Fd that becomes readable when receive() has something to return
+    virtual int pollFd() const = 0;
+
+    // Next batch of datagrams: the number of entries read from the kernel,
+    // 0 when there is nothing, -1 on error (errno is set). A result below
+    // maxSize() means the source is drained.
+    virtual int receive() = 0;
+    virtual const Datagram* begin() const = 0;
+    virtual const Datagram* end() const = 0;
+    virtual size_t size() const = 0;
+    virtual size_t maxSize() const = 0;
+    virtual size_t maxDatagrams() const = 0;
+
+    // True once a receive() that returned `received` has left nothing
+    // behind that would not raise a new edge on pollFd()
+    virtual bool drained(int received) const { return static_cast<size_t>(received) < maxSize(); }
+
+    // Send everything queued in `tx` and leave it empty
+    virtual void flush(SendBatch& tx) = 0;
+
+    virtual const char* name() const = 0;
+    virtual const BatchHistogram& recvStats() const = 0;
+};
+
+// The plain socket path
+class SocketIo : public DatagramIo {
+private:
+    int fd;
+    RecvBatch rx;
+
+public:
+    SocketIo(int fd, size_t batch_size) : fd(fd), rx(batch_size) {}
+
+    // Turn on segmentation offload for `fd`, in both directions where the
+    // kernel has it. `tx` is the batch the server will flush through us.
+    void enableOffload(SendBatch& tx, bool& gso, bool& gro) {
+        gso = tx.enableGso(fd);
+        gro = rx.enableGro(fd);
+    }
+
+    int pollFd() const override { return fd; }
+    int receive() override { return rx.receive(fd); }
+    const Datagram* begin() const override { return rx.begin(); }
+    const Datagram* end() const override { return rx.end(); }
+    size_t size() const override { return rx.size(); }
+    size_t maxSize() const override { return rx.maxSize(); }
+    size_t maxDatagrams() const override { return rx.maxDatagrams(); }
+    void flush(SendBatch& tx) override { tx.flush(fd); }
+    const char* name() const override { return "recvmmsg"; }
+    const BatchHistogram& recvStats() const override { return rx.stats(); }
+};
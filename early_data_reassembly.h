@@ -0,0 +1,351 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "hash.h"
+#include "quic_protocol.h"
+#include "session_ticket.h"
+#include "timer_wheel.h"
+
+// Reassembly of 0-RTT early data split over several datagrams.
+//
+// A message is identified by its "connection" and the request id its
+// fragments share. The connection is the client's connection id when the
+// server knows it, so a client whose address changes mid-message still
+// completes it, and otherwise the client's address and port. The first
+// fragment to arrive opens the message with the total length it carries,
+// and the whole message gets one contiguous block at once, so fragments
+// are copied straight to their offset in any order and the completed
+// message is handed out in place.
+//
+// Pieces must tile the message: every piece but the last has the same
+// length, and piece N starts at N times that length. Distinct sequence
+// numbers then never overlap, so a message is whole exactly when its byte
+// count reaches the total; a piece that breaks the layout is refused.
+//
+// Blocks come from a slab arena: size classes are powers of two from
+// kMinBlock up to the largest message, each with a free list, carved from
+// one arena reserved up front. Its pages are only touched as blocks are
+// first used, and after warm-up nothing is allocated. Memory is bounded
+// three ways: a message may not exceed `max_message`, one connection may
+// not hold more than `max_connection_bytes`, and the arena is
+// `max_bytes`. A message that would break a bound is refused outright;
+// nothing already buffered is evicted to make room.
+//
+// Messages still incomplete after `timeout_ms` are dropped by expire(),
+// which hands them to the caller so the client can be told to fall back.
+//
+// Open messages are found through an open-addressed index hashed by the
+// connection alone, so one probe run holds every message of a connection
+// and also yields its buffered bytes. Not thread-safe; each worker has
+// its own, and SO_REUSEPORT keeps a client's datagrams on one worker
+// (a client that moves to another worker mid-message times out there).
+
+struct ReassemblyConfig {
+    size_t max_message = 16 * 1024;           // early data per request, at most kMaxEarlyDataSize
+    size_t max_connection_bytes = 64 * 1024;  // buffered per client address and port
+    size_t max_bytes = 16 << 20;              // arena per worker
+    uint32_t timeout_ms = 1000;
+};
+
+class EarlyDataReassembler {
+public:
+    enum class Result : uint8_t {
+        Buffered,   // stored, more fragments to come
+        Complete,   // message() holds the whole early data
+        Duplicate,  // this fragment was seen before; ignored
+        Invalid,    // does not agree with the message it belongs to
+    };
+
+    static constexpr uint32_t kNoMessage = UINT32_MAX;
+
+    // What the caller needs to answer a message: its sender, request id
+    // and the ticket its first fragment carried
+    struct Message {
+        uint64_t connection;
+        bool by_connection_id;  // `connection` is a connection id, not an address
+        uint64_t address;       // addressKey() of the latest piece's sender
+        uint32_t request_id;
+        bool has_request_id;
+        uint8_t ticket_len;
+        uint8_t ticket[kMaxTicketSize];
+        uint32_t total;
+        uint32_t received;
+        uint64_t seen;   // bit per fragment sequence number
+        uint32_t piece;  // length of every piece but the last, 0 until known
+        uint32_t block;
+        uint8_t size_class;
+        uint32_t timer;
+        uint32_t index_slot;
+        uint32_t next_free;
+    };
+
+private:
+    static constexpr size_t kMinBlockBits = 11;  // 2 KiB, about one datagram's worth
+    static constexpr size_t kMinBlock = size_t(1) << kMinBlockBits;
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+
+    ReassemblyConfig config;
+    std::unique_ptr<uint8_t[]> arena;  // default-initialized: pages stay untouched until used
+    size_t arena_size;
+    size_t arena_used;  // bump pointer; blocks below it are in use or on a free list
+    std::vector<uint32_t> free_blocks;  // per class, head of an intrusive list; offsets / kMinBlock
+    std::vector<Message> messages;
+    uint32_t free_message;
+    std::vector<uint32_t> index;  // message ids, kEmpty for a free slot
+    uint64_t index_mask;
+    uint64_t seed;
+    TimerWheel<uint32_t> timeouts;  // in milliseconds
+    size_t open_count;
+    size_t buffered_bytes;
+
+    static size_t classOf(size_t size) {
+        size_t cls = 0;
+        while ((kMinBlock << cls) < size) {
+            cls++;
+        }
+        return cls;
+    }
+
+    uint8_t* blockData(uint32_t block) { return arena.get() + static_cast<size_t>(block) * kMinBlock; }
+
+    // Free blocks keep the next free block's number in their first word
+    uint32_t allocateBlock(size_t cls) {
+        uint32_t block = free_blocks[cls];
+        if (block != kEmpty) {
+            memcpy(&free_blocks[cls], blockData(block), sizeof(uint32_t));
+            return block;
+        }
+        size_t size = kMinBlock << cls;
+        if (arena_size - arena_used < size) {
+            return kEmpty;
+        }
+        block = static_cast<uint32_t>(arena_used / kMinBlock);
+        arena_used += size;
+        return block;
+    }
+
+    void freeBlock(uint32_t block, size_t cls) {
+        memcpy(blockData(block), &free_blocks[cls], sizeof(uint32_t));
+        free_blocks[cls] = block;
+    }
+
+    // Whether a piece of `len` bytes keeps to the layout of `message`;
+    // learns the piece length from the first piece that shows it
+    static bool tiles(Message& message, const EarlyDataFragment& fragment, size_t len) {
+        uint64_t start = static_cast<uint64_t>(fragment.seq) * message.piece;
+        bool last = fragment.offset + len == message.total;
+        if (message.piece != 0) {
+            return fragment.offset == start && (last ? len <= message.piece : len == message.piece);
+        }
+        if (!last) {
+            if (len == 0 || fragment.offset != static_cast<uint64_t>(fragment.seq) * len) {
+                return false;
+            }
+            message.piece = static_cast<uint32_t>(len);
+            return true;
+        }
+        if (fragment.seq == 0) {
+            return fragment.offset == 0;  // the whole message in one piece
+        }
+        if (fragment.offset == 0 || fragment.offset % fragment.seq != 0 || fragment.offset / fragment.seq < len) {
+            return false;
+        }
+        message.piece = fragment.offset / fragment.seq;
+        return true;
+    }
+
+    uint64_t home(uint64_t connection) const { return hashMix(connection, seed) & index_mask; }
+
+    // Walk the probe run of `connection`; `fn(Message&)` returns true to stop
+    template <typename Fn>
+    void forConnection(uint64_t connection, bool by_connection_id, Fn&& fn) {
+        for (uint64_t slot = home(connection);; slot = (slot + 1) & index_mask) {
+            uint32_t id = index[slot];
+            if (id == kEmpty) {
+                return;
+            }
+            if (messages[id].connection == connection && messages[id].by_connection_id == by_connection_id &&
+                fn(messages[id])) {
+                return;
+            }
+        }
+    }
+
+    // Backward-shift deletion keeps probe runs free of holes
+    void unindex(uint32_t slot) {
+        uint64_t hole = slot;
+        for (uint64_t next = (hole + 1) & index_mask;; next = (next + 1) & index_mask) {
+            uint32_t id = index[next];
+            if (id == kEmpty) {
+                break;
+            }
+            uint64_t want = home(messages[id].connection);
+            // Move it into the hole unless its home lies cyclically in (hole, next]
+            bool stays = hole <= next ? (hole < want && want <= next) : (hole < want || want <= next);
+            if (!stays) {
+                index[hole] = id;
+                messages[id].index_slot = static_cast<uint32_t>(hole);
+                hole = next;
+            }
+        }
+        index[hole] = kEmpty;
+    }
+
+public:
+    EarlyDataReassembler(const ReassemblyConfig& reassembly_config, uint64_t now_ms)
+        : config(reassembly_config), arena_used(0), free_message(kEmpty), index_mask(0), seed(randomSeed()),
+          timeouts(now_ms), open_count(0), buffered_bytes(0) {
+        config.max_message = std::clamp<size_t>(config.max_message, 1, kMaxEarlyDataSize);
+        config.max_connection_bytes = std::max(config.max_connection_bytes, kMinBlock << classOf(config.max_message));
+        arena_size = std::max(config.max_bytes / kMinBlock, size_t(1)) * kMinBlock;
+        arena.reset(new uint8_t[arena_size]);
+        free_blocks.assign(classOf(config.max_message) + 1, kEmpty);
+
+        // Every open message holds at least one block
+        size_t max_messages = arena_size / kMinBlock;
+        messages.resize(max_messages);
+        for (size_t i = 0; i < max_messages; i++) {
+            messages[i].next_free = i + 1 < max_messages ? static_cast<uint32_t>(i + 1) : kEmpty;
+        }
+        free_message = 0;
+        size_t slots = 2;
+        while (slots < max_messages * 2) {
+            slots <<= 1;
+        }
+        index.assign(slots, kEmpty);
+        index_mask = slots - 1;
+    }
+
+    EarlyDataReassembler(const EarlyDataReassembler&) = delete;
+    EarlyDataReassembler& operator=(const EarlyDataReassembler&) = delete;
+
+    // The open message of `connection` with this request id, or kNoMessage
+    uint32_t find(uint64_t connection, bool by_connection_id, const RequestId& request_id) {
+        uint32_t found = kNoMessage;
+        forConnection(connection, by_connection_id, [&](Message& message) {
+            if (message.has_request_id == request_id.has_value() &&
+                (!request_id || message.request_id == *request_id)) {
+                found = static_cast<uint32_t>(&message - messages.data());
+                return true;
+            }
+            return false;
+        });
+        return found;
+    }
+
+    // Start a message of `total` bytes for a fragment that found none.
+    // Returns kNoMessage if a memory bound does not allow it.
+    uint32_t open(uint64_t connection, bool by_connection_id, uint64_t address, const RequestId& request_id,
+                  ByteView ticket, uint32_t total, uint64_t now_ms) {
+        if (total == 0 || total > config.max_message || ticket.size > kMaxTicketSize || free_message == kEmpty) {
+            return kNoMessage;
+        }
+        size_t cls = classOf(total);
+        size_t connection_bytes = 0;
+        forConnection(connection, by_connection_id, [&](Message& message) {
+            connection_bytes += kMinBlock << message.size_class;
+            return false;
+        });
+        if (connection_bytes + (kMinBlock << cls) > config.max_connection_bytes) {
+            return kNoMessage;
+        }
+        uint32_t block = allocateBlock(cls);
+        if (block == kEmpty) {
+            return kNoMessage;
+        }
+
+        uint32_t id = free_message;
+        Message& message = messages[id];
+        free_message = message.next_free;
+        message.connection = connection;
+        message.by_connection_id = by_connection_id;
+        message.address = address;
+        message.request_id = request_id.value_or(0);
+        message.has_request_id = request_id.has_value();
+        message.ticket_len = static_cast<uint8_t>(ticket.size);
+        memcpy(message.ticket, ticket.data, ticket.size);
+        message.total = total;
+        message.received = 0;
+        message.seen = 0;
+        message.piece = 0;
+        message.block = block;
+        message.size_class = static_cast<uint8_t>(cls);
+        message.timer = timeouts.schedule(now_ms + config.timeout_ms, id);
+
+        uint64_t slot = home(connection);
+        while (index[slot] != kEmpty) {
+            slot = (slot + 1) & index_mask;
+        }
+        index[slot] = id;
+        message.index_slot = static_cast<uint32_t>(slot);
+        open_count++;
+        buffered_bytes += kMinBlock << cls;
+        return id;
+    }
+
+    // Copy one fragment into message `id`. Every fragment must carry the
+    // ticket and total length the first one did and keep to the layout.
+    // A piece that is taken moves the message to its sender's `address`.
+    Result add(uint32_t id, uint64_t address, ByteView ticket, const EarlyDataFragment& fragment, ByteView piece) {
+        Message& message = messages[id];
+        if (fragment.total != message.total || ticket.size != message.ticket_len ||
+            memcmp(ticket.data, message.ticket, ticket.size) != 0) {
+            return Result::Invalid;
+        }
+        uint64_t bit = uint64_t(1) << fragment.seq;
+        if (message.seen & bit) {
+            return Result::Duplicate;
+        }
+        if (piece.size > message.total - message.received || !tiles(message, fragment, piece.size)) {
+            return Result::Invalid;
+        }
+        message.seen |= bit;
+        message.address = address;
+        message.received += static_cast<uint32_t>(piece.size);
+        memcpy(blockData(message.block) + fragment.offset, piece.data, piece.size);
+        return message.received == message.total ? Result::Complete : Result::Buffered;
+    }
+
+    const Message& info(uint32_t id) const { return messages[id]; }
+
+    // The early data of a complete message, valid until release()
+    ByteView message(uint32_t id) {
+        return {blockData(messages[id].block), messages[id].total};
+    }
+
+    // Drop message `id` and give its block back
+    void release(uint32_t id) {
+        Message& message = messages[id];
+        timeouts.cancel(message.timer);
+        unindex(message.index_slot);
+        freeBlock(message.block, message.size_class);
+        buffered_bytes -= kMinBlock << message.size_class;
+        open_count--;
+        message.next_free = free_message;
+        free_message = id;
+    }
+
+    // Drop messages open longer than the timeout, at most `budget`, after
+    // handing each to `expired(const Message&)`. Returns how many.
+    template <typename Fn>
+    size_t expire(uint64_t now_ms, size_t budget, Fn&& expired) {
+        size_t count = 0;
+        timeouts.advance(now_ms, budget, [&](uint32_t id) {
+            expired(static_cast<const Message&>(messages[id]));
+            messages[id].timer = kNoTimer;  // fired; nothing to cancel
+            release(id);
+            count++;
+        });
+        return count;
+    }
+
+    size_t openMessages() const { return open_count; }
+    size_t bufferedBytes() const { return buffered_bytes; }
+    size_t arenaBytes() const { return arena_size; }
+    size_t maxMessage() const { return config.max_message; }
+};
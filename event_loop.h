@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "logger.h"
+
+// Minimal epoll-based event loop with one-shot/repeating timers.
+// File descriptors are registered edge-triggered, so handlers must drain
+// their fd until EAGAIN. stop() only writes to an eventfd and is therefore
+// safe to call from a signal handler or from another thread.
+
+class EventLoop {
+public:
+    using Clock = std::chrono::steady_clock;
+    using IoHandler = std::function<void(uint32_t events)>;
+    using TimerHandler = std::function<void()>;
+
+private:
+    struct Timer {
+        Clock::time_point deadline;
+        uint64_t id;
+
+        bool operator>(const Timer& other) const {
+            return deadline > other.deadline;
+        }
+    };
+
+    struct TimerEntry {
+        Clock::duration interval;  // zero for one-shot timers
+        TimerHandler handler;
+    };
+
+    int epoll_fd;
+    int wake_fd;
+    std::atomic<bool> stop_requested;
+    std::unordered_map<int, IoHandler> io_handlers;
+    std::vector<IoHandler> retired_handlers;  // removed while dispatching
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timer_queue;
+    std::unordered_map<uint64_t, TimerEntry> timers;
+    uint64_t next_timer_id;
+
+    static constexpr int kMaxEvents = 64;
+
+    // Milliseconds until the earliest pending timer, or -1 to block forever
+    int nextTimeoutMs() {
+        while (!timer_queue.empty() && timers.find(timer_queue.top().id) == timers.end()) {
+            timer_queue.pop();  // drop cancelled timers lazily
+        }
+        if (timer_queue.empty()) {
+            return -1;
+        }
+
+        auto now = Clock::now();
+        auto deadline = timer_queue.top().deadline;
+        if (deadline <= now) {
+            return 0;
+        }
+
+        // Round up so we never wake before the deadline and spin
+        auto wait = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count();
+        return static_cast<int>((wait + 999) / 1000);
+    }
+
+    void runExpiredTimers() {
+        auto now = Clock::now();
+        while (!timer_queue.empty() && timer_queue.top().deadline <= now) {
+            Timer timer = timer_queue.top();
+            timer_queue.pop();
+
+            auto it = timers.find(timer.id);
+            if (it == timers.end()) {
+                continue;  // cancelled
+            }
+
+            if (it->second.interval.count() > 0) {
+                timer_queue.push({timer.deadline + it->second.interval, timer.id});
+                TimerHandler handler = it->second.handler;
+                handler();
+            } else {
+                TimerHandler handler = std::move(it->second.handler);
+                timers.erase(it);
+                handler();
+            }
+        }
+    }
+
+    void drainWakeFd() {
+        uint64_t value;
+        while (read(wake_fd, &value, sizeof(value)) > 0) {
+        }
+    }
+
+public:
+    EventLoop() : epoll_fd(-1), wake_fd(-1), stop_requested(false), next_timer_id(1) {}
+
+    ~EventLoop() {
+        if (wake_fd >= 0) {
+            close(wake_fd);
+        }
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool init() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            QLOG_ERROR("Failed to create epoll instance: {}", strerror(errno));
+            return false;
+        }
+
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0) {
+            QLOG_ERROR("Failed to create eventfd: {}", strerror(errno));
+            return false;
+        }
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = wake_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0) {
+            QLOG_ERROR("Failed to register eventfd: {}", strerror(errno));
+            return false;
+        }
+
+        return true;
+    }
+
+    // Register a non-blocking fd; EPOLLET is always added
+    bool add(int fd, uint32_t events, IoHandler handler) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            QLOG_ERROR("Failed to register fd {}: {}", fd, strerror(errno));
+            return false;
+        }
+        io_handlers[fd] = std::move(handler);
+        return true;
+    }
+
+    // Safe to call from inside the fd's own handler
+    void remove(int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        auto it = io_handlers.find(fd);
+        if (it != io_handlers.end()) {
+            retired_handlers.push_back(std::move(it->second));
+            io_handlers.erase(it);
+        }
+    }
+
+    // Schedule a handler after `delay`; a non-zero `interval` makes it repeat
+    template <typename Rep, typename Period>
+    uint64_t addTimer(std::chrono::duration<Rep, Period> delay, TimerHandler handler,
+                      std::chrono::duration<Rep, Period> interval = std::chrono::duration<Rep, Period>::zero()) {
+        uint64_t id = next_timer_id++;
+        timers[id] = {std::chrono::duration_cast<Clock::duration>(interval), std::move(handler)};
+        timer_queue.push({Clock::now() + delay, id});
+        return id;
+    }
+
+    void cancelTimer(uint64_t id) {
+        timers.erase(id);
+    }
+
+    // Run until stop() is called
+    void run() {
+        struct epoll_event events[kMaxEvents];
+
+        while (!stop_requested.load(std::memory_order_acquire)) {
+            int n = epoll_wait(epoll_fd, events, kMaxEvents, nextTimeoutMs());
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                QLOG_ERROR("epoll_wait failed: {}", strerror(errno));
+                break;
+            }
+
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == wake_fd) {
+                    drainWakeFd();
+                    continue;
+                }
+
+                auto it = io_handlers.find(fd);
+                if (it != io_handlers.end()) {
+                    it->second(events[i].events);
+                }
+            }
+            retired_handlers.clear();
+
+            runExpiredTimers();
+        }
+    }
+
+    // Async-signal-safe: only touches an atomic and writes to the eventfd
+    void stop() {
+        stop_requested.store(true, std::memory_order_release);
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    bool stopped() const {
+        return stop_requested.load(std::memory_order_acquire);
+    }
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+
+// Fast seeded 64-bit hash for in-memory tables and filters (wyhash-style
+// multiply-fold mixing). Not cryptographic; seed it randomly per process so
+// peers cannot precompute colliding inputs.
+
+static constexpr uint64_t kHashP0 = 0xa0761d6478bd642fULL;
+static constexpr uint64_t kHashP1 = 0xe7037ed1a0b428dbULL;
+static constexpr uint64_t kHashP2 = 0x8ebc6af09c88c6e3ULL;
+static constexpr uint64_t kHashP3 = 0x589965cc75374cc3ULL;
+
+inline uint64_t hashMix(uint64_t a, uint64_t b) {
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t hashLoad64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t hashBytes(const void* data, size_t len, uint64_t seed) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t h = seed ^ kHashP0;
+    size_t remaining = len;
+
+    while (remaining >= 16) {
+        h = hashMix(hashLoad64(p) ^ kHashP1, hashLoad64(p + 8) ^ h);
+        p += 16;
+        remaining -= 16;
+    }
+    if (remaining >= 8) {
+        h = hashMix(hashLoad64(p) ^ kHashP1, h ^ kHashP2);
+        p += 8;
+        remaining -= 8;
+    }
+    if (remaining > 0) {
+        uint64_t tail = 0;
+        memcpy(&tail, p, remaining);
+        h = hashMix(tail ^ kHashP1, h ^ kHashP3);
+    }
+
+    return hashMix(h ^ kHashP2, static_cast<uint64_t>(len) ^ kHashP3);
+}
+
+inline uint64_t randomSeed() {
+    std::random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) ^ rd();
+}
@@ -0,0 +1,423 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <unistd.h>
+
+// Asynchronous logger.
+//
+// QLOG_* calls capture their arguments in binary form into a per-thread
+// lock-free ring. Nothing is formatted and nothing is written on the
+// calling thread. A background thread drains all rings, formats the
+// messages, and writes them in batches: Debug/Info go to stdout and
+// Warn/Error go to stderr. If a ring is full, the message is dropped and
+// counted; the caller never blocks. Messages below LOG_MIN_LEVEL are
+// removed at compile time.
+//
+// The format string must be a literal and uses "{}" placeholders.
+// "{:.Nf}" prints a floating-point argument with N decimals.
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+
+enum class LogLevel : uint8_t {
+    Debug = LOG_LEVEL_DEBUG,
+    Info = LOG_LEVEL_INFO,
+    Warn = LOG_LEVEL_WARN,
+    Error = LOG_LEVEL_ERROR,
+};
+
+#define QLOG_AT(level_value, level, ...) \
+    do { \
+        if (level_value >= LOG_MIN_LEVEL) { \
+            logWrite(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define QLOG_DEBUG(...) QLOG_AT(LOG_LEVEL_DEBUG, LogLevel::Debug, __VA_ARGS__)
+#define QLOG_INFO(...) QLOG_AT(LOG_LEVEL_INFO, LogLevel::Info, __VA_ARGS__)
+#define QLOG_WARN(...) QLOG_AT(LOG_LEVEL_WARN, LogLevel::Warn, __VA_ARGS__)
+#define QLOG_ERROR(...) QLOG_AT(LOG_LEVEL_ERROR, LogLevel::Error, __VA_ARGS__)
+
+// One captured message; arguments are stored as tagged binary values
+struct LogRecord {
+    static constexpr size_t kSize = 256;
+    static constexpr size_t kArgBytes = kSize - sizeof(uint64_t) - sizeof(const char*) - 4;
+
+    uint64_t timestamp_ns;
+    const char* format;
+    uint8_t level;
+    uint8_t truncated;
+    uint16_t arg_len;
+    uint8_t args[kArgBytes];
+};
+
+static_assert(sizeof(LogRecord) == LogRecord::kSize, "log records are fixed size");
+
+enum class LogArgKind : uint8_t { Signed, Unsigned, Double, Char, Bool, String, Pointer };
+
+// Single-producer/single-consumer ring owned by one logging thread
+class LogRing {
+private:
+    static constexpr size_t kCapacity = 4096;  // power of two
+
+    alignas(64) std::atomic<uint64_t> head;  // written by the producer
+    alignas(64) std::atomic<uint64_t> tail;  // written by the drain thread
+    alignas(64) std::atomic<uint64_t> dropped;
+    std::unique_ptr<LogRecord[]> records;
+
+public:
+    LogRing() : head(0), tail(0), dropped(0), records(new LogRecord[kCapacity]) {}
+
+    // Producer side: a slot to fill, or nullptr when the ring is full
+    LogRecord* claim() {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= kCapacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &records[h & (kCapacity - 1)];
+    }
+
+    void publish() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer side: hand every pending record to `fn`; returns how many
+    template <typename Fn>
+    size_t drain(Fn&& fn) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        for (uint64_t i = t; i < h; i++) {
+            fn(records[i & (kCapacity - 1)]);
+        }
+        tail.store(h, std::memory_order_release);
+        return h - t;
+    }
+
+    uint64_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+class Logger {
+private:
+    static constexpr size_t kOutBufferSize = 64 * 1024;
+
+    // Output buffer for one fd; flushed with a single write() per batch
+    struct Sink {
+        int fd;
+        size_t len;
+        char buf[kOutBufferSize];
+
+        void flush() {
+            size_t off = 0;
+            while (off < len) {
+                ssize_t n = ::write(fd, buf + off, len - off);
+                if (n <= 0) {
+                    break;
+                }
+                off += n;
+            }
+            len = 0;
+        }
+
+        void append(const char* data, size_t n) {
+            while (n > 0) {
+                if (len == kOutBufferSize) {
+                    flush();
+                }
+                size_t chunk = std::min(n, kOutBufferSize - len);
+                memcpy(buf + len, data, chunk);
+                len += chunk;
+                data += chunk;
+                n -= chunk;
+            }
+        }
+    };
+
+    std::mutex rings_mutex;  // only taken when a thread logs for the first time
+    std::vector<std::shared_ptr<LogRing>> rings;
+    std::vector<std::shared_ptr<LogRing>> drain_list;  // drain thread's copy, reused
+    std::atomic<bool> running;
+    std::thread drain_thread;
+    std::unique_ptr<Sink> out;
+    std::unique_ptr<Sink> err;
+    uint64_t reported_drops;
+    bool verbose;
+    std::chrono::steady_clock::time_point start_time;
+
+    Logger()
+        : running(true), out(new Sink{STDOUT_FILENO, 0, {}}), err(new Sink{STDERR_FILENO, 0, {}}),
+          reported_drops(0), verbose(std::getenv("QUIC_LOG_VERBOSE") != nullptr),
+          start_time(std::chrono::steady_clock::now()) {
+        drain_thread = std::thread([this]() { drainLoop(); });
+    }
+
+    template <typename T>
+    static T readArg(const uint8_t*& p) {
+        T value;
+        memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return value;
+    }
+
+    template <typename T>
+    static void appendNumber(Sink& sink, T value) {
+        char tmp[32];
+        auto result = std::to_chars(tmp, tmp + sizeof(tmp), value);
+        sink.append(tmp, result.ptr - tmp);
+    }
+
+    // Format one argument; returns false when the record has no more
+    static bool appendArg(Sink& sink, const uint8_t*& p, const uint8_t* end, int precision) {
+        if (p >= end) {
+            return false;
+        }
+        auto kind = static_cast<LogArgKind>(*p++);
+        switch (kind) {
+            case LogArgKind::Signed:
+                appendNumber(sink, readArg<int64_t>(p));
+                break;
+            case LogArgKind::Unsigned:
+                appendNumber(sink, readArg<uint64_t>(p));
+                break;
+            case LogArgKind::Double: {
+                char tmp[64];
+                int n = snprintf(tmp, sizeof(tmp), "%.*f", precision < 0 ? 6 : precision, readArg<double>(p));
+                sink.append(tmp, std::min<size_t>(n, sizeof(tmp) - 1));
+                break;
+            }
+            case LogArgKind::Char: {
+                char c = readArg<char>(p);
+                sink.append(&c, 1);
+                break;
+            }
+            case LogArgKind::Bool: {
+                bool value = readArg<bool>(p);
+                sink.append(value ? "true" : "false", value ? 4 : 5);
+                break;
+            }
+            case LogArgKind::String: {
+                uint16_t len = readArg<uint16_t>(p);
+                sink.append(reinterpret_cast<const char*>(p), len);
+                p += len;
+                break;
+            }
+            case LogArgKind::Pointer: {
+                char tmp[32];
+                int n = snprintf(tmp, sizeof(tmp), "%p", readArg<const void*>(p));
+                sink.append(tmp, std::min<size_t>(n, sizeof(tmp) - 1));
+                break;
+            }
+        }
+        return true;
+    }
+
+    void formatRecord(const LogRecord& record) {
+        Sink& sink = record.level >= static_cast<uint8_t>(LogLevel::Warn) ? *err : *out;
+
+        if (verbose) {
+            static const char* kLevelNames[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+            char prefix[64];
+            uint64_t start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                start_time.time_since_epoch()).count();
+            uint64_t rel_us = (record.timestamp_ns - start_ns) / 1000;
+            int n = snprintf(prefix, sizeof(prefix), "[%llu.%06llu %s] ",
+                             static_cast<unsigned long long>(rel_us / 1000000),
+                             static_cast<unsigned long long>(rel_us % 1000000),
+                             kLevelNames[record.level & 3]);
+            sink.append(prefix, std::min<size_t>(n, sizeof(prefix) - 1));
+        }
+
+        const uint8_t* p = record.args;
+        const uint8_t* end = record.args + record.arg_len;
+        for (const char* f = record.format; *f; f++) {
+            if (f[0] == '{' && f[1] == '}') {
+                appendArg(sink, p, end, -1);
+                f++;
+            } else if (f[0] == '{' && f[1] == ':' && f[2] == '.' && f[3] >= '0' && f[3] <= '9' &&
+                       f[4] == 'f' && f[5] == '}') {
+                appendArg(sink, p, end, f[3] - '0');
+                f += 5;
+            } else {
+                sink.append(f, 1);
+            }
+        }
+        if (record.truncated) {
+            sink.append("...", 3);
+        }
+        sink.append("\n", 1);
+    }
+
+    // Drain every ring once; returns the number of records written
+    size_t drainOnce() {
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            drain_list.assign(rings.begin(), rings.end());
+        }
+
+        size_t drained = 0;
+        uint64_t drops = 0;
+        for (auto& ring : drain_list) {
+            drained += ring->drain([this](const LogRecord& record) { formatRecord(record); });
+            drops += ring->droppedCount();
+        }
+        if (drops > reported_drops) {
+            char msg[96];
+            int n = snprintf(msg, sizeof(msg), "logger: dropped %llu messages (ring full)\n",
+                             static_cast<unsigned long long>(drops - reported_drops));
+            err->append(msg, std::min<size_t>(n, sizeof(msg) - 1));
+            reported_drops = drops;
+        }
+        out->flush();
+        err->flush();
+        return drained;
+    }
+
+    void drainLoop() {
+        // Back off while idle so an idle process does not wake 1000x a second
+        auto idle_sleep = std::chrono::microseconds(500);
+        while (running.load(std::memory_order_acquire)) {
+            if (drainOnce() > 0) {
+                idle_sleep = std::chrono::microseconds(500);
+            } else {
+                std::this_thread::sleep_for(idle_sleep);
+                idle_sleep = std::min(idle_sleep * 2, std::chrono::microseconds(32000));
+            }
+        }
+        drainOnce();
+    }
+
+public:
+    ~Logger() {
+        running.store(false, std::memory_order_release);
+        if (drain_thread.joinable()) {
+            drain_thread.join();
+        }
+    }
+
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    // The calling thread's ring, registered on first use
+    LogRing& threadRing() {
+        thread_local std::shared_ptr<LogRing> ring;
+        if (!ring) {
+            ring = std::make_shared<LogRing>();
+            std::lock_guard<std::mutex> lock(rings_mutex);
+            rings.push_back(ring);
+        }
+        return *ring;
+    }
+
+    uint64_t dropped() {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        uint64_t total = 0;
+        for (auto& ring : rings) {
+            total += ring->droppedCount();
+        }
+        return total;
+    }
+};
+
+// Binary argument capture
+
+struct LogArgWriter {
+    LogRecord& record;
+    bool overflow = false;
+
+    bool reserve(size_t n) {
+        if (overflow || record.arg_len + n > LogRecord::kArgBytes) {
+            overflow = true;
+            record.truncated = 1;
+            return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    void put(LogArgKind kind, T value) {
+        if (!reserve(1 + sizeof(value))) {
+            return;
+        }
+        record.args[record.arg_len++] = static_cast<uint8_t>(kind);
+        memcpy(record.args + record.arg_len, &value, sizeof(value));
+        record.arg_len += sizeof(value);
+    }
+
+    void putString(const char* data, size_t len) {
+        if (!reserve(1 + sizeof(uint16_t))) {
+            return;
+        }
+        size_t room = LogRecord::kArgBytes - record.arg_len - 1 - sizeof(uint16_t);
+        if (len > room) {
+            len = room;
+            record.truncated = 1;
+            overflow = true;
+        }
+        uint16_t len16 = static_cast<uint16_t>(len);
+        record.args[record.arg_len++] = static_cast<uint8_t>(LogArgKind::String);
+        memcpy(record.args + record.arg_len, &len16, sizeof(len16));
+        record.arg_len += sizeof(len16);
+        memcpy(record.args + record.arg_len, data, len);
+        record.arg_len += len;
+    }
+
+    void add(bool value) { put(LogArgKind::Bool, value); }
+    void add(char value) { put(LogArgKind::Char, value); }
+    void add(double value) { put(LogArgKind::Double, value); }
+    void add(float value) { put(LogArgKind::Double, static_cast<double>(value)); }
+    void add(const char* value) { putString(value, value ? strlen(value) : 0); }
+    void add(std::string_view value) { putString(value.data(), value.size()); }
+    void add(const std::string& value) { putString(value.data(), value.size()); }
+    void add(const void* value) { put(LogArgKind::Pointer, value); }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+    add(T value) { put(LogArgKind::Signed, static_cast<int64_t>(value)); }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+    add(T value) { put(LogArgKind::Unsigned, static_cast<uint64_t>(value)); }
+};
+
+template <typename... Args>
+void logWrite(LogLevel level, const char* format, const Args&... args) {
+    LogRing& ring = Logger::instance().threadRing();
+    LogRecord* record = ring.claim();
+    if (!record) {
+        return;
+    }
+
+    record->timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    record->format = format;
+    record->level = static_cast<uint8_t>(level);
+    record->truncated = 0;
+    record->arg_len = 0;
+
+    LogArgWriter writer{*record};
+    (writer.add(args), ...);
+    (void)writer;
+    ring.publish();
+}
@@ -0,0 +1,462 @@
+#pragma once
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "event_loop.h"
+#include "logger.h"
+
+// Server instrumentation. Every counter and histogram has exactly one
+// writer (the worker that owns it), so updates are a relaxed load and
+// store rather than a locked read-modify-write. Any thread may read them
+// at any time to render a snapshot.
+
+class MetricCounter {
+private:
+    std::atomic<uint64_t> value{0};
+
+public:
+    void add(uint64_t n = 1) {
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void set(uint64_t n) { value.store(n, std::memory_order_relaxed); }
+    uint64_t load() const { return value.load(std::memory_order_relaxed); }
+};
+
+// HDR-style log-linear histogram of nanosecond values. Each power of two
+// is split into 32 linear sub-buckets, so any recorded value is off by at
+// most ~3%. Values from 0 to ~68 s are tracked; larger ones saturate.
+class LatencyHistogram {
+public:
+    static constexpr unsigned kSubBucketBits = 5;
+    static constexpr unsigned kMaxValueBits = 36;
+    static constexpr size_t kSubBuckets = size_t(1) << kSubBucketBits;
+    static constexpr size_t kBuckets = (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+    static constexpr uint64_t kMaxValue = (uint64_t(1) << kMaxValueBits) - 1;
+
+    static size_t bucketOf(uint64_t value) {
+        if (value > kMaxValue) {
+            value = kMaxValue;
+        }
+        if (value < kSubBuckets) {
+            return value;
+        }
+        unsigned exponent = 63 - __builtin_clzll(value);
+        unsigned shift = exponent - kSubBucketBits;
+        return (shift + 1) * kSubBuckets + ((value >> shift) - kSubBuckets);
+    }
+
+    // Smallest and largest value that land in `bucket`
+    static uint64_t bucketLow(size_t bucket) {
+        if (bucket < kSubBuckets) {
+            return bucket;
+        }
+        unsigned shift = bucket / kSubBuckets - 1;
+        return (kSubBuckets + bucket % kSubBuckets) << shift;
+    }
+
+    static uint64_t bucketHigh(size_t bucket) {
+        if (bucket < kSubBuckets) {
+            return bucket;
+        }
+        unsigned shift = bucket / kSubBuckets - 1;
+        return bucketLow(bucket) + (uint64_t(1) << shift) - 1;
+    }
+
+    // Plain copy of a histogram, or of several added together
+    struct Snapshot {
+        uint64_t counts[kBuckets];
+        uint64_t total;
+        uint64_t sum;
+
+        void clear() {
+            memset(counts, 0, sizeof(counts));
+            total = 0;
+            sum = 0;
+        }
+
+        // Samples at or below `value`, counting whole buckets only
+        uint64_t countAtOrBelow(uint64_t value) const {
+            uint64_t n = 0;
+            for (size_t b = 0; b < kBuckets && bucketHigh(b) <= value; b++) {
+                n += counts[b];
+            }
+            return n;
+        }
+
+        // Upper edge of the bucket holding the q-th quantile, 0 when empty
+        uint64_t quantile(double q) const {
+            if (total == 0) {
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(q * total);
+            if (rank >= total) {
+                rank = total - 1;
+            }
+            uint64_t seen = 0;
+            for (size_t b = 0; b < kBuckets; b++) {
+                seen += counts[b];
+                if (seen > rank) {
+                    return bucketHigh(b);
+                }
+            }
+            return kMaxValue;
+        }
+    };
+
+private:
+    std::atomic<uint64_t> counts[kBuckets];
+    MetricCounter total;
+    MetricCounter sum;
+
+public:
+    LatencyHistogram() {
+        for (auto& count : counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(uint64_t value_ns) {
+        std::atomic<uint64_t>& count = counts[bucketOf(value_ns)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        total.add();
+        sum.add(value_ns);
+    }
+
+    void addTo(Snapshot& snapshot) const {
+        for (size_t b = 0; b < kBuckets; b++) {
+            snapshot.counts[b] += counts[b].load(std::memory_order_relaxed);
+        }
+        snapshot.total += total.load();
+        snapshot.sum += sum.load();
+    }
+};
+
+// Appends metrics in the Prometheus text exposition format (version
+// 0.0.4). Write each family's header with family() and then all of its
+// samples. Appending reuses the output string's capacity, so rendering
+// stops allocating once the string has grown to size.
+class PrometheusWriter {
+private:
+    std::string& out;
+
+    void appendNumber(uint64_t value) {
+        char buf[24];
+        auto result = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, result.ptr - buf);
+    }
+
+    void appendNumber(double value) {
+        char buf[32];
+        auto result = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, result.ptr - buf);
+    }
+
+    // Writes `name``suffix` and opens the label list if there is one
+    void appendSeries(std::string_view name, std::string_view suffix, std::string_view labels) {
+        out.append(name).append(suffix);
+        if (!labels.empty()) {
+            out.append("{").append(labels);
+        }
+    }
+
+public:
+    explicit PrometheusWriter(std::string& out) : out(out) {}
+
+    void family(std::string_view name, std::string_view type, std::string_view help) {
+        out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+        out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    }
+
+    // `labels` is the already formatted label list without braces, e.g.
+    // worker="0",type="handshake"; it may be empty
+    template <typename T>
+    void sample(std::string_view name, std::string_view labels, T value) {
+        out.append(name);
+        if (!labels.empty()) {
+            out.append("{").append(labels).append("}");
+        }
+        out.append(" ");
+        appendNumber(value);
+        out.append("\n");
+    }
+
+    // Builds a label list in `buf`; both keys and values must be plain
+    // identifiers, which is all the server ever emits
+    static std::string_view labels(std::string& buf, std::initializer_list<std::pair<std::string_view, std::string_view>> pairs) {
+        buf.clear();
+        for (const auto& pair : pairs) {
+            if (!buf.empty()) {
+                buf.append(",");
+            }
+            buf.append(pair.first).append("=\"").append(pair.second).append("\"");
+        }
+        return buf;
+    }
+
+    // A histogram family in seconds: cumulative buckets at the standard
+    // latency ladder plus _sum and _count
+    void histogram(std::string_view name, std::string_view labels, const LatencyHistogram::Snapshot& snapshot) {
+        static constexpr double kBoundsSeconds[] = {
+            1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+            1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1.0,
+        };
+        for (double bound : kBoundsSeconds) {
+            appendSeries(name, "_bucket", labels);
+            out.append(labels.empty() ? "{le=\"" : ",le=\"");
+            appendNumber(bound);
+            out.append("\"} ");
+            appendNumber(snapshot.countAtOrBelow(static_cast<uint64_t>(bound * 1e9 + 0.5)));
+            out.append("\n");
+        }
+        appendSeries(name, "_bucket", labels);
+        out.append(labels.empty() ? "{le=\"+Inf\"} " : ",le=\"+Inf\"} ");
+        appendNumber(snapshot.total);
+        out.append("\n");
+
+        appendSeries(name, "_sum", labels);
+        out.append(labels.empty() ? " " : "} ");
+        appendNumber(snapshot.sum / 1e9);
+        out.append("\n");
+        appendSeries(name, "_count", labels);
+        out.append(labels.empty() ? " " : "} ");
+        appendNumber(snapshot.total);
+        out.append("\n");
+    }
+
+};
+
+// Serves the rendered metrics on a local UNIX stream socket: every client
+// that connects gets the current text and is then disconnected, e.g.
+//   socat - UNIX-CONNECT:/tmp/quic-server.metrics
+// Clients are served without blocking the loop: what does not fit the
+// socket buffer at once is kept and written as the client drains it, and a
+// client that has not taken everything within kClientTimeout is dropped.
+// requestDump() writes the same text to the log instead. It only writes to
+// an eventfd, so it is safe to call from a signal handler.
+class MetricsEndpoint {
+public:
+    using Renderer = std::function<void(std::string& out)>;
+
+private:
+    std::string path;
+    Renderer render;
+    int listen_fd;
+    int dump_fd;
+    std::string text;
+    EventLoop* loop;
+
+    // Clients whose text did not fit their socket buffer at once
+    struct PendingClient {
+        std::string rest;
+        uint64_t timer;
+    };
+    std::unordered_map<int, PendingClient> pending;
+
+    static constexpr size_t kInitialTextCapacity = 64 * 1024;
+    static constexpr size_t kMaxPendingClients = 16;
+    static constexpr std::chrono::milliseconds kClientTimeout{1000};
+
+    void renderText() {
+        text.clear();
+        render(text);
+    }
+
+    // Write as much of `data` as the socket takes. Returns the bytes
+    // written, or SIZE_MAX if the client went away.
+    static size_t writeSome(int fd, std::string_view data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t n = write(fd, data.data() + written, data.size() - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (n <= 0) {
+                return SIZE_MAX;
+            }
+            written += n;
+        }
+        return written;
+    }
+
+    void onConnect() {
+        while (true) {
+            int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_fd < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    QLOG_ERROR("Failed to accept metrics client: {}", strerror(errno));
+                }
+                return;
+            }
+
+            // The text usually fits the socket buffer and is done here
+            renderText();
+            size_t written = writeSome(client_fd, text);
+            if (written == text.size() || written == SIZE_MAX) {
+                close(client_fd);
+                continue;
+            }
+            if (pending.size() >= kMaxPendingClients) {
+                QLOG_WARN("Too many slow metrics clients, dropping one after {} of {} bytes", written, text.size());
+                close(client_fd);
+                continue;
+            }
+            if (!loop->add(client_fd, EPOLLOUT, [this, client_fd](uint32_t) { onWritable(client_fd); })) {
+                close(client_fd);
+                continue;
+            }
+            uint64_t timer = loop->addTimer(kClientTimeout, [this, client_fd]() {
+                QLOG_WARN("Metrics client too slow, dropping it");
+                dropClient(client_fd);
+            });
+            pending[client_fd] = {text.substr(written), timer};
+        }
+    }
+
+    void onWritable(int client_fd) {
+        auto it = pending.find(client_fd);
+        if (it == pending.end()) {
+            return;
+        }
+        std::string& rest = it->second.rest;
+        size_t written = writeSome(client_fd, rest);
+        if (written == SIZE_MAX) {
+            QLOG_WARN("Metrics client went away with {} bytes unsent", rest.size());
+        } else if (written < rest.size()) {
+            rest.erase(0, written);
+            return;
+        }
+        loop->cancelTimer(it->second.timer);
+        dropClient(client_fd);
+    }
+
+    void dropClient(int client_fd) {
+        loop->remove(client_fd);
+        close(client_fd);
+        pending.erase(client_fd);
+    }
+
+    void onDumpRequested() {
+        uint64_t value;
+        while (read(dump_fd, &value, sizeof(value)) > 0) {
+        }
+
+        renderText();
+        std::string_view rest = text;
+        while (!rest.empty()) {
+            size_t end = rest.find('\n');
+            std::string_view line = rest.substr(0, end);
+            QLOG_INFO("{}", line);
+            rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+        }
+    }
+
+public:
+    // An empty `path` disables the socket; dumps on request still work
+    MetricsEndpoint(std::string path, Renderer render)
+        : path(std::move(path)), render(std::move(render)), listen_fd(-1), dump_fd(-1), loop(nullptr) {
+        text.reserve(kInitialTextCapacity);
+    }
+
+    ~MetricsEndpoint() {
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            unlink(path.c_str());
+        }
+        if (dump_fd >= 0) {
+            close(dump_fd);
+        }
+    }
+
+    MetricsEndpoint(const MetricsEndpoint&) = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+    bool init() {
+        dump_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (dump_fd < 0) {
+            QLOG_ERROR("Failed to create metrics eventfd: {}", strerror(errno));
+            return false;
+        }
+        if (path.empty()) {
+            return true;
+        }
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            QLOG_ERROR("Metrics socket path too long: {}", path);
+            return false;
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size());
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) {
+            QLOG_ERROR("Failed to create metrics socket: {}", strerror(errno));
+            return false;
+        }
+
+        unlink(path.c_str());  // left behind by a previous run
+        if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            listen(listen_fd, 16) < 0) {
+            QLOG_ERROR("Failed to listen on metrics socket {}: {}", path, strerror(errno));
+            close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+
+        QLOG_INFO("Metrics available on unix:{}", path);
+        return true;
+    }
+
+    // Serve from `event_loop` until detach(); both run on the loop's thread
+    bool attach(EventLoop& event_loop) {
+        loop = &event_loop;
+        if (!loop->add(dump_fd, EPOLLIN, [this](uint32_t) { onDumpRequested(); })) {
+            return false;
+        }
+        return listen_fd < 0 || loop->add(listen_fd, EPOLLIN, [this](uint32_t) { onConnect(); });
+    }
+
+    void detach() {
+        if (!loop) {
+            return;
+        }
+        loop->remove(dump_fd);
+        if (listen_fd >= 0) {
+            loop->remove(listen_fd);
+        }
+        while (!pending.empty()) {
+            loop->cancelTimer(pending.begin()->second.timer);
+            dropClient(pending.begin()->first);
+        }
+        loop = nullptr;
+    }
+
+    // Async-signal-safe
+    void requestDump() {
+        uint64_t one = 1;
+        ssize_t ignored = write(dump_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+};
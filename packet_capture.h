@@ -0,0 +1,638 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "logger.h"
+
+#if defined(__linux__)
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#endif
+
+// Packet capture helpers for the attacker: link-layer aware frame parsing
+// shared by every capture source, a streaming pcap/pcapng file reader,
+// and on Linux a memory-mapped AF_PACKET TPACKET_V3 receive ring.
+
+// Link-layer framing in front of the IP header
+enum class LinkType {
+    Null,      // BSD loopback: 4-byte address family, host byte order
+    Loop,      // OpenBSD loopback: 4-byte address family, network byte order
+    Ethernet,  // 14-byte header, optionally 802.1Q tagged (Linux lo too)
+    LinuxSll,  // Linux "cooked" capture, 16 bytes
+    LinuxSll2, // Linux "cooked" capture v2, 20 bytes
+    Raw,       // no link header, frame starts with the IP header
+    Unsupported,
+};
+
+// Map a libpcap/pcapng DLT/LINKTYPE value to the framing it implies
+inline LinkType linkTypeFromDlt(int dlt) {
+    switch (dlt) {
+        case 0: return LinkType::Null;                  // DLT_NULL
+        case 1: return LinkType::Ethernet;              // DLT_EN10MB
+        case 12: case 14: case 101: case 228:           // DLT_RAW variants, LINKTYPE_RAW, DLT_IPV4
+            return LinkType::Raw;
+        case 108: return LinkType::Loop;                // DLT_LOOP
+        case 113: return LinkType::LinuxSll;            // DLT_LINUX_SLL
+        case 276: return LinkType::LinuxSll2;           // DLT_LINUX_SLL2
+        default: return LinkType::Unsupported;
+    }
+}
+
+// A UDP datagram found in a captured frame; points into the frame
+struct UdpView {
+    const uint8_t* payload;
+    size_t len;
+    uint16_t src_port;  // host byte order
+    uint16_t dst_port;
+};
+
+// Walk the link, IPv4 and UDP headers of `frame` (`caplen` bytes were
+// captured). Fragments, non-IPv4 and truncated packets are rejected; a
+// payload cut short by the snapshot length is reported as captured.
+inline bool parseUdpFrame(LinkType link, const uint8_t* frame, size_t caplen, UdpView& out) {
+    size_t offset = 0;
+    switch (link) {
+        case LinkType::Null:
+        case LinkType::Loop: {
+            if (caplen < 4) {
+                return false;
+            }
+            uint32_t family;
+            memcpy(&family, frame, sizeof(family));
+            if (link == LinkType::Loop) {
+                family = ntohl(family);
+            }
+            if (family != AF_INET) {
+                return false;
+            }
+            offset = 4;
+            break;
+        }
+        case LinkType::Ethernet: {
+            offset = 12;
+            uint16_t ethertype;
+            do {
+                if (caplen < offset + 2) {
+                    return false;
+                }
+                memcpy(&ethertype, frame + offset, sizeof(ethertype));
+                ethertype = ntohs(ethertype);
+                offset += 2;
+                if (ethertype == 0x8100 || ethertype == 0x88A8) {
+                    offset += 2;  // skip the VLAN tag's TCI, then read the inner type
+                }
+            } while (ethertype == 0x8100 || ethertype == 0x88A8);
+            if (ethertype != 0x0800) {
+                return false;
+            }
+            break;
+        }
+        case LinkType::LinuxSll:
+        case LinkType::LinuxSll2: {
+            size_t header = link == LinkType::LinuxSll ? 16 : 20;
+            size_t type_at = link == LinkType::LinuxSll ? 14 : 0;
+            if (caplen < header) {
+                return false;
+            }
+            uint16_t protocol;
+            memcpy(&protocol, frame + type_at, sizeof(protocol));
+            if (ntohs(protocol) != 0x0800) {
+                return false;
+            }
+            offset = header;
+            break;
+        }
+        case LinkType::Raw:
+            break;
+        default:
+            return false;
+    }
+
+    if (caplen < offset + sizeof(struct ip)) {
+        return false;
+    }
+    const uint8_t* ip = frame + offset;
+    size_t ip_header_length = (ip[0] & 0x0F) * 4;
+    if ((ip[0] >> 4) != 4 || ip_header_length < 20 || ip[9] != IPPROTO_UDP) {
+        return false;
+    }
+    uint16_t fragment;
+    memcpy(&fragment, ip + 6, sizeof(fragment));
+    if (ntohs(fragment) & 0x3FFF) {
+        return false;  // a fragment (or more to come): no whole UDP datagram here
+    }
+
+    offset += ip_header_length;
+    if (caplen < offset + sizeof(struct udphdr)) {
+        return false;
+    }
+    struct udphdr udp;
+    memcpy(&udp, frame + offset, sizeof(udp));
+    size_t udp_length = ntohs(udp.uh_ulen);
+    if (udp_length < sizeof(struct udphdr)) {
+        return false;
+    }
+    offset += sizeof(struct udphdr);
+
+    out.payload = frame + offset;
+    out.len = std::min(udp_length - sizeof(struct udphdr), caplen - offset);
+    out.src_port = ntohs(udp.uh_sport);
+    out.dst_port = ntohs(udp.uh_dport);
+    return true;
+}
+
+// A frame read from a capture file; points into the file's mapping
+struct CaptureRecord {
+    const uint8_t* frame;
+    size_t caplen;
+    uint64_t ts_ns;  // capture time, 0 when the format has none
+    LinkType link;
+};
+
+// Streams the frames of a pcap or pcapng file through a read-only
+// mapping, without copying them. Pages already read can be handed back
+// with release(), so a multi-gigabyte capture never stays resident.
+class CaptureFile {
+private:
+    static constexpr size_t kReleaseChunk = 64 << 20;  // release() works in steps this size
+
+    enum class Format { Pcap, Pcapng };
+
+    // A pcapng interface description: framing, and timestamp units per second
+    struct Interface {
+        LinkType link;
+        uint64_t units;
+    };
+
+    int fd;
+    const uint8_t* data;
+    size_t size;
+    size_t offset;
+    size_t released;
+    Format format;
+    bool swapped;  // written with the other byte order
+    Interface pcap_interface;  // the single interface of a classic pcap file
+    std::vector<Interface> interfaces;  // per pcapng section
+    std::string path;
+
+    uint16_t read16(const uint8_t* p) const {
+        uint16_t value;
+        memcpy(&value, p, sizeof(value));
+        return swapped ? __builtin_bswap16(value) : value;
+    }
+
+    uint32_t read32(const uint8_t* p) const {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return swapped ? __builtin_bswap32(value) : value;
+    }
+
+    static uint64_t toNs(uint64_t ts, uint64_t units) {
+        return static_cast<uint64_t>(static_cast<unsigned __int128>(ts) * 1000000000 / units);
+    }
+
+    bool truncated() {
+        QLOG_WARN("{}: truncated or corrupt at byte {}", path, offset);
+        offset = size;
+        return false;
+    }
+
+    bool openPcap(uint32_t magic) {
+        if (size < 24) {
+            return truncated();
+        }
+        swapped = magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1;
+        bool nanos = magic == 0xA1B23C4D || magic == 0x4D3CB2A1;
+        pcap_interface = {linkTypeFromDlt(read32(data + 20) & 0xFFFF), nanos ? 1000000000ULL : 1000000ULL};
+        format = Format::Pcap;
+        offset = 24;
+        return true;
+    }
+
+    bool nextPcap(CaptureRecord& rec) {
+        if (size - offset < 16) {
+            return offset == size ? false : truncated();
+        }
+        const uint8_t* hdr = data + offset;
+        size_t caplen = read32(hdr + 8);
+        if (size - offset - 16 < caplen) {
+            return truncated();
+        }
+        uint64_t fraction = toNs(read32(hdr + 4), pcap_interface.units);
+        rec = {hdr + 16, caplen, read32(hdr) * 1000000000ULL + fraction, pcap_interface.link};
+        offset += 16 + caplen;
+        return true;
+    }
+
+    // Interface Description Block: link type, then options; only
+    // if_tsresol (code 9) matters here
+    void addInterface(const uint8_t* body, size_t len) {
+        Interface iface = {len >= 2 ? linkTypeFromDlt(read16(body)) : LinkType::Unsupported, 1000000};
+        size_t pos = 8;
+        while (pos + 4 <= len) {
+            uint16_t code = read16(body + pos);
+            uint16_t option_len = read16(body + pos + 2);
+            if (code == 0 || pos + 4 + option_len > len) {
+                break;
+            }
+            if (code == 9 && option_len >= 1) {
+                uint8_t resolution = body[pos + 4];
+                unsigned exponent = resolution & 0x7F;
+                if (resolution & 0x80) {
+                    iface.units = exponent < 64 ? 1ULL << exponent : iface.units;
+                } else if (exponent <= 19) {
+                    iface.units = 1;
+                    for (unsigned i = 0; i < exponent; i++) {
+                        iface.units *= 10;
+                    }
+                }
+            }
+            pos += 4 + ((option_len + 3) & ~3u);
+        }
+        interfaces.push_back(iface);
+    }
+
+    bool nextPcapng(CaptureRecord& rec) {
+        while (offset < size) {
+            if (size - offset < 12) {
+                return truncated();
+            }
+            const uint8_t* block = data + offset;
+            uint32_t type;
+            memcpy(&type, block, sizeof(type));
+            if (type == 0x0A0D0D0A) {
+                // Section Header Block: the byte-order magic decides how
+                // everything up to the next section is read
+                uint32_t magic;
+                memcpy(&magic, block + 8, sizeof(magic));
+                if (magic != 0x1A2B3C4D && magic != 0x4D3C2B1A) {
+                    return truncated();
+                }
+                swapped = magic == 0x4D3C2B1A;
+                interfaces.clear();
+            }
+            type = read32(block);
+            size_t len = read32(block + 4);
+            if (len < 12 || len % 4 != 0 || len > size - offset) {
+                return truncated();
+            }
+            const uint8_t* body = block + 8;
+            size_t body_len = len - 12;
+            offset += len;
+
+            switch (type) {
+                case 1:  // Interface Description Block
+                    addInterface(body, body_len);
+                    break;
+                case 6: {  // Enhanced Packet Block
+                    if (body_len < 20) {
+                        return truncated();
+                    }
+                    uint32_t id = read32(body);
+                    size_t caplen = read32(body + 12);
+                    if (id >= interfaces.size() || caplen > body_len - 20) {
+                        return truncated();
+                    }
+                    uint64_t ts = (static_cast<uint64_t>(read32(body + 4)) << 32) | read32(body + 8);
+                    rec = {body + 20, caplen, toNs(ts, interfaces[id].units), interfaces[id].link};
+                    return true;
+                }
+                case 3: {  // Simple Packet Block: interface 0, no timestamp
+                    if (body_len < 4 || interfaces.empty()) {
+                        return truncated();
+                    }
+                    size_t caplen = std::min<size_t>(read32(body), body_len - 4);
+                    rec = {body + 4, caplen, 0, interfaces[0].link};
+                    return true;
+                }
+                case 2: {  // Packet Block, obsolete but still written by old tools
+                    if (body_len < 20) {
+                        return truncated();
+                    }
+                    uint16_t id = read16(body);
+                    size_t caplen = read32(body + 12);
+                    if (id >= interfaces.size() || caplen > body_len - 20) {
+                        return truncated();
+                    }
+                    uint64_t ts = (static_cast<uint64_t>(read32(body + 4)) << 32) | read32(body + 8);
+                    rec = {body + 20, caplen, toNs(ts, interfaces[id].units), interfaces[id].link};
+                    return true;
+                }
+                default:  // statistics, name resolution, custom blocks
+                    break;
+            }
+        }
+        return false;
+    }
+
+public:
+    CaptureFile()
+        : fd(-1), data(nullptr), size(0), offset(0), released(0), format(Format::Pcap), swapped(false),
+          pcap_interface{LinkType::Unsupported, 1000000} {}
+
+    ~CaptureFile() {
+        if (data) {
+            munmap(const_cast<uint8_t*>(data), size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    CaptureFile(const CaptureFile&) = delete;
+    CaptureFile& operator=(const CaptureFile&) = delete;
+
+    bool open(const char* file) {
+        path = file;
+        fd = ::open(file, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            QLOG_ERROR("Failed to open {}: {}", path, strerror(errno));
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        if (size < 4) {
+            QLOG_ERROR("{} is not a capture file", path);
+            return false;
+        }
+        void* mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem == MAP_FAILED) {
+            QLOG_ERROR("Failed to map {}: {}", path, strerror(errno));
+            return false;
+        }
+        data = static_cast<const uint8_t*>(mem);
+        madvise(mem, size, MADV_SEQUENTIAL);
+
+        uint32_t magic;
+        memcpy(&magic, data, sizeof(magic));
+        switch (magic) {
+            case 0xA1B2C3D4: case 0xD4C3B2A1:  // microsecond timestamps
+            case 0xA1B23C4D: case 0x4D3CB2A1:  // nanosecond timestamps
+                return openPcap(magic);
+            case 0x0A0D0D0A:
+                format = Format::Pcapng;
+                return true;
+            default:
+                QLOG_ERROR("{} is neither pcap nor pcapng", path);
+                return false;
+        }
+    }
+
+    // The next frame, or false at the end of the file (or at the first
+    // corrupt record, which is logged)
+    bool next(CaptureRecord& rec) {
+        return format == Format::Pcap ? nextPcap(rec) : nextPcapng(rec);
+    }
+
+    // Drop the pages before the read position from memory. Frames
+    // returned so far must no longer be referenced.
+    void release() {
+        if (offset - released < kReleaseChunk) {
+            return;
+        }
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t end = offset / page * page;
+        madvise(const_cast<uint8_t*>(data) + released, end - released, MADV_DONTNEED);
+        released = end;
+    }
+
+    size_t position() const { return offset; }
+    size_t fileSize() const { return size; }
+};
+
+#if defined(__linux__)
+
+// Memory-mapped TPACKET_V3 receive ring on one interface. The kernel
+// fills whole blocks of frames and a classic BPF program attached to the
+// socket drops everything that is not IPv4/UDP to the wanted port before
+// it reaches the ring. Frames are handed to the caller in place; a block
+// goes back to the kernel once all of its frames have been visited.
+class PacketRing {
+private:
+    static constexpr unsigned kBlockSize = 1 << 22;  // 4 MiB
+    static constexpr unsigned kBlockCount = 64;
+    static constexpr unsigned kFrameSize = 1 << 11;
+    static constexpr unsigned kBlockTimeoutMs = 10;  // hand over partial blocks this often
+
+    int fd;
+    uint8_t* ring;
+    size_t ring_size;
+    unsigned current_block;
+    LinkType link;
+
+    // Classic BPF: accept unfragmented IPv4 UDP to `dst_port`. On
+    // Ethernet the IP header follows a 14-byte link header; otherwise the
+    // frame starts with it.
+    static std::vector<struct sock_filter> buildFilter(LinkType link, uint16_t dst_port) {
+        static constexpr uint8_t kReject = 0xFF;  // jump target, patched below
+        const uint32_t l = link == LinkType::Ethernet ? 14 : 0;
+
+        std::vector<struct sock_filter> prog;
+        if (link == LinkType::Ethernet) {
+            prog.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12));  // ethertype
+            prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 0, kReject));
+        } else {
+            prog.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0));  // IP version
+            prog.push_back(BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xF0));
+            prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x40, 0, kReject));
+        }
+        prog.push_back(BPF_STMT(BPF_LD | BPF_B | BPF_ABS, l + 9));  // protocol
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, kReject));
+        prog.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_ABS, l + 6));  // fragment offset
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1FFF, kReject, 0));
+        prog.push_back(BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, l));  // X = IP header length
+        prog.push_back(BPF_STMT(BPF_LD | BPF_H | BPF_IND, l + 2));  // UDP destination port
+        prog.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, dst_port, 0, kReject));
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, 0x40000));  // accept the whole frame
+        prog.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+
+        size_t reject = prog.size() - 1;
+        for (size_t i = 0; i < prog.size(); i++) {
+            if (BPF_CLASS(prog[i].code) != BPF_JMP) {
+                continue;
+            }
+            uint8_t offset = static_cast<uint8_t>(reject - i - 1);
+            if (prog[i].jt == kReject) {
+                prog[i].jt = offset;
+            }
+            if (prog[i].jf == kReject) {
+                prog[i].jf = offset;
+            }
+        }
+        return prog;
+    }
+
+    static LinkType linkTypeOf(int sock, const char* interface) {
+        struct ifreq ifr;
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+        if (ioctl(sock, SIOCGIFHWADDR, &ifr) < 0) {
+            return LinkType::Unsupported;
+        }
+        switch (ifr.ifr_hwaddr.sa_family) {
+            case ARPHRD_ETHER:
+            case ARPHRD_LOOPBACK:
+                return LinkType::Ethernet;
+            case ARPHRD_NONE:
+            case ARPHRD_RAWIP:
+                return LinkType::Raw;
+            default:
+                return LinkType::Unsupported;
+        }
+    }
+
+    struct tpacket_block_desc* block(unsigned i) const {
+        return reinterpret_cast<struct tpacket_block_desc*>(ring + static_cast<size_t>(i) * kBlockSize);
+    }
+
+public:
+    PacketRing() : fd(-1), ring(nullptr), ring_size(0), current_block(0), link(LinkType::Unsupported) {}
+
+    ~PacketRing() {
+        if (ring) {
+            munmap(ring, ring_size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    PacketRing(const PacketRing&) = delete;
+    PacketRing& operator=(const PacketRing&) = delete;
+
+    // Needs CAP_NET_RAW
+    bool open(const char* interface, uint16_t dst_port) {
+        fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ALL));
+        if (fd < 0) {
+            QLOG_ERROR("Failed to open AF_PACKET socket: {}", strerror(errno));
+            return false;
+        }
+
+        link = linkTypeOf(fd, interface);
+        if (link == LinkType::Unsupported) {
+            QLOG_ERROR("Unsupported or unknown interface: {}", interface);
+            return false;
+        }
+
+        // Filter before the ring is set up so nothing unwanted gets in
+        std::vector<struct sock_filter> prog = buildFilter(link, dst_port);
+        struct sock_fprog fprog = {static_cast<unsigned short>(prog.size()), prog.data()};
+        if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) < 0) {
+            QLOG_ERROR("Failed to attach capture filter: {}", strerror(errno));
+            return false;
+        }
+
+        // Loopback shows every packet twice, once leaving and once arriving
+        int ignore_outgoing = 1;
+        setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore_outgoing, sizeof(ignore_outgoing));
+
+        int version = TPACKET_V3;
+        if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+            QLOG_ERROR("TPACKET_V3 not supported: {}", strerror(errno));
+            return false;
+        }
+
+        struct tpacket_req3 req;
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = kBlockSize;
+        req.tp_block_nr = kBlockCount;
+        req.tp_frame_size = kFrameSize;
+        req.tp_frame_nr = (kBlockSize / kFrameSize) * kBlockCount;
+        req.tp_retire_blk_tov = kBlockTimeoutMs;
+        if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+            QLOG_ERROR("Failed to set up the capture ring: {}", strerror(errno));
+            return false;
+        }
+
+        ring_size = static_cast<size_t>(kBlockSize) * kBlockCount;
+        void* mem = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+        if (mem == MAP_FAILED) {
+            mem = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);  // no RLIMIT_MEMLOCK room
+        }
+        if (mem == MAP_FAILED) {
+            QLOG_ERROR("Failed to map the capture ring: {}", strerror(errno));
+            return false;
+        }
+        ring = static_cast<uint8_t*>(mem);
+
+        struct sockaddr_ll addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_ALL);
+        addr.sll_ifindex = if_nametoindex(interface);
+        if (addr.sll_ifindex == 0 || bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+            QLOG_ERROR("Failed to bind capture to {}: {}", interface, strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    LinkType linkType() const { return link; }
+
+    // Wait up to `timeout_ms` for a filled block, then call
+    // fn(frame, caplen) for every frame of every ready block. Returns the
+    // number of frames delivered, or -1 on error.
+    template <typename Fn>
+    long dispatch(int timeout_ms, Fn&& fn) {
+        if (!(block(current_block)->hdr.bh1.block_status & TP_STATUS_USER)) {
+            struct pollfd pfd = {fd, POLLIN | POLLERR, 0};
+            if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+                return -1;
+            }
+        }
+
+        long frames = 0;
+        while (block(current_block)->hdr.bh1.block_status & TP_STATUS_USER) {
+            struct tpacket_block_desc* desc = block(current_block);
+            uint8_t* base = reinterpret_cast<uint8_t*>(desc);
+            auto* frame = reinterpret_cast<struct tpacket3_hdr*>(base + desc->hdr.bh1.offset_to_first_pkt);
+            for (uint32_t i = 0; i < desc->hdr.bh1.num_pkts; i++) {
+                // Older kernels ignore PACKET_IGNORE_OUTGOING
+                auto* ll = reinterpret_cast<struct sockaddr_ll*>(
+                    reinterpret_cast<uint8_t*>(frame) + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+                if (ll->sll_pkttype != PACKET_OUTGOING) {
+                    fn(reinterpret_cast<const uint8_t*>(frame) + frame->tp_mac, static_cast<size_t>(frame->tp_snaplen));
+                    frames++;
+                }
+                frame = reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<uint8_t*>(frame) + frame->tp_next_offset);
+            }
+
+            __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            current_block = (current_block + 1) % kBlockCount;
+        }
+        return frames;
+    }
+
+    // Frames seen and frames the kernel dropped because the ring was
+    // full, since the previous call
+    bool stats(uint64_t& packets, uint64_t& drops) {
+        struct tpacket_stats_v3 st;
+        socklen_t len = sizeof(st);
+        if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) {
+            return false;
+        }
+        packets = st.tp_packets;
+        drops = st.tp_drops;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,502 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <chrono>
+#include <ctime>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include <cstring>
+#include <cerrno>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "logger.h"
+#include "quic_protocol.h"
+#include "ticket_cache.h"
+
+// Simple QUIC client implementation using a basic socket-based approach
+// This demonstrates the concept without requiring complex libraries
+
+// Request id used for unnumbered packets
+static constexpr uint32_t kNoRequestId = 0;
+
+// Outcome of one asynchronous request
+struct QuicResponse {
+    enum class Status { Ok, Rejected, Timeout, Error };
+
+    Status status = Status::Error;
+    uint8_t type = 0;     // response packet type, 0 if none arrived
+    std::string payload;  // bytes after the type and request id
+    std::chrono::nanoseconds latency{0};  // send to response (or timeout)
+};
+
+class QuicClient {
+public:
+    using Clock = std::chrono::steady_clock;
+    using ResponseHandler = std::function<void(const QuicResponse&)>;
+
+    static constexpr std::chrono::milliseconds kDefaultTimeout{5000};
+
+private:
+    struct PendingRequest {
+        Clock::time_point sent_at;
+        Clock::time_point deadline;
+        PacketType expected_type;  // 0x02, 0x04 (or 0x05) or 0x07
+        ResponseHandler handler;
+    };
+
+    int sock_fd;
+    struct sockaddr_in server_addr;
+    std::vector<uint8_t> session_ticket;
+    bool has_ticket;
+    ConnectionId connection_id;  // from the last handshake, sent on 0x03 and 0x06
+    uint32_t next_request_id;
+    std::unordered_map<uint32_t, PendingRequest> pending;
+
+public:
+    QuicClient() : sock_fd(-1), has_ticket(false), next_request_id(1) {}
+
+    ~QuicClient() {
+        if (sock_fd >= 0) {
+            close(sock_fd);
+        }
+    }
+
+    QuicClient(const QuicClient&) = delete;
+    QuicClient& operator=(const QuicClient&) = delete;
+
+    bool init(const char* server_ip = "127.0.0.1", uint16_t server_port = 4433) {
+        // Create UDP socket
+        sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock_fd < 0) {
+            QLOG_ERROR("Failed to create socket");
+            return false;
+        }
+
+        // Make socket non-blocking
+        int flags = fcntl(sock_fd, F_GETFL, 0);
+        fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK);
+
+        // Set server address
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(server_port);
+        server_addr.sin_addr.s_addr = inet_addr(server_ip);
+
+        return true;
+    }
+
+    int fd() const { return sock_fd; }
+    bool hasTicket() const { return has_ticket; }
+    size_t pendingCount() const { return pending.size(); }
+
+    // Packet builders; `packet` must hold kMaxPacketSize bytes. They return
+    // the packet length, or 0 if the packet cannot be built. A request id
+    // other than kNoRequestId is sent along and echoed by the server.
+    static constexpr size_t kMaxPacketSize = 1500;
+
+    size_t buildHandshakePacket(uint8_t* packet, uint32_t request_id = kNoRequestId) const {
+        // Simply send client identifier for demo purposes
+        static constexpr std::string_view client_id = "client1";
+        return encode(packet, kMaxPacketSize, Packet<PacketType::Handshake>{client_id}, requestId(request_id));
+    }
+
+    size_t buildRegularPacket(uint8_t* packet, std::string_view data,
+                              uint32_t request_id = kNoRequestId) const {
+        return encode(packet, kMaxPacketSize, Packet<PacketType::Regular>{data}, requestId(request_id), connection_id);
+    }
+
+    size_t build0RttPacket(uint8_t* packet, std::string_view early_data,
+                           uint32_t request_id = kNoRequestId) const {
+        if (!has_ticket) {
+            return 0;
+        }
+        Packet<PacketType::EarlyData> body{{session_ticket.data(), session_ticket.size()}, early_data, {}};
+        return encode(packet, kMaxPacketSize, body, requestId(request_id), connection_id);
+    }
+
+    bool sendPacket(const uint8_t* packet, size_t len) {
+        return sendto(sock_fd, packet, len, 0, (struct sockaddr *)&server_addr, sizeof(server_addr)) >= 0;
+    }
+
+    // Early data that one fragment of split 0-RTT data carries
+    size_t fragmentCapacity() const {
+        return kMaxPacketSize - kMaxHeaderSize - kTicketLengthSize - session_ticket.size() - kFragmentHeaderSize;
+    }
+
+    // Send `early_data` in one 0x03 packet, or split over as many as it
+    // takes when it does not fit. All pieces share `request_id`, and the
+    // server answers once. Fails without a ticket or beyond
+    // kMaxEarlyDataSize.
+    bool send0RttData(std::string_view early_data, uint32_t request_id = kNoRequestId) {
+        uint8_t packet[kMaxPacketSize];
+        size_t len = build0RttPacket(packet, early_data, request_id);
+        if (len > 0) {
+            return sendPacket(packet, len);
+        }
+        size_t piece = fragmentCapacity();
+        if (!has_ticket || early_data.size() > kMaxEarlyDataSize ||
+            (early_data.size() + piece - 1) / piece > kMaxEarlyDataFragments) {
+            return false;
+        }
+        Packet<PacketType::EarlyData> body;
+        body.ticket = {session_ticket.data(), session_ticket.size()};
+        body.fragment.present = true;
+        body.fragment.total = static_cast<uint32_t>(early_data.size());
+        for (size_t offset = 0; offset < early_data.size(); offset += piece) {
+            body.payload = early_data.substr(offset, piece);
+            body.fragment.offset = static_cast<uint32_t>(offset);
+            len = encode(packet, kMaxPacketSize, body, requestId(request_id), connection_id);
+            if (len == 0 || !sendPacket(packet, len)) {
+                return false;
+            }
+            body.fragment.seq++;
+        }
+        return true;
+    }
+
+    // Echo a 0x08 path challenge with the connection id, so the server
+    // moves the connection to the address this socket now has
+    bool answerPathChallenge(const PacketHeader& challenge) {
+        if (!connection_id || challenge.body.size != kPathTokenSize) {
+            return false;
+        }
+        uint8_t packet[kMaxPacketSize];
+        size_t len = encode(packet, kMaxPacketSize, Packet<PacketType::PathResponse>{challenge.body}, {}, connection_id);
+        return len > 0 && sendPacket(packet, len);
+    }
+
+    // Take the ticket, and the connection id if the server sent one, out
+    // of the body of a 0x02 handshake response
+    bool acceptTicket(const PacketHeader& response) {
+        Packet<PacketType::HandshakeResponse> body;
+        if (!decode(response, body)) {
+            return false;
+        }
+        session_ticket.assign(body.ticket.data, body.ticket.data + body.ticket.size);
+        has_ticket = true;
+        connection_id = body.connection_id;
+        return true;
+    }
+
+    // Save session ticket to a file
+    bool saveSessionTicket(const std::string& filename) {
+        if (session_ticket.empty()) {
+            QLOG_ERROR("No session ticket to save");
+            return false;
+        }
+        
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) {
+            QLOG_ERROR("Failed to open file for writing: {}", filename);
+            return false;
+        }
+        
+        file.write(reinterpret_cast<const char*>(session_ticket.data()), session_ticket.size());
+        QLOG_INFO("Session ticket saved to {}", filename);
+        return true;
+    }
+
+    // Load session ticket from a file
+    bool loadSessionTicket(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file) {
+            QLOG_ERROR("Failed to open file for reading: {}", filename);
+            return false;
+        }
+        
+        size_t size = file.tellg();
+        file.seekg(0, std::ios::beg);
+        
+        session_ticket.resize(size);
+        file.read(reinterpret_cast<char*>(session_ticket.data()), size);
+        
+        // A resumed session is a new connection
+        has_ticket = true;
+        connection_id.reset();
+        QLOG_INFO("Session ticket loaded from {}", filename);
+        return true;
+    }
+
+    // Store the ticket in a shared cache under this client's server
+    // address and `identity`
+    bool saveSessionTicket(TicketCache& cache, std::string_view identity,
+                           uint32_t lifetime_s = TicketCache::kDefaultLifetimeS) {
+        if (!has_ticket) {
+            return false;
+        }
+        return cache.store(server_addr, identity, session_ticket.data(), session_ticket.size(), lifetime_s,
+                           static_cast<uint64_t>(time(nullptr)));
+    }
+
+    // Take this server's unexpired ticket for `identity` from a shared cache
+    bool loadSessionTicket(const TicketCache& cache, std::string_view identity) {
+        if (!cache.lookup(server_addr, identity, static_cast<uint64_t>(time(nullptr)), session_ticket)) {
+            return false;
+        }
+        has_ticket = true;
+        connection_id.reset();
+        return true;
+    }
+
+    // Asynchronous API. Each call sends one numbered request and returns
+    // at once; any number may be in flight on the socket. `handler` runs
+    // exactly once from poll() with the matching response, a timeout, or
+    // an error; a request that cannot be sent fails immediately. The
+    // overloads without a handler return a future instead, which becomes
+    // ready as poll() runs.
+
+    // Full handshake; a successful response also stores the ticket
+    void connectWithFullHandshakeAsync(ResponseHandler handler, std::chrono::milliseconds timeout = kDefaultTimeout) {
+        uint8_t packet[kMaxPacketSize];
+        uint32_t id = nextRequestId();
+        submit(id, PacketType::HandshakeResponse, packet, buildHandshakePacket(packet, id), std::move(handler), timeout);
+    }
+
+    void sendRegularDataAsync(std::string_view data, ResponseHandler handler,
+                              std::chrono::milliseconds timeout = kDefaultTimeout) {
+        uint8_t packet[kMaxPacketSize];
+        uint32_t id = nextRequestId();
+        submit(id, PacketType::RegularResponse, packet, buildRegularPacket(packet, data, id), std::move(handler), timeout);
+    }
+
+    void connectWith0RTTAsync(std::string_view early_data, ResponseHandler handler,
+                              std::chrono::milliseconds timeout = kDefaultTimeout) {
+        uint32_t id = nextRequestId();
+        Clock::time_point sent_at = Clock::now();
+        track(id, PacketType::EarlyDataAccepted, sent_at, send0RttData(early_data, id), std::move(handler), timeout);
+    }
+
+    std::future<QuicResponse> connectWithFullHandshakeAsync(std::chrono::milliseconds timeout = kDefaultTimeout) {
+        auto promise = std::make_shared<std::promise<QuicResponse>>();
+        connectWithFullHandshakeAsync([promise](const QuicResponse& r) { promise->set_value(r); }, timeout);
+        return promise->get_future();
+    }
+
+    std::future<QuicResponse> sendRegularDataAsync(std::string_view data,
+                                                   std::chrono::milliseconds timeout = kDefaultTimeout) {
+        auto promise = std::make_shared<std::promise<QuicResponse>>();
+        sendRegularDataAsync(data, [promise](const QuicResponse& r) { promise->set_value(r); }, timeout);
+        return promise->get_future();
+    }
+
+    std::future<QuicResponse> connectWith0RTTAsync(std::string_view early_data,
+                                                   std::chrono::milliseconds timeout = kDefaultTimeout) {
+        auto promise = std::make_shared<std::promise<QuicResponse>>();
+        connectWith0RTTAsync(early_data, [promise](const QuicResponse& r) { promise->set_value(r); }, timeout);
+        return promise->get_future();
+    }
+
+    // Wait up to `timeout` for the socket to become readable or for the
+    // earliest request deadline, then complete every request that has an
+    // answer or has expired. Returns the number of requests completed.
+    size_t poll(std::chrono::milliseconds timeout) {
+        Clock::time_point wake = Clock::now() + timeout;
+        for (const auto& entry : pending) {
+            wake = std::min(wake, entry.second.deadline);
+        }
+        auto wait = std::max(Clock::duration::zero(), wake - Clock::now());
+        auto wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count();
+
+        struct pollfd pfd = {sock_fd, POLLIN, 0};
+        struct timespec ts = {static_cast<time_t>(wait_ns / 1000000000), static_cast<long>(wait_ns % 1000000000)};
+        int ready = ppoll(&pfd, 1, &ts, nullptr);
+        if (ready < 0 && errno != EINTR) {
+            QLOG_ERROR("Failed to poll socket: {}", strerror(errno));
+        }
+
+        size_t completed = ready > 0 ? receiveResponses() : 0;
+        return completed + expireRequests(Clock::now());
+    }
+
+    // Poll until no request is left in flight
+    void drain() {
+        while (!pending.empty()) {
+            poll(kDefaultTimeout);
+        }
+    }
+
+    // Poll until `future` is ready and return its response
+    QuicResponse await(std::future<QuicResponse>& future) {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            poll(kDefaultTimeout);
+        }
+        return future.get();
+    }
+
+    // Synchronous wrappers over the asynchronous API
+
+    // Connect with full handshake to get session ticket
+    bool connectWithFullHandshake() {
+        QLOG_INFO("Initiating full handshake with server...");
+        
+        auto response = connectWithFullHandshakeAsync();
+        QuicResponse result = await(response);
+        if (result.status != QuicResponse::Status::Ok) {
+            logFailure("Handshake", result);
+            return false;
+        }
+        
+        QLOG_INFO("Handshake completed, received session ticket of {} bytes in {}us",
+                  session_ticket.size(), result.latency.count() / 1000);
+        
+        // Send a regular data packet
+        sendRegularData("Hello after full handshake!");
+        
+        return true;
+    }
+
+    // Send regular data after handshake
+    bool sendRegularData(const std::string& data) {
+        QLOG_INFO("Sending regular data: {}", data);
+        
+        auto response = sendRegularDataAsync(data);
+        QuicResponse result = await(response);
+        if (result.status != QuicResponse::Status::Ok) {
+            logFailure("Regular data", result);
+            return false;
+        }
+        QLOG_INFO("Received regular response: {}", result.payload);
+        return true;
+    }
+
+    // Connect with 0-RTT using session ticket
+    bool connectWith0RTT(const std::string& early_data) {
+        if (!has_ticket) {
+            QLOG_ERROR("No session ticket available for 0-RTT");
+            return false;
+        }
+        
+        QLOG_INFO("Attempting 0-RTT connection with early data: {}", early_data);
+        
+        auto response = connectWith0RTTAsync(early_data);
+        QuicResponse result = await(response);
+        if (result.status != QuicResponse::Status::Ok) {
+            logFailure("0-RTT", result);
+            return false;
+        }
+        QLOG_INFO("Received 0-RTT response: {}", result.payload);
+        return true;
+    }
+
+private:
+    static RequestId requestId(uint32_t request_id) {
+        return request_id == kNoRequestId ? RequestId() : RequestId(request_id);
+    }
+
+    uint32_t nextRequestId() {
+        uint32_t id = next_request_id++;
+        if (next_request_id == kNoRequestId) {
+            next_request_id = 1;
+        }
+        return id;
+    }
+
+    void submit(uint32_t id, PacketType expected_type, const uint8_t* packet, size_t len,
+                ResponseHandler handler, std::chrono::milliseconds timeout) {
+        Clock::time_point sent_at = Clock::now();
+        track(id, expected_type, sent_at, len > 0 && sendPacket(packet, len), std::move(handler), timeout);
+    }
+
+    // Wait for the answer to request `id` if it was `sent`. `sent_at` is
+    // taken before the send, so the latency includes the send itself.
+    void track(uint32_t id, PacketType expected_type, Clock::time_point sent_at, bool sent, ResponseHandler handler,
+               std::chrono::milliseconds timeout) {
+        if (!sent) {
+            QuicResponse result;
+            result.status = QuicResponse::Status::Error;
+            handler(result);
+            return;
+        }
+        pending[id] = {sent_at, sent_at + timeout, expected_type, std::move(handler)};
+    }
+
+    size_t receiveResponses() {
+        size_t completed = 0;
+        while (true) {
+            uint8_t buf[kMaxPacketSize];
+            ssize_t recv_len = recv(sock_fd, buf, sizeof(buf), 0);
+            if (recv_len < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                    QLOG_ERROR("Failed to receive data: {}", strerror(errno));
+                }
+                return completed;
+            }
+
+            PacketHeader view;
+            if (!parseHeader(buf, recv_len, view)) {
+                QLOG_ERROR("Invalid response");
+                continue;
+            }
+            if (view.type == static_cast<uint8_t>(PacketType::PathChallenge)) {
+                answerPathChallenge(view);
+                continue;
+            }
+            auto it = pending.find(view.request_id.value_or(kNoRequestId));
+            if (it == pending.end()) {
+                continue;  // late answer to a request that already timed out
+            }
+
+            PendingRequest request = std::move(it->second);
+            pending.erase(it);
+
+            QuicResponse result;
+            result.type = view.type;
+            result.payload.assign(view.body.str());
+            result.latency = Clock::now() - request.sent_at;
+            if (view.type == static_cast<uint8_t>(PacketType::EarlyDataRejected)) {
+                result.status = QuicResponse::Status::Rejected;
+            } else if (view.type != static_cast<uint8_t>(request.expected_type)) {
+                QLOG_ERROR("Unknown response type: {}", (int)view.type);
+                result.status = QuicResponse::Status::Error;
+            } else if (request.expected_type == PacketType::HandshakeResponse && !acceptTicket(view)) {
+                result.status = QuicResponse::Status::Error;
+            } else {
+                result.status = QuicResponse::Status::Ok;
+            }
+            request.handler(result);
+            completed++;
+        }
+    }
+
+    size_t expireRequests(Clock::time_point now) {
+        size_t expired = 0;
+        for (auto it = pending.begin(); it != pending.end();) {
+            if (it->second.deadline > now) {
+                ++it;
+                continue;
+            }
+            PendingRequest request = std::move(it->second);
+            it = pending.erase(it);
+
+            QuicResponse result;
+            result.status = QuicResponse::Status::Timeout;
+            result.latency = now - request.sent_at;
+            request.handler(result);
+            expired++;
+        }
+        return expired;
+    }
+
+    static void logFailure(const char* what, const QuicResponse& result) {
+        switch (result.status) {
+            case QuicResponse::Status::Rejected:
+                QLOG_INFO("0-RTT data rejected by server");
+                break;
+            case QuicResponse::Status::Timeout:
+                QLOG_ERROR("{} timeout", what);
+                break;
+            default:
+                QLOG_ERROR("{} failed", what);
+                break;
+        }
+    }
+};
@@ -0,0 +1,413 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
+// Wire codec shared by the server, the client and the attacker.
+//
+// Every packet is a type byte, an optional request id, an optional
+// connection id and a body:
+//
+//   0x01 handshake            client id
+//   0x02 handshake response   u16 ticket length, ticket, [u64 connection id]
+//   0x03 0-RTT                u16 ticket length, ticket, [fragment], early data
+//   0x04 0-RTT accepted       echo of the early data
+//   0x05 0-RTT rejected       empty
+//   0x06 regular              data
+//   0x07 regular response     echo of the data
+//   0x08 path challenge       u64 token
+//   0x09 path response        the token of a 0x08
+//
+// Early data too large for one datagram is split over several 0x03
+// packets with the same request id, each carrying the ticket. Bit 15 of
+// their ticket length is set and a fragment header follows the ticket:
+//
+//   u16 sequence number, u32 offset of this piece, u32 total length
+//
+// Every piece but the last has the same length, and piece N starts at N
+// times that length. The server answers once, when every piece has arrived.
+//
+// The connection id in a 0x02 names the connection the server opened for
+// the handshake. Clients send it on their 0x03 and 0x06 packets, so the
+// server finds the connection again after the client's address changes.
+// A packet naming the connection from another address is answered there,
+// and the server also sends that address a 0x08. The connection moves only
+// when a 0x09 with the id and the token comes back from the same address,
+// so a packet with a forged source address cannot move it.
+//
+// Integers are big-endian. Parsers check every length against the
+// datagram and return views into it; nothing is copied. Serializers take
+// the capacity of the output buffer and return 0 rather than overrun it.
+
+// A packet type with the high bit set carries a 4-byte request id right
+// after the type byte. The response echoes the flag and the id, so a client
+// can have many requests in flight and match the answers out of order.
+static constexpr uint8_t kRequestIdFlag = 0x80;
+static constexpr size_t kRequestIdSize = 4;
+
+// A packet type with this bit set carries an 8-byte connection id after
+// the request id, if any. Responses do not echo it.
+static constexpr uint8_t kConnectionIdFlag = 0x40;
+static constexpr size_t kConnectionIdSize = 8;
+static constexpr uint8_t kPacketTypeMask = static_cast<uint8_t>(~(kRequestIdFlag | kConnectionIdFlag));
+
+static constexpr size_t kMaxHeaderSize = 1 + kRequestIdSize + kConnectionIdSize;
+static constexpr size_t kTicketLengthSize = 2;
+static constexpr uint16_t kFragmentedFlag = 0x8000;  // in the 0x03 ticket length
+static constexpr size_t kFragmentHeaderSize = 10;
+static constexpr size_t kMaxEarlyDataFragments = 64;
+static constexpr size_t kMaxEarlyDataSize = 64 * 1024;  // over all fragments
+static constexpr size_t kPathTokenSize = 8;
+
+enum class PacketType : uint8_t {
+    Handshake = 0x01,
+    HandshakeResponse = 0x02,
+    EarlyData = 0x03,
+    EarlyDataAccepted = 0x04,
+    EarlyDataRejected = 0x05,
+    Regular = 0x06,
+    RegularResponse = 0x07,
+    PathChallenge = 0x08,
+    PathResponse = 0x09,
+};
+
+using RequestId = std::optional<uint32_t>;
+using ConnectionId = std::optional<uint64_t>;
+
+// Bytes inside a datagram; never owns them
+struct ByteView {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    ByteView() = default;
+    ByteView(const uint8_t* data, size_t size) : data(data), size(size) {}
+    ByteView(std::string_view s) : data(reinterpret_cast<const uint8_t*>(s.data())), size(s.size()) {}
+
+    bool empty() const { return size == 0; }
+    std::string_view str() const { return {reinterpret_cast<const char*>(data), size}; }
+};
+
+struct PacketHeader {
+    uint8_t type;  // id flags masked off; may be a type this codec does not know
+    RequestId request_id;
+    ConnectionId connection_id;
+    ByteView body;
+};
+
+inline uint16_t readU16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+inline void writeU16(uint8_t* p, uint16_t value) {
+    p[0] = static_cast<uint8_t>(value >> 8);
+    p[1] = static_cast<uint8_t>(value);
+}
+
+inline uint32_t readU32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+inline void writeU32(uint8_t* p, uint32_t value) {
+    p[0] = static_cast<uint8_t>(value >> 24);
+    p[1] = static_cast<uint8_t>(value >> 16);
+    p[2] = static_cast<uint8_t>(value >> 8);
+    p[3] = static_cast<uint8_t>(value);
+}
+
+inline uint64_t readU64(const uint8_t* p) {
+    return (static_cast<uint64_t>(readU32(p)) << 32) | readU32(p + 4);
+}
+
+inline void writeU64(uint8_t* p, uint64_t value) {
+    writeU32(p, static_cast<uint32_t>(value >> 32));
+    writeU32(p + 4, static_cast<uint32_t>(value));
+}
+
+inline size_t headerSize(const RequestId& request_id, const ConnectionId& connection_id = {}) {
+    return 1 + (request_id ? kRequestIdSize : 0) + (connection_id ? kConnectionIdSize : 0);
+}
+
+// Split a datagram into type, request id, connection id and body
+inline bool parseHeader(const uint8_t* buf, size_t len, PacketHeader& out) {
+    if (len < 1) {
+        return false;
+    }
+    out.type = buf[0] & kPacketTypeMask;
+    size_t header = 1 + (buf[0] & kRequestIdFlag ? kRequestIdSize : 0) +
+                    (buf[0] & kConnectionIdFlag ? kConnectionIdSize : 0);
+    if (len < header) {
+        return false;
+    }
+    const uint8_t* p = buf + 1;
+    out.request_id.reset();
+    if (buf[0] & kRequestIdFlag) {
+        out.request_id = readU32(p);
+        p += kRequestIdSize;
+    }
+    out.connection_id.reset();
+    if (buf[0] & kConnectionIdFlag) {
+        out.connection_id = readU64(p);
+    }
+    out.body = {buf + header, len - header};
+    return true;
+}
+
+// Write the type byte and, if present, the request id and connection id.
+// Returns the header length, or 0 if `cap` is too small.
+inline size_t writeHeader(uint8_t* out, size_t cap, PacketType type, const RequestId& request_id,
+                          const ConnectionId& connection_id = {}) {
+    size_t len = headerSize(request_id, connection_id);
+    if (cap < len) {
+        return 0;
+    }
+    out[0] = static_cast<uint8_t>(type);
+    uint8_t* p = out + 1;
+    if (request_id) {
+        out[0] |= kRequestIdFlag;
+        writeU32(p, *request_id);
+        p += kRequestIdSize;
+    }
+    if (connection_id) {
+        out[0] |= kConnectionIdFlag;
+        writeU64(p, *connection_id);
+    }
+    return len;
+}
+
+// Typed bodies. Most packets carry an opaque payload; the two that carry
+// a ticket have their own layout.
+template <PacketType T>
+struct Packet {
+    ByteView payload;
+};
+
+template <>
+struct Packet<PacketType::HandshakeResponse> {
+    ByteView ticket;
+    ConnectionId connection_id;  // absent when the server tracks no connections
+};
+
+// Where a piece of split early data goes; absent for unsplit early data
+struct EarlyDataFragment {
+    bool present = false;
+    uint16_t seq = 0;
+    uint32_t offset = 0;
+    uint32_t total = 0;
+};
+
+template <>
+struct Packet<PacketType::EarlyData> {
+    ByteView ticket;
+    ByteView payload;  // early data, or this fragment's piece of it
+    EarlyDataFragment fragment;
+};
+
+template <>
+struct Packet<PacketType::EarlyDataRejected> {};
+
+// Per-type body parser and serializer, specialized at compile time
+template <PacketType T>
+struct PacketCodec {
+    static bool parse(ByteView body, Packet<T>& out) {
+        out.payload = body;
+        return true;
+    }
+    static size_t bodySize(const Packet<T>& packet) { return packet.payload.size; }
+    static void writeBody(uint8_t* out, const Packet<T>& packet) {
+        memcpy(out, packet.payload.data, packet.payload.size);
+    }
+};
+
+template <>
+struct PacketCodec<PacketType::EarlyDataRejected> {
+    static bool parse(ByteView, Packet<PacketType::EarlyDataRejected>&) { return true; }
+    static size_t bodySize(const Packet<PacketType::EarlyDataRejected>&) { return 0; }
+    static void writeBody(uint8_t*, const Packet<PacketType::EarlyDataRejected>&) {}
+};
+
+template <>
+struct PacketCodec<PacketType::HandshakeResponse> {
+    using Body = Packet<PacketType::HandshakeResponse>;
+
+    static bool parse(ByteView body, Body& out) {
+        if (body.size < kTicketLengthSize) {
+            return false;
+        }
+        size_t ticket_len = readU16(body.data);
+        if (body.size - kTicketLengthSize < ticket_len) {
+            return false;
+        }
+        out.ticket = {body.data + kTicketLengthSize, ticket_len};
+        // Older servers send no connection id; older clients ignore it
+        out.connection_id.reset();
+        if (body.size - kTicketLengthSize - ticket_len >= kConnectionIdSize) {
+            out.connection_id = readU64(body.data + kTicketLengthSize + ticket_len);
+        }
+        return true;
+    }
+    static size_t bodySize(const Body& packet) {
+        return kTicketLengthSize + packet.ticket.size + (packet.connection_id ? kConnectionIdSize : 0);
+    }
+    static void writeBody(uint8_t* out, const Body& packet) {
+        writeU16(out, static_cast<uint16_t>(packet.ticket.size));
+        memcpy(out + kTicketLengthSize, packet.ticket.data, packet.ticket.size);
+        if (packet.connection_id) {
+            writeU64(out + kTicketLengthSize + packet.ticket.size, *packet.connection_id);
+        }
+    }
+};
+
+template <>
+struct PacketCodec<PacketType::EarlyData> {
+    using Body = Packet<PacketType::EarlyData>;
+
+    static bool parse(ByteView body, Body& out) {
+        if (body.size < kTicketLengthSize) {
+            return false;
+        }
+        uint16_t length_field = readU16(body.data);
+        size_t ticket_len = length_field & ~kFragmentedFlag;
+        if (body.size - kTicketLengthSize < ticket_len) {
+            return false;
+        }
+        size_t early = kTicketLengthSize + ticket_len;
+        out.ticket = {body.data + kTicketLengthSize, ticket_len};
+        out.fragment = {};
+        if (length_field & kFragmentedFlag) {
+            if (body.size - early < kFragmentHeaderSize) {
+                return false;
+            }
+            const uint8_t* header = body.data + early;
+            out.fragment = {true, readU16(header), readU32(header + 2), readU32(header + 6)};
+            early += kFragmentHeaderSize;
+            const EarlyDataFragment& f = out.fragment;
+            if (f.seq >= kMaxEarlyDataFragments || f.total > kMaxEarlyDataSize || f.offset > f.total ||
+                body.size - early > f.total - f.offset) {
+                return false;
+            }
+        }
+        out.payload = {body.data + early, body.size - early};
+        return true;
+    }
+    static size_t bodySize(const Body& packet) {
+        return kTicketLengthSize + packet.ticket.size + (packet.fragment.present ? kFragmentHeaderSize : 0) +
+               packet.payload.size;
+    }
+    static void writeBody(uint8_t* out, const Body& packet) {
+        uint16_t flag = packet.fragment.present ? kFragmentedFlag : 0;
+        writeU16(out, static_cast<uint16_t>(packet.ticket.size | flag));
+        memcpy(out + kTicketLengthSize, packet.ticket.data, packet.ticket.size);
+        out += kTicketLengthSize + packet.ticket.size;
+        if (packet.fragment.present) {
+            writeU16(out, packet.fragment.seq);
+            writeU32(out + 2, packet.fragment.offset);
+            writeU32(out + 6, packet.fragment.total);
+            out += kFragmentHeaderSize;
+        }
+        memcpy(out, packet.payload.data, packet.payload.size);
+    }
+};
+
+// The typed body of a parsed header, if the header has type T and the
+// body is well formed
+template <PacketType T>
+inline bool decode(const PacketHeader& header, Packet<T>& out) {
+    return header.type == static_cast<uint8_t>(T) && PacketCodec<T>::parse(header.body, out);
+}
+
+// Serialize a whole packet. Returns its length, or 0 if it does not fit
+// in `cap` bytes (or a ticket is longer than its length field allows).
+template <PacketType T>
+inline size_t encode(uint8_t* out, size_t cap, const Packet<T>& packet, const RequestId& request_id = {},
+                     const ConnectionId& connection_id = {}) {
+    if constexpr (T == PacketType::HandshakeResponse) {
+        if (packet.ticket.size > UINT16_MAX) {
+            return 0;
+        }
+    }
+    if constexpr (T == PacketType::EarlyData) {
+        if (packet.ticket.size >= kFragmentedFlag) {
+            return 0;
+        }
+    }
+    size_t header = headerSize(request_id, connection_id);
+    size_t body = PacketCodec<T>::bodySize(packet);
+    if (cap < header || cap - header < body) {
+        return 0;
+    }
+    writeHeader(out, cap, T, request_id, connection_id);
+    PacketCodec<T>::writeBody(out + header, packet);
+    return header + body;
+}
+
+// One datagram of a batch after validation. `ticket` is set for 0x02
+// and 0x03; `payload` holds the rest of the body (early data for 0x03,
+// with `fragment` saying where it goes if the early data was split).
+struct ParsedPacket {
+    PacketHeader header;
+    ByteView ticket;
+    ByteView payload;
+    EarlyDataFragment fragment;
+    bool valid;
+
+    PacketType type() const { return static_cast<PacketType>(header.type); }
+};
+
+// Validate one datagram: header, known type and body layout
+inline bool parsePacket(const uint8_t* buf, size_t len, ParsedPacket& out) {
+    out.ticket = {};
+    out.payload = {};
+    out.fragment = {};
+    out.valid = false;
+    if (!parseHeader(buf, len, out.header)) {
+        return false;
+    }
+    switch (static_cast<PacketType>(out.header.type)) {
+        case PacketType::HandshakeResponse: {
+            Packet<PacketType::HandshakeResponse> body;
+            out.valid = PacketCodec<PacketType::HandshakeResponse>::parse(out.header.body, body);
+            out.ticket = body.ticket;
+            break;
+        }
+        case PacketType::EarlyData: {
+            Packet<PacketType::EarlyData> body;
+            out.valid = PacketCodec<PacketType::EarlyData>::parse(out.header.body, body);
+            out.ticket = body.ticket;
+            out.payload = body.payload;
+            out.fragment = body.fragment;
+            break;
+        }
+        case PacketType::Handshake:
+        case PacketType::EarlyDataAccepted:
+        case PacketType::EarlyDataRejected:
+        case PacketType::Regular:
+        case PacketType::RegularResponse:
+            out.payload = out.header.body;
+            out.valid = true;
+            break;
+        case PacketType::PathChallenge:
+        case PacketType::PathResponse:
+            out.payload = out.header.body;
+            out.valid = out.payload.size == kPathTokenSize;
+            break;
+        default:
+            break;
+    }
+    return out.valid;
+}
+
+// Validate a whole receive batch up front: `first`..`last` are datagrams
+// with `data` and `len`, `out` has room for all of them. Returns the
+// number of valid packets; the handlers then only branch on the type.
+template <typename It>
+inline size_t parseBatch(It first, It last, ParsedPacket* out) {
+    size_t valid = 0;
+    for (; first != last; ++first, ++out) {
+        valid += parsePacket(first->data, first->len, *out);
+    }
+    return valid;
+}
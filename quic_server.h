@@ -0,0 +1,1207 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <shared_mutex>
+#include <mutex>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "logger.h"
+#include "event_loop.h"
+#include "datagram_batch.h"
+#include "datagram_io.h"
+#include "uring_io.h"
+#include "admission.h"
+#include "connection_table.h"
+#include "early_data_reassembly.h"
+#include "replay_filter.h"
+#include "ticket_table.h"
+#include "timer_wheel.h"
+#include "session_ticket.h"
+#include "server_state.h"
+#include "shared_store.h"
+#include "metrics.h"
+#include "quic_protocol.h"
+
+// Simple QUIC server implementation using a basic socket-based approach
+// This demonstrates the concept without requiring complex libraries
+
+inline uint64_t monotonicMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint64_t monotonicUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One worker's slice of the session store. Only the owning worker inserts
+// and expires; other workers take the shared lock when a ticket minted
+// here arrives on their socket, so there is no lock shared by all workers.
+struct alignas(64) TicketShard {
+    std::shared_mutex mutex;
+    TicketTable session_tickets;
+    TimerWheel<TicketRecord> expiry;  // one timer per stored ticket, in seconds
+
+    // Tickets restored from a state file come back without their expiry
+    // timers; the next slot to schedule one for, SIZE_MAX once done
+    size_t restore_cursor;
+
+    explicit TicketShard(size_t initial_capacity)
+        : session_tickets(kTicketHeaderSize, initial_capacity), expiry(monotonicMs() / 1000),
+          restore_cursor(SIZE_MAX) {}
+
+    explicit TicketShard(const TicketTableStorage& storage)
+        : session_tickets(kTicketHeaderSize, storage), expiry(monotonicMs() / 1000),
+          restore_cursor(storage.restore ? 0 : SIZE_MAX) {}
+
+    // Whether `timer` is pending for a ticket with this one's key. Handles
+    // in restored records are left over from the previous run and may
+    // point at another ticket's timer until the shard has been rescanned.
+    bool timerHoldsKey(uint32_t timer, const uint8_t* ticket, size_t len) const {
+        const TicketRecord* timed = expiry.find(timer);
+        size_t stored = std::min<size_t>(len, kMaxStoredTicketSize);
+        return timed && timed->len == len && stored >= kTicketHeaderSize &&
+               memcmp(timed->bytes + kTicketHeaderSize, ticket + kTicketHeaderSize, stored - kTicketHeaderSize) == 0;
+    }
+};
+
+// All shards, indexed by the shard id embedded in each ticket
+class TicketShards {
+private:
+    std::vector<std::unique_ptr<TicketShard>> shards;
+
+public:
+    explicit TicketShards(size_t count, size_t initial_capacity = 1 << 16) {
+        for (size_t i = 0; i < count; i++) {
+            shards.push_back(std::make_unique<TicketShard>(initial_capacity));
+        }
+    }
+
+    // `count` shards living in a state file, which must outlive them
+    TicketShards(size_t count, ServerStateFile& state) {
+        for (size_t i = 0; i < count; i++) {
+            shards.push_back(std::make_unique<TicketShard>(state.shardStorage(i)));
+        }
+    }
+
+    size_t size() const { return shards.size(); }
+    TicketShard& operator[](size_t i) { return *shards[i]; }
+};
+
+// Client address and port packed into one integer (network byte order)
+inline uint64_t addressKey(const struct sockaddr_in& addr) {
+    return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+}
+
+inline struct sockaddr_in addressOf(uint64_t key) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = static_cast<uint32_t>(key >> 16);
+    addr.sin_port = static_cast<uint16_t>(key);
+    return addr;
+}
+
+inline uint64_t realtimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+// What handlePacket() did with a datagram; metrics are split by this
+enum class PacketKind : uint8_t {
+    Handshake,          // 0x01 answered with a ticket
+    EarlyDataAccepted,  // 0x03 answered with 0x04
+    EarlyDataRejected,  // 0x03 answered with 0x05
+    EarlyDataBuffered,  // 0x03 fragment held for reassembly, no response yet
+    Regular,            // 0x06 answered with 0x07
+    PathResponse,       // 0x09 checked against its challenge, no response
+    Invalid,            // malformed or unknown, no response
+    Count,
+};
+
+static constexpr size_t kPacketKinds = static_cast<size_t>(PacketKind::Count);
+static constexpr std::string_view kPacketKindNames[kPacketKinds] = {
+    "handshake", "early_data_accepted", "early_data_rejected", "early_data_buffered", "regular", "path_response",
+    "invalid",
+};
+
+// Kinds answered straight away, which have a recv-to-send latency
+inline bool isAnswered(PacketKind kind) {
+    return kind != PacketKind::Invalid && kind != PacketKind::EarlyDataBuffered;
+}
+
+// Written only by the owning worker, read by the metrics endpoint
+struct alignas(64) WorkerMetrics {
+    MetricCounter packets[kPacketKinds];
+    MetricCounter rejected_bad_ticket;
+    MetricCounter rejected_replay;
+    MetricCounter rejected_expired;
+    MetricCounter rejected_shed;            // refused by admission control, by limit
+    MetricCounter rejected_source_rate;
+    MetricCounter rejected_global_budget;
+    MetricCounter overload_episodes;        // times the queue delay started shedding
+    MetricCounter rejected_reassembly;      // split early data over a memory bound
+    MetricCounter rejected_incomplete;      // split early data timed out
+    MetricCounter connections_opened;
+    MetricCounter connections_closed;       // idle for longer than the timeout
+    MetricCounter connections_untracked;    // handshakes answered without a connection id
+    MetricCounter path_challenges;          // sent to a known connection's packets from a new address
+    MetricCounter connection_migrations;    // new addresses that answered their challenge
+    MetricCounter unknown_connection_ids;   // served anyway, without connection state
+    MetricCounter tickets_expired;  // dropped from the shard at end of lifetime
+    MetricCounter tickets_evicted;  // dropped early because the shard was full
+    MetricCounter recv_batches;
+    MetricCounter responses_dropped;
+    MetricCounter responses_coalesced;  // sent inside a GSO message
+    LatencyHistogram latency[kPacketKinds];  // recv-to-send; empty for kinds not answered
+};
+
+static constexpr std::string_view k0RttResponsePrefix = "Received your 0-RTT data: ";
+static constexpr std::string_view kRegularResponsePrefix = "Received your regular data: ";
+
+// How long tickets live and how many a shard may hold
+struct TicketLifetimeConfig {
+    uint32_t lifetime_s = 7200;            // stored tickets are dropped this long after issue
+    uint32_t max_early_data_age_s = 7200;  // 0-RTT is refused on older tickets
+    size_t max_tickets = 1 << 20;          // per shard; the oldest are evicted beyond it
+};
+
+// Outcome of checking a ticket presented with 0-RTT data
+enum class TicketStatus : uint8_t {
+    Valid,
+    Unknown,  // not issued by us, forged, or no longer stored
+    Expired,  // older than the lifetime or the max early data age
+};
+
+class QuicServer {
+private:
+    int sock_fd;
+    struct sockaddr_in local_addr;
+    EventLoop loop;
+    size_t batch_size;
+    std::unique_ptr<DatagramIo> io;  // created by init()
+    SendBatch tx;
+
+    // Simulated session store for resumption tickets, sharded per worker
+    std::shared_ptr<TicketShards> shards;
+    uint8_t shard_id;
+    bool reuse_port;
+    bool udp_offload;  // try GSO/GRO in init()
+    IoBackend io_backend;
+    bool sqpoll;
+
+    // Shared by all workers; null when replay protection is off
+    std::shared_ptr<ReplayFilter> replay_filter;
+
+    // Shared by all workers; when set, tickets are stateless and sealed
+    // with these keys instead of being stored in the shards
+    std::shared_ptr<TicketKeyring> ticket_keys;
+    TicketLifetimeConfig ticket_lifetime;
+
+    // Shared by all workers; holds the shards, filter and keys when set
+    std::shared_ptr<ServerStateFile> state_file;
+    std::chrono::milliseconds checkpoint_interval;
+
+    // Shared with the other server processes on the host; when set it
+    // holds the stored tickets instead of the shards, and the filter
+    // and keys are rotated by whichever process leads
+    std::shared_ptr<SharedStore> shared_store;
+
+    // Refuses 0-RTT before any ticket work; null when no limit is set
+    std::unique_ptr<EarlyDataAdmission> admission;
+    uint64_t batch_now_us;  // when the current batch was received
+
+    // Early data split over several datagrams; null when turned off
+    ReassemblyConfig reassembly_config;
+    std::unique_ptr<EarlyDataReassembler> reassembly;
+
+    // Shared by all workers; null when connections are not tracked
+    std::shared_ptr<ConnectionTable> connection_table;
+
+    // Counters and histograms; the endpoint is only set on the worker
+    // whose loop serves it
+    WorkerMetrics worker_metrics;
+    std::vector<ParsedPacket> batch_packets;  // per datagram of the current batch
+    std::vector<PacketKind> batch_kinds;
+    std::shared_ptr<MetricsEndpoint> metrics_endpoint;
+
+    // Request id of the packet being handled, echoed in its response
+    RequestId request_id;
+
+    static constexpr std::chrono::milliseconds kReplayTickInterval{10};
+    static constexpr std::chrono::milliseconds kKeyRotationCheckInterval{1000};
+    static constexpr std::chrono::milliseconds kTicketExpiryInterval{100};
+    static constexpr std::chrono::milliseconds kReassemblyExpiryInterval{50};
+    static constexpr std::chrono::milliseconds kConnectionSweepInterval{100};
+
+    // Records of this worker's slice checked per sweep tick
+    static constexpr size_t kConnectionSweepBudget = 4096;
+
+    // Timed-out messages dropped per reassembly tick
+    static constexpr size_t kReassemblyExpiryBudget = 1024;
+
+    // Expired tickets dropped per expiry tick; a larger backlog drains
+    // over the following ticks
+    static constexpr size_t kTicketExpiryBudget = 4096;
+
+    // A full shard evicts this fraction of its cap at once, so the scan
+    // for the oldest tickets is paid once per batch, not per handshake
+    static constexpr size_t kEvictionBatchDivisor = 256;
+
+    // Tickets dated this far ahead of our clock are not ours
+    static constexpr uint32_t kTicketClockSkewS = 60;
+
+    // Slots of a restored shard scanned per expiry tick for tickets whose
+    // timers need rescheduling
+    static constexpr size_t kRestoreScanSlots = 1 << 16;
+
+public:
+    explicit QuicServer(size_t batch_size = kDefaultBatchSize)
+        : QuicServer(std::make_shared<TicketShards>(1), 0, batch_size) {}
+
+    // Worker mode: one server per shard, all bound to the same port
+    QuicServer(std::shared_ptr<TicketShards> shards, uint8_t shard_id,
+               size_t batch_size = kDefaultBatchSize)
+        : sock_fd(-1), batch_size(batch_size), tx(batch_size), shards(std::move(shards)),
+          shard_id(shard_id), reuse_port(this->shards->size() > 1), udp_offload(true),
+          io_backend(IoBackend::Socket), sqpoll(false), checkpoint_interval(0), batch_now_us(0),
+          batch_packets(batch_size),
+          batch_kinds(batch_size) {}
+
+    ~QuicServer() {
+        if (sock_fd >= 0) {
+            close(sock_fd);
+        }
+    }
+
+    // Port 0 binds an ephemeral port; port() reports the one chosen
+    bool init(uint16_t listen_port = 4433) {
+        if (!loop.init()) {
+            return false;
+        }
+
+        // Create UDP socket
+        sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock_fd < 0) {
+            QLOG_ERROR("Failed to create socket");
+            return false;
+        }
+
+        // Set socket options
+        int reuseaddr = 1;
+        if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) < 0) {
+            QLOG_ERROR("Failed to set socket options");
+            return false;
+        }
+
+        // Let every worker bind its own socket; the kernel spreads flows
+        // across them by 4-tuple hash
+        int reuseport = 1;
+        if (reuse_port &&
+            setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &reuseport, sizeof(reuseport)) < 0) {
+            QLOG_ERROR("Failed to set SO_REUSEPORT");
+            return false;
+        }
+
+        // Make socket non-blocking
+        int flags = fcntl(sock_fd, F_GETFL, 0);
+        fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK);
+
+        // Kernel arrival times make the latency histograms include the
+        // time a datagram waited in the socket queue
+        if (!RecvBatch::enableTimestamps(sock_fd)) {
+            QLOG_WARN("SO_TIMESTAMPNS unavailable, latency is measured from recvmmsg");
+        }
+
+        // Bind to address
+        memset(&local_addr, 0, sizeof(local_addr));
+        local_addr.sin_family = AF_INET;
+        local_addr.sin_port = htons(listen_port);
+        local_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+        if (bind(sock_fd, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+            QLOG_ERROR("Failed to bind socket");
+            return false;
+        }
+        socklen_t addr_len = sizeof(local_addr);
+        getsockname(sock_fd, reinterpret_cast<struct sockaddr*>(&local_addr), &addr_len);
+
+        initIo();
+        if (reassembly_config.max_message > 0) {
+            reassembly = std::make_unique<EarlyDataReassembler>(reassembly_config, monotonicMs());
+        }
+        batch_packets.resize(io->maxDatagrams());
+        batch_kinds.resize(io->maxDatagrams());
+
+        if (reuse_port) {
+            QLOG_INFO("QUIC server worker {} initialized on 127.0.0.1:{}", (int)shard_id, port());
+        } else {
+            QLOG_INFO("QUIC server initialized on 127.0.0.1:{}", port());
+        }
+        return true;
+    }
+
+    // Generate a session ticket for 0-RTT resumption
+    SessionTicket generateSessionTicket(uint64_t client_key) {
+        uint8_t id[sizeof(client_key)];
+        memcpy(id, &client_key, sizeof(client_key));
+        uint32_t timestamp = static_cast<uint32_t>(time(nullptr));
+
+        // Stateless: the ticket authenticates itself, nothing to store
+        if (ticket_keys) {
+            return ticket_keys->mint(id, sizeof(id), timestamp, monotonicMs());
+        }
+
+        // In a real implementation, this would be an encrypted, authenticated blob
+        // For this demo, we'll just create a simple structure
+        SessionTicket ticket = makeStoredTicket(id, sizeof(id), shard_id, timestamp);
+
+        // Host-wide store: entries carry their deadline and expire lazily
+        if (shared_store) {
+            bool evicted = false;
+            shared_store->insertTicket(ticket.data(), ticket.size(), timestamp + ticket_lifetime.lifetime_s,
+                                       timestamp, evicted);
+            if (evicted) {
+                worker_metrics.tickets_evicted.add(1);
+            }
+            return ticket;
+        }
+        
+        // Store ticket for validation later, with a timer that drops it
+        // at the end of its lifetime
+        TicketShard& shard = (*shards)[shard_id];
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+            // A full shard sheds its oldest tickets rather than growing:
+            // under a handshake flood the oldest clients lose 0-RTT and
+            // fall back to a full handshake, and memory stays flat
+            if (shard.session_tickets.size() >= ticket_lifetime.max_tickets) {
+                evictOldest(shard);
+            }
+
+            TicketRecord record{};
+            record.len = ticket.len;
+            memcpy(record.bytes, ticket.bytes, std::min<size_t>(ticket.len, kMaxStoredTicketSize));
+            record.timer = kNoTimer;
+            uint32_t timer = shard.expiry.schedule(monotonicMs() / 1000 + ticket_lifetime.lifetime_s, record);
+            uint32_t replaced = kNoTimer;
+            if (!shard.session_tickets.insert(ticket.data(), ticket.size(), timer, &replaced)) {
+                shard.expiry.cancel(timer);
+            }
+            if (shard.restore_cursor == SIZE_MAX ||
+                (replaced != timer && shard.timerHoldsKey(replaced, ticket.data(), ticket.size()))) {
+                shard.expiry.cancel(replaced);
+            }
+        }
+        
+        return ticket;
+    }
+
+    // Validate a session ticket
+    bool validateSessionTicket(const uint8_t* ticket, size_t ticket_len) {
+        return checkSessionTicket(ticket, ticket_len) == TicketStatus::Valid;
+    }
+
+    // Validate a session ticket and say why it was refused
+    TicketStatus checkSessionTicket(const uint8_t* ticket, size_t ticket_len) {
+        // Both formats carry their issue time in the clear, so stale
+        // tickets are turned away before any MAC or table lookup
+        uint32_t issued;
+        if (!ticketTimestamp(ticket, ticket_len, issued)) {
+            return TicketStatus::Unknown;
+        }
+        uint32_t now = static_cast<uint32_t>(time(nullptr));
+        if (issued > now + kTicketClockSkewS) {
+            return TicketStatus::Unknown;
+        }
+        if (issued < now && now - issued > maxTicketAge()) {
+            return TicketStatus::Expired;
+        }
+
+        if (ticket_keys) {
+            uint64_t now_ms = monotonicMs();
+            if (ticket_keys->verify(ticket, ticket_len, now_ms)) {
+                return TicketStatus::Valid;
+            }
+            // Minted by another process with a key we have not picked up yet
+            return shared_store && shared_store->syncKeys(*ticket_keys) &&
+                           ticket_keys->verify(ticket, ticket_len, now_ms)
+                       ? TicketStatus::Valid
+                       : TicketStatus::Unknown;
+        }
+
+        // In a real implementation, this would verify the ticket's authenticity
+        // For this demo, we'll just check if it's in our store
+        if (ticket[2] != 'T') {
+            return TicketStatus::Unknown;
+        }
+        if (shared_store) {
+            return shared_store->containsTicket(ticket, ticket_len, now) ? TicketStatus::Valid
+                                                                         : TicketStatus::Unknown;
+        }
+
+        // Route to the shard that issued the ticket
+        uint8_t issuer = ticket[7];
+        if (issuer >= shards->size()) {
+            return TicketStatus::Unknown;
+        }
+        
+        // Check if we have this ticket; the table hashes the client id
+        // straight out of the ticket bytes
+        TicketShard& shard = (*shards)[issuer];
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        return shard.session_tickets.contains(ticket, ticket_len) ? TicketStatus::Valid
+                                                                  : TicketStatus::Unknown;
+    }
+
+    // Drop this worker's tickets whose lifetime is over, at most
+    // kTicketExpiryBudget per call. Returns how many were dropped.
+    size_t expireTickets(uint64_t now_ms) {
+        TicketShard& shard = (*shards)[shard_id];
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        if (shard.restore_cursor != SIZE_MAX) {
+            rescheduleRestored(shard, now_ms);
+        }
+        size_t expired = shard.expiry.advance(now_ms / 1000, kTicketExpiryBudget,
+                                              [&shard](const TicketRecord& record) {
+            shard.session_tickets.erase(record.bytes, record.len);
+        });
+        worker_metrics.tickets_expired.add(expired);
+        return expired;
+    }
+
+    void run() {
+        QLOG_INFO("QUIC server running, waiting for connections...");
+
+        if (!loop.add(io->pollFd(), EPOLLIN, [this](uint32_t) { onReadable(); })) {
+            return;
+        }
+
+        // The first worker owns rotation of the shared replay filter; with
+        // a shared store, only the first worker of the leading process
+        uint64_t replay_timer = 0;
+        if (replay_filter && shard_id == 0) {
+            replay_timer = loop.addTimer(kReplayTickInterval, [this]() {
+                uint64_t now_ms = monotonicMs();
+                if (!shared_store || shared_store->lead(now_ms)) {
+                    replay_filter->tick(now_ms);
+                }
+            }, kReplayTickInterval);
+        }
+
+        // ...and rotation of the shared ticket keys. Other processes pick
+        // up the leader's keys here, or sooner when a ticket fails to verify.
+        uint64_t rotation_timer = 0;
+        if (ticket_keys && shard_id == 0) {
+            rotation_timer = loop.addTimer(kKeyRotationCheckInterval, [this]() {
+                uint64_t now_ms = monotonicMs();
+                if (shared_store) {
+                    shared_store->syncKeys(*ticket_keys);
+                    if (!shared_store->lead(now_ms)) {
+                        return;
+                    }
+                }
+                if (!ticket_keys->rotateIfDue(now_ms)) {
+                    return;
+                }
+                if (state_file) {
+                    state_file->saveKeys(*ticket_keys, now_ms, realtimeNs() / 1000000);
+                }
+                if (shared_store) {
+                    shared_store->publishKeys(*ticket_keys, false);
+                }
+            }, kKeyRotationCheckInterval);
+        }
+
+        // ...and checkpoints of the shared state file
+        uint64_t checkpoint_timer = 0;
+        if (state_file && shard_id == 0 && checkpoint_interval.count() > 0) {
+            checkpoint_timer = loop.addTimer(checkpoint_interval, [this]() {
+                state_file->checkpoint(realtimeNs() / 1000000);
+            }, checkpoint_interval);
+        }
+
+        // Every worker expires the tickets in its own shard
+        uint64_t expiry_timer = 0;
+        if (!ticket_keys && !shared_store) {
+            expiry_timer = loop.addTimer(kTicketExpiryInterval, [this]() {
+                expireTickets(monotonicMs());
+            }, kTicketExpiryInterval);
+        }
+
+        // ...and drops the split early data that never completed
+        uint64_t reassembly_timer = 0;
+        if (reassembly) {
+            reassembly_timer = loop.addTimer(kReassemblyExpiryInterval, [this]() {
+                expireReassembly(monotonicMs());
+            }, kReassemblyExpiryInterval);
+        }
+
+        // ...and closes its connections that went idle
+        uint64_t sweep_timer = 0;
+        if (connection_table) {
+            sweep_timer = loop.addTimer(kConnectionSweepInterval, [this]() {
+                size_t closed = connection_table->sweep(shard_id, monotonicMs(), kConnectionSweepBudget);
+                worker_metrics.connections_closed.add(closed);
+            }, kConnectionSweepInterval);
+        }
+
+        if (metrics_endpoint && !metrics_endpoint->attach(loop)) {
+            return;
+        }
+
+        loop.run();
+        if (metrics_endpoint) {
+            metrics_endpoint->detach();
+        }
+        loop.cancelTimer(replay_timer);
+        loop.cancelTimer(rotation_timer);
+        loop.cancelTimer(checkpoint_timer);
+        loop.cancelTimer(expiry_timer);
+        loop.cancelTimer(reassembly_timer);
+        loop.cancelTimer(sweep_timer);
+        loop.remove(io->pollFd());
+    }
+
+    // Reject 0-RTT packets already accepted within the filter's window.
+    // Set before run(); the filter may be shared across workers.
+    void enableReplayProtection(std::shared_ptr<ReplayFilter> filter) {
+        replay_filter = std::move(filter);
+    }
+
+    // Issue stateless tickets sealed with `keys`. Set before run(); the
+    // key ring may be shared across workers.
+    void enableStatelessTickets(std::shared_ptr<TicketKeyring> keys) {
+        ticket_keys = std::move(keys);
+    }
+
+    // Checkpoint `file` every `interval` from worker 0 and keep the ticket
+    // keys in it. The shards, filter and keys must already live in or
+    // have been restored from it. Set before run().
+    void enableStateFile(std::shared_ptr<ServerStateFile> file, std::chrono::milliseconds interval) {
+        state_file = std::move(file);
+        checkpoint_interval = interval;
+    }
+
+    // Store tickets in, and share the replay filter and keys through,
+    // `store` so that several server processes behind SO_REUSEPORT act as
+    // one. The filter and keys must already live in or have been synced
+    // from it. Set before init().
+    void enableSharedStore(std::shared_ptr<SharedStore> store) {
+        shared_store = std::move(store);
+        reuse_port = true;
+    }
+
+    // Limit and shed 0-RTT as `config` says; `budget` is the global rate
+    // shared by all workers, null without one. Set before run().
+    void setAdmission(const AdmissionConfig& config, std::shared_ptr<EarlyDataBudget> budget) {
+        admission = config.enabled() ? std::make_unique<EarlyDataAdmission>(config, std::move(budget)) : nullptr;
+    }
+
+    // Bounds on early data split over several datagrams; a max_message
+    // of 0 refuses all split early data. Set before init().
+    void setEarlyDataReassembly(const ReassemblyConfig& config) {
+        reassembly_config = config;
+    }
+
+    // Hand out connection ids from `table` and keep per-connection state
+    // in it. The table is shared by all workers and sized for them; this
+    // worker uses the slice of its shard id. Set before run().
+    void enableConnectionTable(std::shared_ptr<ConnectionTable> table) {
+        connection_table = std::move(table);
+    }
+
+    // Ticket lifetime, 0-RTT age limit and shard size cap. Set before run().
+    void setTicketLifetime(const TicketLifetimeConfig& config) {
+        ticket_lifetime = config;
+        ticket_lifetime.max_tickets = std::max<size_t>(1, config.max_tickets);
+    }
+
+    // I/O engine for the socket; io_uring falls back to the socket path
+    // where the kernel lacks it. Set before init().
+    void setIoBackend(IoBackend backend, bool use_sqpoll = false) {
+        io_backend = backend;
+        sqpoll = use_sqpoll;
+    }
+
+    // Whether init() tries UDP GSO/GRO on the socket. Set before init().
+    void setUdpOffload(bool enabled) {
+        udp_offload = enabled;
+    }
+
+    // Serve `endpoint` from this worker's event loop. Set before run().
+    void enableMetrics(std::shared_ptr<MetricsEndpoint> endpoint) {
+        metrics_endpoint = std::move(endpoint);
+    }
+
+    // Async-signal-safe, wakes the event loop through its eventfd
+    void stop() {
+        loop.stop();
+    }
+
+    uint64_t packetsReceived() const {
+        return io ? io->recvStats().datagrams() : 0;
+    }
+
+    uint8_t shardId() const { return shard_id; }
+    uint16_t port() const { return ntohs(local_addr.sin_port); }
+    const WorkerMetrics& metrics() const { return worker_metrics; }
+
+    // Connections this worker opened that are still open; safe from any thread
+    size_t openConnections() const {
+        return connection_table ? connection_table->openConnections(shard_id) : 0;
+    }
+
+    // Size of this worker's ticket shard; safe from any thread
+    std::pair<size_t, size_t> ticketStoreUsage() {
+        // The host-wide store is reported once, by the first worker
+        if (shared_store) {
+            if (shard_id != 0) {
+                return {0, 0};
+            }
+            return {shared_store->ticketsUsed(), shared_store->segmentBytes()};
+        }
+        TicketShard& shard = (*shards)[shard_id];
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        return {shard.session_tickets.size(),
+                shard.session_tickets.memoryBytes() + shard.expiry.memoryBytes()};
+    }
+
+    // Batch-size distribution for tuning the recvmmsg/sendmmsg batch size
+    void printStats() {
+        if (io) {
+            io->recvStats().print((std::string(io->name()) + " batches").c_str());
+        }
+        tx.stats().print("send batches");
+        QLOG_INFO("dropped responses: {}", tx.droppedCount());
+        if (tx.gsoEnabled()) {
+            QLOG_INFO("responses sent coalesced by GSO: {}", tx.coalescedCount());
+        }
+        if (shared_store) {
+            if (shard_id == 0) {
+                QLOG_INFO("shared store {}: {} of {} ticket slots used ({} KiB), {} processes, "
+                          "{} locks recovered", shared_store->segmentName(), shared_store->ticketsUsed(),
+                          shared_store->ticketCapacity(), shared_store->segmentBytes() / 1024,
+                          shared_store->processes(), shared_store->recoveredLocks());
+            }
+            QLOG_INFO("session tickets evicted early from the shared store: {}",
+                      worker_metrics.tickets_evicted.load());
+        } else {
+            TicketShard& shard = (*shards)[shard_id];
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            QLOG_INFO("session tickets: {} ({} KiB), {} expired, {} evicted early",
+                      shard.session_tickets.size(),
+                      (shard.session_tickets.memoryBytes() + shard.expiry.memoryBytes()) / 1024,
+                      worker_metrics.tickets_expired.load(), worker_metrics.tickets_evicted.load());
+        }
+        if (admission) {
+            QLOG_INFO("0-RTT admission: {} shed in {} overload episodes, {} over source rate, "
+                      "{} over global budget", worker_metrics.rejected_shed.load(),
+                      worker_metrics.overload_episodes.load(), worker_metrics.rejected_source_rate.load(),
+                      worker_metrics.rejected_global_budget.load());
+        }
+        if (reassembly) {
+            QLOG_INFO("split early data: {} messages open ({} KiB), {} refused over memory bounds, {} timed out",
+                      reassembly->openMessages(), reassembly->bufferedBytes() / 1024,
+                      worker_metrics.rejected_reassembly.load(), worker_metrics.rejected_incomplete.load());
+        }
+        if (connection_table) {
+            if (shard_id == 0) {
+                QLOG_INFO("connection table: {} slots ({} KiB)", connection_table->capacity(),
+                          connection_table->memoryBytes() / 1024);
+            }
+            QLOG_INFO("connections: {} open, {} opened, {} closed idle, {} untracked, {} path challenges, "
+                      "{} migrations, {} unknown ids", connection_table->openConnections(shard_id),
+                      worker_metrics.connections_opened.load(), worker_metrics.connections_closed.load(),
+                      worker_metrics.connections_untracked.load(), worker_metrics.path_challenges.load(),
+                      worker_metrics.connection_migrations.load(), worker_metrics.unknown_connection_ids.load());
+        }
+        if (replay_filter && shard_id == 0) {
+            QLOG_INFO("0-RTT replay filter: {} accepted, {} rejected as replays",
+                      replay_filter->accepted(), replay_filter->rejected());
+        }
+    }
+
+    // Run one datagram through the packet handlers as onReadable() would,
+    // without the socket; whatever it queued is thrown away. Lets a
+    // benchmark time the dispatch path on its own.
+    PacketKind dispatch(const uint8_t* data, size_t len, const struct sockaddr_in& from) {
+        ParsedPacket packet;
+        parsePacket(data, len, packet);
+        batch_now_us = monotonicUs();
+        enterBatch();
+        PacketKind kind = handlePacket(packet, from, sizeof(from));
+        leaveBatch();
+        tx.discard();
+        return kind;
+    }
+
+private:
+    // Past the replay window a replay would go unnoticed
+    uint32_t maxTicketAge() const {
+        uint32_t age = std::min(ticket_lifetime.lifetime_s, ticket_lifetime.max_early_data_age_s);
+        return replay_filter ? std::min(age, replay_filter->maxTicketAgeS()) : age;
+    }
+
+    // Give restored tickets their expiry timers back, kRestoreScanSlots
+    // slots per call. Validation does not wait for this: it checks the
+    // ticket's age itself. Caller holds the unique lock of the shard.
+    void rescheduleRestored(TicketShard& shard, uint64_t now_ms) {
+        uint64_t now_s = now_ms / 1000;
+        uint32_t wall_s = static_cast<uint32_t>(time(nullptr));
+        shard.restore_cursor = shard.session_tickets.visit(shard.restore_cursor, kRestoreScanSlots,
+                                                           [&](TicketRecord& record) {
+            // Reissued since the restart: the handle is already current
+            if (shard.timerHoldsKey(record.timer, record.bytes, record.len)) {
+                return;
+            }
+            uint32_t issued = wall_s;
+            ticketTimestamp(record.bytes, record.len, issued);
+            uint64_t expires_s = static_cast<uint64_t>(issued) + ticket_lifetime.lifetime_s;
+            TicketRecord timed = record;
+            timed.timer = kNoTimer;
+            record.timer = shard.expiry.schedule(now_s + (expires_s > wall_s ? expires_s - wall_s : 0), timed);
+        });
+        if (shard.restore_cursor >= shard.session_tickets.capacity()) {
+            shard.restore_cursor = SIZE_MAX;
+            QLOG_INFO("Worker {}: expiry timers restored for {} tickets", (int)shard_id, shard.expiry.size());
+        }
+    }
+
+    // Drop a batch of the shard's oldest tickets. Caller holds the
+    // unique lock of this worker's shard.
+    void evictOldest(TicketShard& shard) {
+        size_t batch = std::max<size_t>(1, ticket_lifetime.max_tickets / kEvictionBatchDivisor);
+        size_t evicted = shard.expiry.expireEarliest(batch, [&shard](const TicketRecord& record) {
+            shard.session_tickets.erase(record.bytes, record.len);
+        });
+        worker_metrics.tickets_evicted.add(evicted);
+    }
+
+    void initIo() {
+        if (io_backend == IoBackend::IoUring) {
+#if HAVE_IO_URING
+            auto uring = std::make_unique<UringIo>(sock_fd, batch_size);
+            if (uring->init(sqpoll)) {
+                io = std::move(uring);
+                if (shard_id == 0) {
+                    QLOG_INFO("io_uring backend on{}", sqpoll ? " with SQPOLL" : "");
+                }
+                return;
+            }
+            QLOG_WARN("io_uring unavailable ({}), using the socket backend", strerror(errno));
+#else
+            QLOG_WARN("io_uring not supported on this platform, using the socket backend");
+#endif
+        }
+
+        auto socket_io = std::make_unique<SocketIo>(sock_fd, batch_size);
+
+        // Segmentation offload: responses to one peer leave as a single
+        // GSO message, and GRO runs from one peer arrive as one buffer
+        // that the receive batch splits again. Either falls back to one
+        // datagram per message on kernels without it.
+        if (udp_offload) {
+            bool gso, gro;
+            socket_io->enableOffload(tx, gso, gro);
+            if (shard_id == 0) {
+                QLOG_INFO("UDP GSO {}, GRO {}", gso ? "on" : "unavailable", gro ? "on" : "unavailable");
+            }
+        }
+        io = std::move(socket_io);
+    }
+
+    void flushResponses() {
+        if (io) {
+            io->flush(tx);
+        } else {
+            tx.discard();
+        }
+    }
+
+    // Edge-triggered: drain the backend until it would block. Each pass
+    // pulls up to one batch, runs the handlers over it and flushes all
+    // responses at once (one sendmmsg, or one io_uring submission).
+    void onReadable() {
+        while (!loop.stopped()) {
+            int n = io->receive();
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                QLOG_ERROR("Failed to receive data: {}", strerror(errno));
+                return;
+            }
+
+            // Validate the whole batch first; the handlers then work on
+            // checked views into the receive ring
+            uint64_t received_ns = realtimeNs();
+            batch_now_us = monotonicUs();
+            if (admission) {
+                observeQueue(received_ns);
+            }
+            parseBatch(io->begin(), io->end(), batch_packets.data());
+            enterBatch();
+            for (size_t i = 0; i < io->size(); i++) {
+                const Datagram& dgram = io->begin()[i];
+                batch_kinds[i] = handlePacket(batch_packets[i], dgram.addr, dgram.addr_len);
+            }
+            leaveBatch();
+            flushResponses();
+            recordBatch(received_ns);
+
+            // A short batch means the queue is empty; the next arrival
+            // raises a new edge
+            if (io->drained(n)) {
+                return;
+            }
+        }
+    }
+
+    // Connection records found while handling a batch stay valid until
+    // leaveBatch(); the sweep of any worker frees them only after that
+    void enterBatch() {
+        if (connection_table) {
+            connection_table->enter(shard_id);
+        }
+    }
+
+    void leaveBatch() {
+        if (connection_table) {
+            connection_table->leave(shard_id);
+        }
+    }
+
+    // Open a connection for a handshake; its id goes back in the 0x02.
+    // A full table still completes the handshake, just without an id.
+    ConnectionId openConnection(const struct sockaddr_in& client_addr) {
+        if (!connection_table) {
+            return {};
+        }
+        uint64_t id = connection_table->open(shard_id, addressKey(client_addr), batch_now_us / 1000);
+        if (id == 0) {
+            worker_metrics.connections_untracked.add();
+            return {};
+        }
+        worker_metrics.connections_opened.add();
+        return id;
+    }
+
+    // The connection a 0x03, 0x06 or 0x09 packet names, updated with this
+    // packet; null if it names none or one we do not know (closed idle,
+    // or issued by another process). Those are served all the same. A
+    // packet from another address is answered there but does not move
+    // the connection; see challengePath().
+    ConnectionRecord* findConnection(const ParsedPacket& packet) {
+        if (!connection_table || !packet.header.connection_id) {
+            return nullptr;
+        }
+        ConnectionRecord* record = connection_table->find(*packet.header.connection_id);
+        if (!record) {
+            worker_metrics.unknown_connection_ids.add();
+            return nullptr;
+        }
+        ConnectionTable::touch(*record, packet.payload.size, batch_now_us / 1000);
+        return record;
+    }
+
+    // A packet of `connection` came from an address it has not validated:
+    // send that address a token. The connection moves there only when the
+    // token comes back from it in a 0x09, so a forged source address gets
+    // nothing but one challenge no larger than the packet that caused it.
+    void challengePath(const ConnectionRecord* connection, const struct sockaddr_in& client_addr,
+                       socklen_t client_addr_len) {
+        uint64_t address = addressKey(client_addr);
+        if (!connection || connection->address.load(std::memory_order_relaxed) == address) {
+            return;
+        }
+        uint8_t token[kPathTokenSize];
+        writeU64(token, connection_table->pathToken(*connection, address));
+        uint8_t* response = prepareResponse(client_addr, client_addr_len);
+        tx.commit(encode(response, kMaxDatagramSize, Packet<PacketType::PathChallenge>{{token, sizeof(token)}}));
+        worker_metrics.path_challenges.add();
+    }
+
+    // A 0x09 echoed a challenge: move the connection if it was the one
+    // sent to this address
+    PacketKind handlePathResponse(const ParsedPacket& packet, const struct sockaddr_in& client_addr) {
+        ConnectionRecord* connection = findConnection(packet);
+        if (connection && connection_table->migrate(*connection, addressKey(client_addr), readU64(packet.payload.data))) {
+            QLOG_INFO("Connection migrated to {}:{}", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+            worker_metrics.connection_migrations.add();
+        }
+        return PacketKind::PathResponse;
+    }
+
+    // Time the head of the batch spent in the socket queue drives
+    // shedding; without a kernel timestamp the state is left as it was
+    void observeQueue(uint64_t received_ns) {
+        uint64_t arrived_ns = io->size() ? io->begin()->rx_time_ns : 0;
+        if (arrived_ns == 0 || arrived_ns > received_ns) {
+            return;
+        }
+        admission->observeQueueDelay((received_ns - arrived_ns) / 1000);
+        worker_metrics.overload_episodes.set(admission->overloadEpisodes());
+    }
+
+    // Answer refused early data with 0x05; the client retries over 1-RTT
+    PacketKind rejectEarlyData(const struct sockaddr_in& client_addr, socklen_t client_addr_len) {
+        uint8_t* response = prepareResponse(client_addr, client_addr_len);
+        tx.commit(encode(response, kMaxDatagramSize, Packet<PacketType::EarlyDataRejected>{}, request_id));
+        return PacketKind::EarlyDataRejected;
+    }
+
+    // Count the batch just flushed and its recv-to-send latencies
+    void recordBatch(uint64_t received_ns) {
+        uint64_t sent_ns = realtimeNs();
+        for (size_t i = 0; i < io->size(); i++) {
+            size_t kind = static_cast<size_t>(batch_kinds[i]);
+            worker_metrics.packets[kind].add();
+            if (!isAnswered(batch_kinds[i])) {
+                continue;
+            }
+            uint64_t arrived_ns = io->begin()[i].rx_time_ns;
+            if (arrived_ns == 0 || arrived_ns > sent_ns) {
+                arrived_ns = received_ns;
+            }
+            worker_metrics.latency[kind].record(sent_ns - arrived_ns);
+        }
+        worker_metrics.recv_batches.add();
+        worker_metrics.responses_dropped.set(tx.droppedCount());
+        worker_metrics.responses_coalesced.set(tx.coalescedCount());
+    }
+
+    // Reserve a response slot, flushing first if the batch is full
+    uint8_t* prepareResponse(const struct sockaddr_in& client_addr, socklen_t client_addr_len) {
+        if (tx.full()) {
+            flushResponses();
+        }
+        return tx.prepare(client_addr, client_addr_len);
+    }
+
+    // Queue `type` followed by `prefix` and `payload`, clamped to one MTU.
+    // Both views are sent in place through iovecs; nothing is copied,
+    // unless `copy_payload` says the payload will not outlive the call.
+    void queueEcho(PacketType type, std::string_view prefix, std::string_view payload,
+                   const struct sockaddr_in& client_addr, socklen_t client_addr_len, bool copy_payload = false) {
+        uint8_t* response = prepareResponse(client_addr, client_addr_len);
+        size_t header = writeHeader(response, kMaxDatagramSize, type, request_id);
+        size_t room = kMaxDatagramSize - header - prefix.size();
+        size_t len = std::min(payload.size(), room);
+        tx.attach(prefix.data(), prefix.size());
+        if (copy_payload) {
+            // After the prefix on the wire, but in the slot's own buffer
+            memcpy(response + header, payload.data(), len);
+            tx.attach(response + header, len);
+        } else {
+            tx.attach(payload.data(), len);
+        }
+        tx.commit(header);
+    }
+
+    // Answer early data whose ticket was checked: accept it unless the
+    // ticket failed or the same early data was accepted before within
+    // the replay window. Views point into the receive ring or, when
+    // `reassembled`, into a reassembly block freed right after the call.
+    PacketKind answerEarlyData(ByteView ticket, TicketStatus status, ByteView early_data,
+                               const struct sockaddr_in& client_addr, socklen_t client_addr_len,
+                               bool reassembled = false) {
+        bool valid = status == TicketStatus::Valid;
+        bool replayed = valid && replay_filter &&
+            !replay_filter->checkAndInsert(ticket.data, ticket.size, early_data.data, early_data.size);
+
+        if (valid && !replayed) {
+            QLOG_INFO("Valid session ticket, accepting 0-RTT data");
+            QLOG_INFO("0-RTT Data: {}", early_data.str());
+
+            // Send successful 0-RTT response
+            queueEcho(PacketType::EarlyDataAccepted, k0RttResponsePrefix, early_data.str(),
+                      client_addr, client_addr_len, reassembled);
+            return PacketKind::EarlyDataAccepted;
+        }
+
+        if (replayed) {
+            QLOG_INFO("Replayed 0-RTT packet, rejecting 0-RTT data");
+            worker_metrics.rejected_replay.add();
+        } else if (status == TicketStatus::Expired) {
+            QLOG_INFO("Expired session ticket, rejecting 0-RTT data");
+            worker_metrics.rejected_expired.add();
+        } else {
+            QLOG_INFO("Invalid session ticket, rejecting 0-RTT data");
+            worker_metrics.rejected_bad_ticket.add();
+        }
+
+        // Send rejection
+        return rejectEarlyData(client_addr, client_addr_len);
+    }
+
+    // Admission control for one 0-RTT request; counts a refusal by reason
+    bool admitEarlyData(const struct sockaddr_in& client_addr) {
+        if (!admission) {
+            return true;
+        }
+        switch (admission->admit(client_addr.sin_addr.s_addr, batch_now_us)) {
+            case AdmissionDecision::Admit:
+                return true;
+            case AdmissionDecision::Shed:
+                worker_metrics.rejected_shed.add();
+                break;
+            case AdmissionDecision::SourceRate:
+                worker_metrics.rejected_source_rate.add();
+                break;
+            case AdmissionDecision::GlobalBudget:
+                worker_metrics.rejected_global_budget.add();
+                break;
+        }
+        return false;
+    }
+
+    // One piece of split early data. The first piece of a message to
+    // arrive passes admission and the ticket check before anything is
+    // buffered; the rest must carry the same ticket. The message is
+    // answered like unsplit early data when its last piece lands. Pieces
+    // of a known `connection` are gathered by its id, else by address.
+    PacketKind handleEarlyDataFragment(const ParsedPacket& packet, const ConnectionRecord* connection,
+                                       const struct sockaddr_in& client_addr, socklen_t client_addr_len) {
+        // Refused pieces of a message are each answered; the client takes
+        // the first answer
+        if (!reassembly || packet.fragment.total > reassembly->maxMessage()) {
+            worker_metrics.rejected_reassembly.add();
+            return rejectEarlyData(client_addr, client_addr_len);
+        }
+        uint64_t address = addressKey(client_addr);
+        bool by_connection_id = connection != nullptr;
+        uint64_t key = by_connection_id ? *packet.header.connection_id : address;
+        uint32_t id = reassembly->find(key, by_connection_id, request_id);
+        if (id == EarlyDataReassembler::kNoMessage) {
+            if (!admitEarlyData(client_addr)) {
+                return rejectEarlyData(client_addr, client_addr_len);
+            }
+            TicketStatus status = checkSessionTicket(packet.ticket.data, packet.ticket.size);
+            if (status != TicketStatus::Valid) {
+                return answerEarlyData(packet.ticket, status, {}, client_addr, client_addr_len);
+            }
+            id = reassembly->open(key, by_connection_id, address, request_id, packet.ticket,
+                                  packet.fragment.total, batch_now_us / 1000);
+            if (id == EarlyDataReassembler::kNoMessage) {
+                QLOG_INFO("Split 0-RTT data over the reassembly limits, rejecting it");
+                worker_metrics.rejected_reassembly.add();
+                return rejectEarlyData(client_addr, client_addr_len);
+            }
+        }
+
+        switch (reassembly->add(id, address, packet.ticket, packet.fragment, packet.payload)) {
+            case EarlyDataReassembler::Result::Buffered:
+            case EarlyDataReassembler::Result::Duplicate:
+                return PacketKind::EarlyDataBuffered;
+            case EarlyDataReassembler::Result::Invalid:
+                // Left open: a forged piece must not cancel the real message
+                QLOG_ERROR("Fragment does not match its 0-RTT message");
+                return PacketKind::Invalid;
+            case EarlyDataReassembler::Result::Complete:
+                break;
+        }
+        PacketKind kind = answerEarlyData(packet.ticket, TicketStatus::Valid, reassembly->message(id),
+                                          client_addr, client_addr_len, true);
+        reassembly->release(id);
+        return kind;
+    }
+
+    // Tell the senders of split early data that never completed to fall
+    // back to 1-RTT
+    void expireReassembly(uint64_t now_ms) {
+        size_t expired = reassembly->expire(now_ms, kReassemblyExpiryBudget,
+                                            [this](const EarlyDataReassembler::Message& message) {
+            struct sockaddr_in addr = addressOf(message.address);
+            request_id = message.has_request_id ? RequestId(message.request_id) : RequestId();
+            rejectEarlyData(addr, sizeof(addr));
+        });
+        if (expired > 0) {
+            worker_metrics.rejected_incomplete.add(expired);
+            flushResponses();
+        }
+    }
+
+    PacketKind handlePacket(const ParsedPacket& packet,
+                            const struct sockaddr_in& client_addr, socklen_t client_addr_len) {
+        if (!packet.valid) {
+            QLOG_ERROR("Invalid packet (type {})", (int)packet.header.type);
+            return PacketKind::Invalid;
+        }
+        request_id = packet.header.request_id;
+
+        switch (packet.type()) {
+            case PacketType::Handshake: {  // Initial handshake packet
+                QLOG_INFO("Received initial handshake from {}:{}",
+                          inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+
+                // Process handshake and generate session ticket
+                SessionTicket session_ticket = generateSessionTicket(addressKey(client_addr));
+
+                // Respond with handshake completion, ticket and connection id
+                uint8_t* response = prepareResponse(client_addr, client_addr_len);
+                Packet<PacketType::HandshakeResponse> reply{{session_ticket.data(), session_ticket.size()},
+                                                            openConnection(client_addr)};
+                tx.commit(encode(response, kMaxDatagramSize, reply, request_id));
+
+                QLOG_INFO("Sent session ticket to client");
+                return PacketKind::Handshake;
+            }
+
+            case PacketType::EarlyData: {  // 0-RTT data packet
+                QLOG_INFO("Received 0-RTT data from {}:{}",
+                          inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+                ConnectionRecord* connection = findConnection(packet);
+
+                // Split early data is answered once it is all here
+                PacketKind kind;
+                if (packet.fragment.present) {
+                    kind = handleEarlyDataFragment(packet, connection, client_addr, client_addr_len);
+                } else if (!admitEarlyData(client_addr)) {
+                    // Refused here, before the ticket is verified or looked up
+                    kind = rejectEarlyData(client_addr, client_addr_len);
+                } else {
+                    TicketStatus status = checkSessionTicket(packet.ticket.data, packet.ticket.size);
+                    kind = answerEarlyData(packet.ticket, status, packet.payload, client_addr, client_addr_len);
+                }
+                if (connection && kind == PacketKind::EarlyDataAccepted) {
+                    connection->early_data_accepted.fetch_add(1, std::memory_order_relaxed);
+                }
+                challengePath(connection, client_addr, client_addr_len);
+                return kind;
+            }
+
+            case PacketType::Regular: {  // Regular data packet
+                QLOG_INFO("Received regular data from {}:{}",
+                          inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
+                ConnectionRecord* connection = findConnection(packet);
+
+                std::string_view data = packet.payload.str();
+                QLOG_INFO("Regular Data: {}", data);
+
+                // Send response
+                queueEcho(PacketType::RegularResponse, kRegularResponsePrefix, data, client_addr, client_addr_len);
+                challengePath(connection, client_addr, client_addr_len);
+                return PacketKind::Regular;
+            }
+
+            case PacketType::PathResponse:
+                return handlePathResponse(packet, client_addr);
+
+            default:
+                QLOG_ERROR("Unexpected packet type: {}", (int)packet.header.type);
+                return PacketKind::Invalid;
+        }
+    }
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include "hash.h"
+
+// Anti-replay strike register for 0-RTT packets.
+//
+// The replay window is split into `buckets` time slices. Each slice has
+// its own Bloom filter generation, and a packet counts as a replay if any
+// live generation already holds it. Every key lands in a single 64-bit word,
+// so one fetch_or both tests and inserts it atomically and a lookup costs one
+// cache line per generation. Memory is allocated once from the configured
+// capacity and false-positive rate and never grows. If traffic exceeds the
+// capacity, the cost is extra false positives. A false positive only forces
+// that client back to a full handshake.
+//
+// There are buckets + 2 generations in the ring: the current one, `buckets`
+// older ones that are still checked, and one spare. tick() clears the spare
+// a slice at a time, so rotating never stalls the packet path.
+//
+// The words and the epoch can live in caller-owned memory, such as a
+// mapped state file, so a restarted server keeps its window. The clock
+// is CLOCK_MONOTONIC, so such state is only meaningful within one boot.
+
+// A packet is only caught as a replay while the filter remembers it, so
+// 0-RTT must never be accepted on a ticket older than the window: a
+// server using the filter caps the early data age at maxTicketAgeS().
+// Ticket times are whole seconds, hence one second under the window.
+struct ReplayFilterConfig {
+    uint64_t window_ms = 60000;   // how long a seen packet is remembered (at least)
+    uint32_t buckets = 6;         // time slices per window
+    uint64_t capacity = 1 << 20;  // distinct 0-RTT packets expected per window
+    double fp_rate = 1e-6;        // target false-replay probability per lookup
+
+    uint32_t maxTicketAgeS() const {
+        return window_ms >= 2000 ? static_cast<uint32_t>(std::min<uint64_t>(window_ms / 1000 - 1, UINT32_MAX)) : 0;
+    }
+};
+
+// Memory for a filter that does not own its storage
+struct ReplayFilterStorage {
+    std::atomic<uint64_t>* words;  // ReplayFilter::storageWords(config) of them
+    std::atomic<uint64_t>* epoch;
+    uint64_t seed;
+    bool restore;  // words and epoch already hold a filter with this seed and config
+};
+
+class ReplayFilter {
+private:
+    ReplayFilterConfig config;
+    uint32_t generations;
+    uint64_t bucket_ms;
+    uint64_t words_per_gen;
+    unsigned bits_per_key;
+    uint64_t seed;
+    std::unique_ptr<std::atomic<uint64_t>[]> owned_words;  // empty for external storage
+    std::atomic<uint64_t> owned_epoch;
+    std::atomic<uint64_t>* words;
+    std::atomic<uint64_t>* epoch;
+    uint64_t refuse_until;  // epoch before which every packet is refused
+    uint64_t clear_cursor;  // only touched by the thread calling tick()
+    std::atomic<uint64_t> accepted_count;
+    std::atomic<uint64_t> rejected_count;
+
+    // False-positive rate of a word-blocked Bloom filter holding `keys`
+    // keys in `num_words` 64-bit words with `k` bits per key
+    static double wordBlockedFpRate(double keys, double num_words, unsigned k) {
+        double lambda = keys / num_words;  // Poisson load per word
+        double pmf = std::exp(-lambda);
+        double fp = 0.0;
+        double limit = lambda + 12.0 * std::sqrt(lambda) + 12.0;
+        for (unsigned j = 0; j <= limit; j++) {
+            double fill = 1.0 - std::pow(1.0 - 1.0 / 64.0, static_cast<double>(j) * k);
+            fp += pmf * std::pow(fill, k);
+            pmf *= lambda / (j + 1);
+        }
+        return fp;
+    }
+
+    static double bestFpRate(double keys, double num_words, unsigned& best_k) {
+        double best = 1.0;
+        for (unsigned k = 1; k <= 24; k++) {
+            double fp = wordBlockedFpRate(keys, num_words, k);
+            if (fp < best) {
+                best = fp;
+                best_k = k;
+            }
+        }
+        return best;
+    }
+
+    // Size one generation: the fewest words that meet the target rate
+    static void sizeGenerations(const ReplayFilterConfig& config, uint64_t& words_per_gen, unsigned& bits_per_key) {
+        double keys = std::max<double>(1.0, static_cast<double>(config.capacity) / config.buckets);
+        // buckets + 1 generations are checked, so split the budget between them
+        double target = config.fp_rate / (config.buckets + 1);
+
+        uint64_t lo = 1;
+        uint64_t hi = static_cast<uint64_t>(keys) * 4 + 1;
+        unsigned k = 1;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (bestFpRate(keys, static_cast<double>(mid), k) <= target) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        words_per_gen = lo;
+        bestFpRate(keys, static_cast<double>(words_per_gen), bits_per_key);
+    }
+
+    // Up to `bits_per_key` distinct bit positions derived from the hash
+    uint64_t keyMask(uint64_t h) const {
+        uint64_t mask = 0;
+        uint64_t stream = hashMix(h ^ kHashP1, kHashP2);
+        unsigned used = 0;
+        unsigned set = 0;
+        while (set < bits_per_key) {
+            if (used == 10) {  // 10 six-bit positions per 64-bit draw
+                stream = hashMix(stream ^ kHashP3, kHashP0);
+                used = 0;
+            }
+            uint64_t bit = 1ULL << (stream & 63);
+            stream >>= 6;
+            used++;
+            if (!(mask & bit)) {
+                mask |= bit;
+                set++;
+            }
+        }
+        return mask;
+    }
+
+    std::atomic<uint64_t>* generation(uint64_t e) {
+        return words + (e % generations) * words_per_gen;
+    }
+
+    void clearSpareUpTo(uint64_t end) {
+        std::atomic<uint64_t>* spare = generation(epoch->load(std::memory_order_relaxed) + 1);
+        for (; clear_cursor < end; clear_cursor++) {
+            spare[clear_cursor].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static ReplayFilterConfig normalized(ReplayFilterConfig config) {
+        config.buckets = std::max<uint32_t>(config.buckets, 1);
+        return config;
+    }
+
+    void clearAll(uint64_t now_ms) {
+        for (uint64_t i = 0; i < generations * words_per_gen; i++) {
+            words[i].store(0, std::memory_order_relaxed);
+        }
+        epoch->store(now_ms / bucket_ms, std::memory_order_release);
+    }
+
+    explicit ReplayFilter(const ReplayFilterConfig& config)
+        : config(normalized(config)), generations(this->config.buckets + 2),
+          bucket_ms(std::max<uint64_t>(config.window_ms / this->config.buckets, 1)),
+          words_per_gen(1), bits_per_key(1), seed(0), owned_epoch(0), words(nullptr), epoch(&owned_epoch),
+          refuse_until(0), clear_cursor(0), accepted_count(0), rejected_count(0) {
+        sizeGenerations(this->config, words_per_gen, bits_per_key);
+    }
+
+public:
+    ReplayFilter(const ReplayFilterConfig& config, uint64_t now_ms) : ReplayFilter(config) {
+        seed = randomSeed();
+        owned_words.reset(new std::atomic<uint64_t>[generations * words_per_gen]);
+        words = owned_words.get();
+        clearAll(now_ms);
+    }
+
+    // A filter in `storage`, which must outlive it. With `restore` set the
+    // packets already recorded there stay recorded.
+    ReplayFilter(const ReplayFilterConfig& config, uint64_t now_ms, const ReplayFilterStorage& storage)
+        : ReplayFilter(config) {
+        seed = storage.seed;
+        words = storage.words;
+        epoch = storage.epoch;
+        if (!storage.restore) {
+            clearAll(now_ms);
+        }
+    }
+
+    // Words of external storage a filter with `config` needs
+    static uint64_t storageWords(const ReplayFilterConfig& config) {
+        ReplayFilterConfig sized = normalized(config);
+        uint64_t words_per_gen;
+        unsigned bits_per_key;
+        sizeGenerations(sized, words_per_gen, bits_per_key);
+        return (sized.buckets + 2) * words_per_gen;
+    }
+
+    // Length of one time slice for `config`
+    static uint64_t bucketMsFor(const ReplayFilterConfig& config) {
+        return std::max<uint64_t>(config.window_ms / normalized(config).buckets, 1);
+    }
+
+    // Treat every packet as a replay until `until_ms`, for a restart that
+    // lost the record of what was accepted before it
+    void refuseUntil(uint64_t until_ms) {
+        refuse_until = until_ms / bucket_ms + 1;
+    }
+
+    // Returns true the first time a (ticket, early data) pair is seen within
+    // the window and false for replays. Safe to call from any thread.
+    bool checkAndInsert(const uint8_t* ticket, size_t ticket_len,
+                        const uint8_t* data, size_t data_len) {
+        uint64_t h = hashBytes(data, data_len, hashBytes(ticket, ticket_len, seed));
+        uint64_t index = static_cast<uint64_t>((static_cast<__uint128_t>(h) * words_per_gen) >> 64);
+        uint64_t mask = keyMask(h);
+        uint64_t e = epoch->load(std::memory_order_acquire);
+        if (e < refuse_until) {
+            rejected_count.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        for (uint32_t i = 1; i <= config.buckets && i <= e; i++) {
+            if ((generation(e - i)[index].load(std::memory_order_relaxed) & mask) == mask) {
+                rejected_count.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+
+        uint64_t old = generation(e)[index].fetch_or(mask, std::memory_order_relaxed);
+        if ((old & mask) == mask) {
+            rejected_count.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        accepted_count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Rotate generations and clear the spare incrementally. Call from one
+    // thread only, every few milliseconds.
+    void tick(uint64_t now_ms) {
+        uint64_t target = now_ms / bucket_ms;
+        uint64_t e = epoch->load(std::memory_order_relaxed);
+
+        if (target > e + generations) {
+            // Idle for longer than the whole ring: everything is stale
+            clearAll(now_ms);
+            clear_cursor = 0;
+            return;
+        }
+
+        while (e < target) {
+            clearSpareUpTo(words_per_gen);
+            epoch->store(++e, std::memory_order_release);
+            clear_cursor = 0;
+        }
+
+        // Pace the clearing to finish halfway through the bucket
+        uint64_t elapsed = now_ms % bucket_ms;
+        uint64_t due = std::min(words_per_gen, words_per_gen * (2 * elapsed + 1) / bucket_ms);
+        clearSpareUpTo(due);
+    }
+
+    size_t memoryBytes() const {
+        return generations * words_per_gen * sizeof(uint64_t);
+    }
+
+    unsigned bitsPerKey() const { return bits_per_key; }
+    uint64_t bucketMs() const { return bucket_ms; }
+    uint32_t maxTicketAgeS() const { return config.maxTicketAgeS(); }
+    uint64_t accepted() const { return accepted_count.load(std::memory_order_relaxed); }
+    uint64_t rejected() const { return rejected_count.load(std::memory_order_relaxed); }
+};
@@ -1,281 +1,573 @@
-#include <iostream>
 #include <vector>
 #include <map>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <shared_mutex>
+#include <mutex>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include "logger.h"
+#include "metrics.h"
+#include "quic_server.h"
 
-// Simple QUIC server implementation using a basic socket-based approach
-// This demonstrates the concept without requiring complex libraries
+// Counts every heap allocation in the process so the stats can show that
+// steady-state packet handling does not allocate
+std::atomic<uint64_t> g_heap_allocations{0};
 
-class QuicServer {
+// Kept out of line: once inlined, GCC pairs the malloc/free inside them
+// with new/delete expressions and reports false mismatches
+__attribute__((noinline)) void* operator new(size_t size) {
+    g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+// Renders every worker's metrics as Prometheus text. Latency histograms
+// are summed over workers; counters keep a worker label.
+class ServerMetricsRenderer {
 private:
-    int sock_fd;
-    struct sockaddr_in local_addr;
-    std::map<std::string, int> connections;
-    bool running;
+    std::vector<QuicServer*> servers;
+    std::shared_ptr<ReplayFilter> replay_filter;
+    std::unique_ptr<LatencyHistogram::Snapshot> snapshot;
+    std::string label_buf;
+    char worker_ids[256][4];
 
-    // Simulated session store for resumption tickets
-    std::map<std::string, std::vector<uint8_t>> session_tickets;
+    std::string_view worker(QuicServer* server) { return worker_ids[server->shardId()]; }
 
 public:
-    QuicServer() : sock_fd(-1), running(false) {}
-
-    ~QuicServer() {
-        if (sock_fd >= 0) {
-            close(sock_fd);
+    ServerMetricsRenderer(std::vector<QuicServer*> servers, std::shared_ptr<ReplayFilter> replay_filter)
+        : servers(std::move(servers)), replay_filter(std::move(replay_filter)),
+          snapshot(std::make_unique<LatencyHistogram::Snapshot>()) {
+        for (int i = 0; i < 256; i++) {
+            snprintf(worker_ids[i], sizeof(worker_ids[i]), "%d", i);
         }
     }
 
-    bool init() {
-        // Create UDP socket
-        sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sock_fd < 0) {
-            std::cerr << "Failed to create socket" << std::endl;
-            return false;
+    void render(std::string& out) {
+        PrometheusWriter writer(out);
+
+        writer.family("quic_server_packets_total", "counter", "Datagrams handled, by outcome");
+        for (QuicServer* server : servers) {
+            for (size_t kind = 0; kind < kPacketKinds; kind++) {
+                writer.sample("quic_server_packets_total",
+                              PrometheusWriter::labels(label_buf, {{"worker", worker(server)},
+                                                                   {"type", kPacketKindNames[kind]}}),
+                              server->metrics().packets[kind].load());
+            }
         }
 
-        // Set socket options
-        int reuseaddr = 1;
-        if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) < 0) {
-            std::cerr << "Failed to set socket options" << std::endl;
-            return false;
+        writer.family("quic_server_early_data_rejections_total", "counter", "0-RTT packets answered with 0x05, by reason");
+        for (QuicServer* server : servers) {
+            writer.sample("quic_server_early_data_rejections_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"reason", "bad_ticket"}}),
+                          server->metrics().rejected_bad_ticket.load());
+            writer.sample("quic_server_early_data_rejections_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"reason", "replay"}}),
+                          server->metrics().rejected_replay.load());
+            writer.sample("quic_server_early_data_rejections_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"reason", "expired"}}),
+                          server->metrics().rejected_expired.load());
+            writer.sample("quic_server_early_data_rejections_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"reason", "shed"}}),
+                          server->metrics().rejected_shed.load());
+            writer.sample("quic_server_early_data_rejections_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"reason", "source_rate"}}),
+                          server->metrics().rejected_source_rate.load());
+            writer.sample("quic_server_early_data_rejections_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"reason", "global_budget"}}),
+                          server->metrics().rejected_global_budget.load());
+            writer.sample("quic_server_early_data_rejections_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"reason", "reassembly_limit"}}),
+                          server->metrics().rejected_reassembly.load());
+            writer.sample("quic_server_early_data_rejections_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"reason", "incomplete"}}),
+                          server->metrics().rejected_incomplete.load());
         }
 
-        // Make socket non-blocking
-        int flags = fcntl(sock_fd, F_GETFL, 0);
-        fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK);
+        writer.family("quic_server_overload_episodes_total", "counter",
+                      "Times the socket queue delay started shedding 0-RTT");
+        for (QuicServer* server : servers) {
+            writer.sample("quic_server_overload_episodes_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}}),
+                          server->metrics().overload_episodes.load());
+        }
 
-        // Bind to address
-        memset(&local_addr, 0, sizeof(local_addr));
-        local_addr.sin_family = AF_INET;
-        local_addr.sin_port = htons(4433);
-        local_addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+        writer.family("quic_server_connections", "gauge", "Open connections the worker owns");
+        for (QuicServer* server : servers) {
+            writer.sample("quic_server_connections",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}}),
+                          static_cast<uint64_t>(server->openConnections()));
+        }
 
-        if (bind(sock_fd, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
-            std::cerr << "Failed to bind socket" << std::endl;
-            return false;
+        writer.family("quic_server_connection_events_total", "counter", "Connection table events, by kind");
+        for (QuicServer* server : servers) {
+            writer.sample("quic_server_connection_events_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"event", "opened"}}),
+                          server->metrics().connections_opened.load());
+            writer.sample("quic_server_connection_events_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"event", "closed_idle"}}),
+                          server->metrics().connections_closed.load());
+            writer.sample("quic_server_connection_events_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"event", "untracked"}}),
+                          server->metrics().connections_untracked.load());
+            writer.sample("quic_server_connection_events_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"event", "migrated"}}),
+                          server->metrics().connection_migrations.load());
+            writer.sample("quic_server_connection_events_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"event", "unknown_id"}}),
+                          server->metrics().unknown_connection_ids.load());
         }
 
-        std::cout << "QUIC server initialized on 127.0.0.1:4433" << std::endl;
-        return true;
-    }
+        writer.family("quic_server_recv_batches_total", "counter", "recvmmsg calls that returned datagrams");
+        for (QuicServer* server : servers) {
+            writer.sample("quic_server_recv_batches_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}}),
+                          server->metrics().recv_batches.load());
+        }
 
-    // Generate a session ticket for 0-RTT resumption
-    std::vector<uint8_t> generateSessionTicket(const std::string& client_id) {
-        // In a real implementation, this would be an encrypted, authenticated blob
-        // For this demo, we'll just create a simple structure
-        std::vector<uint8_t> ticket;
-        
-        // Add a ticket identifier
-        ticket.push_back('T');
-        ticket.push_back('K');
-        ticket.push_back('T');
-        
-        // Add a timestamp (just demo purposes)
-        uint32_t timestamp = static_cast<uint32_t>(time(nullptr));
-        ticket.push_back((timestamp >> 24) & 0xFF);
-        ticket.push_back((timestamp >> 16) & 0xFF);
-        ticket.push_back((timestamp >> 8) & 0xFF);
-        ticket.push_back(timestamp & 0xFF);
-        
-        // Add client identifier (simplified)
-        for (char c : client_id) {
-            ticket.push_back(static_cast<uint8_t>(c));
+        writer.family("quic_server_responses_dropped_total", "counter", "Responses the kernel would not take");
+        for (QuicServer* server : servers) {
+            writer.sample("quic_server_responses_dropped_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}}),
+                          server->metrics().responses_dropped.load());
         }
-        
-        // Store ticket for validation later
-        session_tickets[client_id] = ticket;
-        
-        return ticket;
-    }
 
-    // Validate a session ticket
-    bool validateSessionTicket(const std::vector<uint8_t>& ticket, std::string& client_id) {
-        // In a real implementation, this would verify the ticket's authenticity
-        // For this demo, we'll just check if it's in our store
-        
-        if (ticket.size() < 7) {
-            return false;
+        writer.family("quic_server_responses_coalesced_total", "counter", "Responses sent inside a UDP GSO message");
+        for (QuicServer* server : servers) {
+            writer.sample("quic_server_responses_coalesced_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}}),
+                          server->metrics().responses_coalesced.load());
         }
-        
-        // Extract client ID from ticket (simplified)
-        client_id.clear();
-        for (size_t i = 7; i < ticket.size(); i++) {
-            client_id.push_back(static_cast<char>(ticket[i]));
+
+        writer.family("quic_server_session_tickets", "gauge", "Tickets held in the worker's store shard");
+        for (QuicServer* server : servers) {
+            writer.sample("quic_server_session_tickets",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}}),
+                          static_cast<uint64_t>(server->ticketStoreUsage().first));
+        }
+
+        writer.family("quic_server_session_ticket_store_bytes", "gauge", "Memory used by the worker's store shard");
+        for (QuicServer* server : servers) {
+            writer.sample("quic_server_session_ticket_store_bytes",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}}),
+                          static_cast<uint64_t>(server->ticketStoreUsage().second));
+        }
+
+        writer.family("quic_server_session_tickets_dropped_total", "counter",
+                      "Tickets removed from the worker's store shard, by reason");
+        for (QuicServer* server : servers) {
+            writer.sample("quic_server_session_tickets_dropped_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"reason", "expired"}}),
+                          server->metrics().tickets_expired.load());
+            writer.sample("quic_server_session_tickets_dropped_total",
+                          PrometheusWriter::labels(label_buf, {{"worker", worker(server)}, {"reason", "evicted"}}),
+                          server->metrics().tickets_evicted.load());
+        }
+
+        if (replay_filter) {
+            writer.family("quic_server_replay_filter_total", "counter", "0-RTT packets checked by the replay filter");
+            writer.sample("quic_server_replay_filter_total",
+                          PrometheusWriter::labels(label_buf, {{"result", "accepted"}}), replay_filter->accepted());
+            writer.sample("quic_server_replay_filter_total",
+                          PrometheusWriter::labels(label_buf, {{"result", "rejected"}}), replay_filter->rejected());
         }
-        
-        // Check if we have this ticket
-        return session_tickets.find(client_id) != session_tickets.end();
-    }
 
-    void run() {
-        running = true;
-        std::cout << "QUIC server running, waiting for connections..." << std::endl;
-        
-        while (running) {
-            uint8_t buf[1500];  // Standard MTU size
-            struct sockaddr_in client_addr;
-            socklen_t client_addr_len = sizeof(client_addr);
-
-            // Receive data
-            ssize_t recv_len = recvfrom(sock_fd, buf, sizeof(buf), 0,
-                                      (struct sockaddr *)&client_addr, &client_addr_len);
-            
-            if (recv_len < 0) {
-                if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                    // No data available, sleep a bit
-                    usleep(10000);  // 10ms
-                    continue;
-                }
-                std::cerr << "Failed to receive data: " << strerror(errno) << std::endl;
+        writer.family("quic_server_log_messages_dropped_total", "counter", "Log messages dropped because a ring was full");
+        writer.sample("quic_server_log_messages_dropped_total", "", Logger::instance().dropped());
+
+        writer.family("quic_server_packet_latency_seconds", "histogram",
+                      "Kernel arrival to response sent, by outcome");
+        for (size_t kind = 0; kind < kPacketKinds; kind++) {
+            if (!isAnswered(static_cast<PacketKind>(kind))) {
                 continue;
             }
+            sumLatency(kind);
+            writer.histogram("quic_server_packet_latency_seconds",
+                             PrometheusWriter::labels(label_buf, {{"type", kPacketKindNames[kind]}}), *snapshot);
+        }
 
-            std::string client_id = std::to_string(client_addr.sin_addr.s_addr) + ":" + 
-                                   std::to_string(ntohs(client_addr.sin_port));
-            
-            // Detect packet type
-            if (recv_len >= 1) {
-                uint8_t packet_type = buf[0];
-                
-                switch (packet_type) {
-                    case 0x01: {  // Initial handshake packet
-                        std::cout << "Received initial handshake from " << inet_ntoa(client_addr.sin_addr) 
-                                 << ":" << ntohs(client_addr.sin_port) << std::endl;
-                        
-                        // Process handshake and generate session ticket
-                        auto session_ticket = generateSessionTicket(client_id);
-                        
-                        // Respond with handshake completion and ticket
-                        uint8_t response[1500];
-                        response[0] = 0x02;  // Handshake response
-                        
-                        // Add ticket length and ticket data
-                        size_t ticket_len = session_ticket.size();
-                        response[1] = (ticket_len >> 8) & 0xFF;
-                        response[2] = ticket_len & 0xFF;
-                        
-                        memcpy(response + 3, session_ticket.data(), ticket_len);
-                        
-                        sendto(sock_fd, response, 3 + ticket_len, 0,
-                               (struct sockaddr *)&client_addr, client_addr_len);
-                        
-                        std::cout << "Sent session ticket to client" << std::endl;
-                        break;
-                    }
-                    
-                    case 0x03: {  // 0-RTT data packet
-                        std::cout << "Received 0-RTT data from " << inet_ntoa(client_addr.sin_addr) 
-                                 << ":" << ntohs(client_addr.sin_port) << std::endl;
-                        
-                        // Extract ticket
-                        if (recv_len < 3) {
-                            std::cerr << "Invalid 0-RTT packet" << std::endl;
-                            break;
-                        }
-                        
-                        uint16_t ticket_len = (buf[1] << 8) | buf[2];
-                        if (recv_len < 3 + ticket_len) {
-                            std::cerr << "Invalid 0-RTT packet (truncated ticket)" << std::endl;
-                            break;
-                        }
-                        
-                        std::vector<uint8_t> ticket(buf + 3, buf + 3 + ticket_len);
-                        std::string ticket_client_id;
-                        
-                        if (validateSessionTicket(ticket, ticket_client_id)) {
-                            std::cout << "Valid session ticket, accepting 0-RTT data" << std::endl;
-                            
-                            // Extract early data
-                            size_t data_offset = 3 + ticket_len;
-                            size_t data_len = recv_len - data_offset;
-                            
-                            std::string early_data(reinterpret_cast<char*>(buf + data_offset), data_len);
-                            std::cout << "0-RTT Data: " << early_data << std::endl;
-                            
-                            // Send successful 0-RTT response
-                            uint8_t response[1500];
-                            response[0] = 0x04;  // 0-RTT response
-                            
-                            std::string msg = "Received your 0-RTT data: " + early_data;
-                            memcpy(response + 1, msg.c_str(), msg.length());
-                            
-                            sendto(sock_fd, response, 1 + msg.length(), 0,
-                                   (struct sockaddr *)&client_addr, client_addr_len);
-                        } else {
-                            std::cout << "Invalid session ticket, rejecting 0-RTT data" << std::endl;
-                            
-                            // Send rejection
-                            uint8_t response[1500];
-                            response[0] = 0x05;  // 0-RTT rejection
-                            
-                            sendto(sock_fd, response, 1, 0,
-                                   (struct sockaddr *)&client_addr, client_addr_len);
-                        }
-                        break;
-                    }
-                    
-                    case 0x06: {  // Regular data packet
-                        std::cout << "Received regular data from " << inet_ntoa(client_addr.sin_addr) 
-                                 << ":" << ntohs(client_addr.sin_port) << std::endl;
-                        
-                        // Extract data
-                        std::string data(reinterpret_cast<char*>(buf + 1), recv_len - 1);
-                        std::cout << "Regular Data: " << data << std::endl;
-                        
-                        // Send response
-                        uint8_t response[1500];
-                        response[0] = 0x07;  // Regular data response
-                        
-                        std::string msg = "Received your regular data: " + data;
-                        memcpy(response + 1, msg.c_str(), msg.length());
-                        
-                        sendto(sock_fd, response, 1 + msg.length(), 0,
-                               (struct sockaddr *)&client_addr, client_addr_len);
-                        break;
-                    }
-                    
-                    default:
-                        std::cerr << "Unknown packet type: " << (int)packet_type << std::endl;
-                        break;
-                }
+        static constexpr std::pair<double, std::string_view> kQuantiles[] = {
+            {0.5, "0.5"}, {0.99, "0.99"}, {0.999, "0.999"},
+        };
+        writer.family("quic_server_packet_latency_quantile_seconds", "gauge",
+                      "Latency quantiles from the full-resolution histogram, by outcome");
+        for (size_t kind = 0; kind < kPacketKinds; kind++) {
+            if (!isAnswered(static_cast<PacketKind>(kind))) {
+                continue;
+            }
+            sumLatency(kind);
+            for (const auto& quantile : kQuantiles) {
+                writer.sample("quic_server_packet_latency_quantile_seconds",
+                              PrometheusWriter::labels(label_buf, {{"type", kPacketKindNames[kind]},
+                                                                   {"quantile", quantile.second}}),
+                              snapshot->quantile(quantile.first) / 1e9);
             }
         }
     }
 
-    void stop() {
-        running = false;
+private:
+    void sumLatency(size_t kind) {
+        snapshot->clear();
+        for (QuicServer* server : servers) {
+            server->metrics().latency[kind].addTo(*snapshot);
+        }
     }
 };
 
-// Signal handler to gracefully stop the server
-QuicServer* g_server = nullptr;
+// Signal handler to gracefully stop every worker
+std::vector<QuicServer*> g_servers;
+MetricsEndpoint* g_metrics = nullptr;
 
-void signal_handler(int signal) {
-    if (g_server) {
-        std::cout << "Stopping server..." << std::endl;
-        g_server->stop();
+void signal_handler(int /*signal*/) {
+    for (QuicServer* server : g_servers) {
+        server->stop();
     }
 }
 
-int main() {
-    // Register signal handler
-    signal(SIGINT, signal_handler);
-    
-    QuicServer server;
-    g_server = &server;
-    
-    if (!server.init()) {
-        std::cerr << "Failed to initialize server" << std::endl;
+// SIGUSR1 writes the current metrics to the log
+void metrics_signal_handler(int /*signal*/) {
+    if (g_metrics) {
+        g_metrics->requestDump();
+    }
+}
+
+// Pin the calling thread to one core so each shard stays cache-local
+void pinToCore(unsigned core) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core % std::thread::hardware_concurrency(), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+int main(int argc, char* argv[]) {
+    size_t batch_size = kDefaultBatchSize;
+    unsigned workers = 1;
+    bool anti_replay = false;
+    bool stateless_tickets = false;
+    bool udp_offload = true;
+    IoBackend io_backend = IoBackend::Socket;
+    bool sqpoll = false;
+    uint64_t key_rotation_s = 3600;
+    uint64_t key_grace_s = 7200;
+    std::string metrics_socket;
+    std::string state_path;
+    uint64_t checkpoint_s = 5;
+    std::string shared_name;
+    ReplayFilterConfig replay_config;
+    TicketLifetimeConfig ticket_lifetime;
+    AdmissionConfig admission;
+    ReassemblyConfig reassembly;
+    ConnectionTableConfig connection_config;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--batch" && i + 1 < argc) {
+            batch_size = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--workers" && i + 1 < argc) {
+            // 0 selects one worker per core
+            workers = std::atoi(argv[++i]);
+        } else if (arg == "--anti-replay") {
+            anti_replay = true;
+        } else if (arg == "--stateless-tickets") {
+            stateless_tickets = true;
+        } else if (arg == "--key-rotation" && i + 1 < argc) {
+            key_rotation_s = std::max(1ULL, std::strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--key-grace" && i + 1 < argc) {
+            key_grace_s = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--ticket-lifetime" && i + 1 < argc) {
+            ticket_lifetime.lifetime_s = static_cast<uint32_t>(std::max(1ULL, std::strtoull(argv[++i], nullptr, 10)));
+        } else if (arg == "--max-early-data-age" && i + 1 < argc) {
+            ticket_lifetime.max_early_data_age_s = static_cast<uint32_t>(std::strtoull(argv[++i], nullptr, 10));
+        } else if (arg == "--ticket-store-max" && i + 1 < argc) {
+            ticket_lifetime.max_tickets = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--replay-window" && i + 1 < argc) {
+            replay_config.window_ms = std::strtoull(argv[++i], nullptr, 10) * 1000;
+        } else if (arg == "--replay-capacity" && i + 1 < argc) {
+            replay_config.capacity = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--replay-fp" && i + 1 < argc) {
+            replay_config.fp_rate = std::atof(argv[++i]);
+        } else if (arg == "--io-uring") {
+            io_backend = IoBackend::IoUring;
+        } else if (arg == "--sqpoll") {
+            io_backend = IoBackend::IoUring;
+            sqpoll = true;
+        } else if (arg == "--no-udp-offload") {
+            udp_offload = false;
+        } else if (arg == "--metrics-socket" && i + 1 < argc) {
+            metrics_socket = argv[++i];
+        } else if (arg == "--state-file" && i + 1 < argc) {
+            state_path = argv[++i];
+        } else if (arg == "--state-checkpoint" && i + 1 < argc) {
+            checkpoint_s = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--shared-store" && i + 1 < argc) {
+            shared_name = argv[++i];
+        } else if (arg == "--early-data-max" && i + 1 < argc) {
+            reassembly.max_message = std::min<size_t>(std::strtoull(argv[++i], nullptr, 10), kMaxEarlyDataSize);
+        } else if (arg == "--early-data-buffer" && i + 1 < argc) {
+            reassembly.max_bytes = std::max(1ULL, std::strtoull(argv[++i], nullptr, 10)) << 20;
+        } else if (arg == "--early-data-timeout" && i + 1 < argc) {
+            reassembly.timeout_ms = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--max-connections" && i + 1 < argc) {
+            // 0 turns connection tracking off
+            connection_config.max_connections = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--idle-timeout" && i + 1 < argc) {
+            connection_config.idle_timeout_ms =
+                static_cast<uint32_t>(std::max(1ULL, std::strtoull(argv[++i], nullptr, 10)) * 1000);
+        } else if (arg == "--shed-queue-delay" && i + 1 < argc) {
+            admission.shed_queue_delay_us = static_cast<uint64_t>(std::max(0.0, std::atof(argv[++i])) * 1000);
+        } else if (arg == "--early-data-source-rate" && i + 1 < argc) {
+            admission.source_rate = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--early-data-source-burst" && i + 1 < argc) {
+            admission.source_burst = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--early-data-rate" && i + 1 < argc) {
+            admission.global_rate = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "--early-data-burst" && i + 1 < argc) {
+            admission.global_burst = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else {
+            QLOG_ERROR("Usage: {} [--batch N] [--workers N] [--anti-replay]"
+                       " [--replay-window SECONDS] [--replay-capacity N] [--replay-fp RATE]"
+                       " [--stateless-tickets] [--key-rotation SECONDS] [--key-grace SECONDS]"
+                       " [--ticket-lifetime SECONDS] [--max-early-data-age SECONDS] [--ticket-store-max N]"
+                       " [--io-uring] [--sqpoll] [--no-udp-offload] [--metrics-socket PATH]"
+                       " [--state-file PATH] [--state-checkpoint SECONDS] [--shared-store NAME]"
+                       " [--shed-queue-delay MS] [--early-data-source-rate N] [--early-data-source-burst N]"
+                       " [--early-data-rate N] [--early-data-burst N]"
+                       " [--early-data-max BYTES] [--early-data-buffer MIB] [--early-data-timeout MS]"
+                       " [--max-connections N] [--idle-timeout SECONDS]",
+                       argv[0]);
+            return 1;
+        }
+    }
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers = std::min(workers, 256u);  // shard id is one byte in the ticket
+    if (!shared_name.empty() && !state_path.empty()) {
+        // Shared memory already outlives any one process
+        QLOG_ERROR("--shared-store and --state-file cannot be combined");
         return 1;
     }
-    
-    server.run();
+
+    // Warm restart: tickets, replay window and keys live in a mapped file
+    std::shared_ptr<ServerStateFile> state;
+    if (!state_path.empty()) {
+        ServerStateLayout layout;
+        layout.shards = workers;
+        layout.shard_capacity = TicketTable::capacityFor(stateless_tickets ? 1 : ticket_lifetime.max_tickets);
+        layout.anti_replay = anti_replay;
+        layout.replay = replay_config;
+        state = std::make_shared<ServerStateFile>();
+        if (!state->open(state_path, layout)) {
+            return 1;
+        }
+        if (state->wasRestored()) {
+            QLOG_INFO("Restored server state from {} (last checkpoint {}s ago)", state_path,
+                      state->checkpointAgeMs(realtimeNs() / 1000000) / 1000);
+        } else {
+            QLOG_INFO("Server state kept in {} ({} MiB)", state_path, state->fileBytes() >> 20);
+        }
+    }
+
+    // Multi-process: every server on the host attaches to one segment
+    std::shared_ptr<SharedStore> shared;
+    if (!shared_name.empty()) {
+        SharedStoreLayout layout;
+        layout.ticket_capacity = stateless_tickets ? 1 : ticket_lifetime.max_tickets;
+        layout.anti_replay = anti_replay;
+        layout.replay = replay_config;
+        shared = std::make_shared<SharedStore>();
+        if (!shared->open(shared_name, layout, monotonicMs())) {
+            return 1;
+        }
+        QLOG_INFO("Shared store {} attached ({} MiB, {} processes)", shared->segmentName(),
+                  shared->segmentBytes() >> 20, shared->processes());
+    }
+
+    std::shared_ptr<ReplayFilter> replay_filter;
+    if (anti_replay) {
+        if (shared) {
+            replay_filter = std::make_shared<ReplayFilter>(replay_config, monotonicMs(), shared->replayStorage());
+        } else if (state) {
+            replay_filter = std::make_shared<ReplayFilter>(replay_config, monotonicMs(), state->replayStorage());
+        } else {
+            replay_filter = std::make_shared<ReplayFilter>(replay_config, monotonicMs());
+        }
+        QLOG_INFO("0-RTT replay protection on: {}s window, {} KiB, {} bits per packet",
+                  replay_config.window_ms / 1000, replay_filter->memoryBytes() / 1024,
+                  replay_filter->bitsPerKey());
+        if (std::min(ticket_lifetime.lifetime_s, ticket_lifetime.max_early_data_age_s) >
+            replay_filter->maxTicketAgeS()) {
+            QLOG_WARN("0-RTT limited to tickets at most {}s old, inside the replay window",
+                      replay_filter->maxTicketAgeS());
+        }
+
+        // Tickets survived but the record of what was accepted with them
+        // may not have: refuse 0-RTT until that record would have expired
+        if (state && state->wasRestored() && !state->replayRestored()) {
+            replay_filter->refuseUntil(monotonicMs() + replay_config.window_ms);
+            QLOG_WARN("Replay window not restored (first start since reboot); refusing 0-RTT for {}s",
+                      replay_config.window_ms / 1000);
+        }
+    }
+
+    std::shared_ptr<TicketKeyring> ticket_keys;
+    if (stateless_tickets) {
+        ticket_keys = std::make_shared<TicketKeyring>(key_rotation_s * 1000, key_grace_s * 1000,
+                                                      monotonicMs());
+        if (state && state->loadKeys(*ticket_keys, monotonicMs(), realtimeNs() / 1000000)) {
+            QLOG_INFO("Stateless ticket keys restored");
+        } else if (state) {
+            state->saveKeys(*ticket_keys, monotonicMs(), realtimeNs() / 1000000);
+        }
+        // The first process's keys become everyone's
+        if (shared && !shared->publishKeys(*ticket_keys, true)) {
+            shared->syncKeys(*ticket_keys);
+            QLOG_INFO("Stateless ticket keys taken from the shared store");
+        }
+        QLOG_INFO("Stateless session tickets on: keys rotate every {}s", key_rotation_s);
+    } else if (shared) {
+        QLOG_INFO("Session tickets live {}s, at most {} on this host",
+                  ticket_lifetime.lifetime_s, ticket_lifetime.max_tickets);
+    } else {
+        QLOG_INFO("Session tickets live {}s, at most {} per worker",
+                  ticket_lifetime.lifetime_s, ticket_lifetime.max_tickets);
+    }
+
+    // Stateless tickets and the shared store never touch the shards, so
+    // keep them minimal
+    std::shared_ptr<TicketShards> shards;
+    if (state) {
+        shards = std::make_shared<TicketShards>(workers, *state);
+        size_t restored = 0;
+        for (unsigned i = 0; i < workers; i++) {
+            restored += (*shards)[i].session_tickets.size();
+        }
+        if (restored > 0) {
+            QLOG_INFO("{} session tickets restored", restored);
+        }
+    } else {
+        shards = std::make_shared<TicketShards>(workers, stateless_tickets || shared ? 16 : 1 << 16);
+    }
+    // 0-RTT admission control; the global budget is shared by the workers
+    std::shared_ptr<EarlyDataBudget> early_data_budget;
+    if (admission.global_rate) {
+        early_data_budget = std::make_shared<EarlyDataBudget>(admission.global_rate, admission.global_burst);
+    }
+    if (admission.enabled()) {
+        QLOG_INFO("0-RTT admission control on: shed above {}us queue delay, {}/s per source, {}/s in total",
+                  admission.shed_queue_delay_us, admission.source_rate, admission.global_rate);
+    }
+
+    if (reassembly.max_message > 0) {
+        QLOG_INFO("Split 0-RTT data up to {} bytes, {} MiB reassembly buffer per worker, {}ms to complete",
+                  reassembly.max_message, reassembly.max_bytes >> 20, reassembly.timeout_ms);
+    }
+
+    // Connections of all workers, found by the id the client sends back
+    std::shared_ptr<ConnectionTable> connections;
+    if (connection_config.max_connections > 0) {
+        connections = std::make_shared<ConnectionTable>(connection_config, workers);
+        QLOG_INFO("Connection table for {} connections, closed after {}s idle", connections->capacity(),
+                  connection_config.idle_timeout_ms / 1000);
+    }
+
+    std::vector<std::unique_ptr<QuicServer>> servers;
+    for (unsigned i = 0; i < workers; i++) {
+        servers.push_back(std::make_unique<QuicServer>(shards, i, batch_size));
+        servers.back()->enableReplayProtection(replay_filter);
+        servers.back()->enableStatelessTickets(ticket_keys);
+        servers.back()->setTicketLifetime(ticket_lifetime);
+        servers.back()->setAdmission(admission, early_data_budget);
+        servers.back()->setEarlyDataReassembly(reassembly);
+        servers.back()->enableConnectionTable(connections);
+        servers.back()->setUdpOffload(udp_offload);
+        servers.back()->setIoBackend(io_backend, sqpoll);
+        servers.back()->enableStateFile(state, std::chrono::seconds(checkpoint_s));
+        if (shared) {
+            servers.back()->enableSharedStore(shared);
+        }
+        if (!servers.back()->init()) {
+            QLOG_ERROR("Failed to initialize server");
+            return 1;
+        }
+        g_servers.push_back(servers.back().get());
+    }
+
+    // Worker 0 serves the metrics of every worker
+    auto renderer = std::make_shared<ServerMetricsRenderer>(g_servers, replay_filter);
+    auto metrics = std::make_shared<MetricsEndpoint>(metrics_socket, [renderer](std::string& out) {
+        renderer->render(out);
+    });
+    if (!metrics->init()) {
+        return 1;
+    }
+    servers[0]->enableMetrics(metrics);
+    g_metrics = metrics.get();
+
+    // Register signal handlers
+    signal(SIGINT, signal_handler);
+    signal(SIGUSR1, metrics_signal_handler);
+
+    uint64_t allocations_before = g_heap_allocations.load();
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < workers; i++) {
+        threads.emplace_back([&servers, i]() {
+            pinToCore(i);
+            servers[i]->run();
+        });
+    }
+    if (workers > 1) {
+        pinToCore(0);
+    }
+    servers[0]->run();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    QLOG_INFO("Stopping server...");
+    uint64_t allocations = g_heap_allocations.load() - allocations_before;
+
+    uint64_t packets = 0;
+    for (unsigned i = 0; i < workers; i++) {
+        if (workers > 1) {
+            QLOG_INFO("worker {}:", i);
+        }
+        servers[i]->printStats();
+        packets += servers[i]->packetsReceived();
+    }
+    QLOG_INFO("heap allocations while serving: {} ({:.2f} per packet)", allocations,
+              packets > 0 ? static_cast<double>(allocations) / packets : 0.0);
+    QLOG_INFO("logger dropped {} messages", Logger::instance().dropped());
+
+    // Leave a complete file for the next start
+    if (state) {
+        if (ticket_keys) {
+            state->saveKeys(*ticket_keys, monotonicMs(), realtimeNs() / 1000000);
+        }
+        state->checkpoint(realtimeNs() / 1000000);
+        state->close();
+    }
     
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hash.h"
+#include "logger.h"
+#include "replay_filter.h"
+#include "session_ticket.h"
+#include "ticket_table.h"
+
+// Warm-restart state: the ticket shards, the replay filter and the
+// stateless ticket keys, kept in one memory-mapped file so that a
+// restarted server serves validations from the first packet.
+//
+// The tables and the filter do not keep a copy in the heap: they live in
+// the mapping, so every insert is in the page cache the moment it is made
+// and a crashed or redeployed process loses nothing. checkpoint() only
+// starts writeback of the pages dirtied since the last one, which is what
+// bounds the loss if the machine itself goes down.
+//
+// Layout: a 4 KiB header, then the filter's words, then per shard the
+// table's control bytes and records, each section page-aligned. The
+// header records the layout; a file with another version or layout is
+// started afresh, with new seeds and keys, so nothing in it validates.
+//
+// The replay filter runs on CLOCK_MONOTONIC and a crash of the machine may
+// lose its latest inserts, so it is only reused within the boot that wrote
+// it. After a reboot the tickets and keys are still restored, and the
+// caller must refuse 0-RTT for one replay window (replayRestored() is
+// false) so that early data accepted before the restart cannot be replayed.
+
+struct ServerStateLayout {
+    uint32_t shards = 1;
+    uint64_t shard_capacity = 16;  // ticket slots per shard, see TicketTable::capacityFor()
+    bool anti_replay = false;
+    ReplayFilterConfig replay;
+};
+
+class ServerStateFile {
+private:
+    static constexpr char kMagic[8] = {'Q', 'S', 'R', 'V', 'S', 'T', 'A', 'T'};
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kHeaderSize = 4096;
+    static constexpr size_t kMaxShards = 256;
+    static constexpr size_t kBootIdSize = 40;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t shards;
+        char boot_id[kBootIdSize];  // of the boot that last opened the file
+        uint64_t checkpoint_wall_ms;
+
+        // The file is only reused if these match
+        uint64_t shard_capacity;
+        uint64_t replay_words;  // 0 without anti-replay
+        uint64_t replay_window_ms;
+        uint64_t replay_capacity;
+        double replay_fp_rate;
+        uint32_t replay_buckets;
+        uint32_t keys_saved;
+
+        uint64_t replay_seed;
+        std::atomic<uint64_t> replay_epoch;
+        TicketKeyring::Snapshot keys;  // expiries in wall-clock ms
+        uint64_t shard_seeds[kMaxShards];
+    };
+    static_assert(sizeof(Header) <= kHeaderSize, "state header fits its page");
+    static_assert(std::is_trivially_copyable<TicketKeyring::Snapshot>::value, "keys are stored as bytes");
+
+    std::string path;
+    int fd;
+    uint8_t* map;
+    size_t map_size;
+    Header* header;
+    ServerStateLayout layout;
+    size_t replay_offset;
+    size_t shards_offset;
+    size_t shard_size;
+    bool restored;
+    bool same_boot;
+
+    static size_t pageAlign(size_t n) { return (n + kHeaderSize - 1) / kHeaderSize * kHeaderSize; }
+
+    static std::string bootId() {
+        char buf[kBootIdSize] = {};
+        int boot_fd = ::open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+        if (boot_fd >= 0) {
+            ssize_t n = read(boot_fd, buf, sizeof(buf) - 1);
+            ::close(boot_fd);
+            if (n > 0) {
+                return std::string(buf, strnlen(buf, sizeof(buf))).substr(0, 36);
+            }
+        }
+        return "";
+    }
+
+    bool matches() const {
+        uint64_t replay_words = layout.anti_replay ? ReplayFilter::storageWords(layout.replay) : 0;
+        return memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 && header->version == kVersion &&
+               header->shards == layout.shards && header->shard_capacity == layout.shard_capacity &&
+               header->replay_words == replay_words &&
+               (!layout.anti_replay || (header->replay_window_ms == layout.replay.window_ms &&
+                                        header->replay_capacity == layout.replay.capacity &&
+                                        header->replay_fp_rate == layout.replay.fp_rate &&
+                                        header->replay_buckets == layout.replay.buckets));
+    }
+
+    bool mapFile(size_t size) {
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED) {
+            QLOG_ERROR("Failed to map {}: {}", path, strerror(errno));
+            return false;
+        }
+        map = static_cast<uint8_t*>(mem);
+        map_size = size;
+        header = reinterpret_cast<Header*>(map);
+        return true;
+    }
+
+    // Start the file afresh. The sections are zero-filled by ftruncate;
+    // the tables and the filter initialize themselves when attached.
+    bool create(size_t size) {
+        if (ftruncate(fd, 0) < 0 || ftruncate(fd, static_cast<off_t>(size)) < 0) {
+            QLOG_ERROR("Failed to size {}: {}", path, strerror(errno));
+            return false;
+        }
+        if (!mapFile(size)) {
+            return false;
+        }
+        header->version = kVersion;
+        header->shards = layout.shards;
+        header->shard_capacity = layout.shard_capacity;
+        header->replay_words = layout.anti_replay ? ReplayFilter::storageWords(layout.replay) : 0;
+        header->replay_window_ms = layout.replay.window_ms;
+        header->replay_capacity = layout.replay.capacity;
+        header->replay_fp_rate = layout.replay.fp_rate;
+        header->replay_buckets = layout.replay.buckets;
+        header->keys_saved = 0;
+        header->replay_seed = randomSeed();
+        for (size_t i = 0; i < kMaxShards; i++) {
+            header->shard_seeds[i] = randomSeed();
+        }
+        // Magic last: a file without it is started afresh next time
+        msync(map, kHeaderSize, MS_SYNC);
+        memcpy(header->magic, kMagic, sizeof(kMagic));
+        return true;
+    }
+
+    static uint64_t toWall(uint64_t mono_ms, uint64_t now_mono_ms, uint64_t now_wall_ms) {
+        if (mono_ms == 0 || mono_ms == UINT64_MAX) {
+            return mono_ms;
+        }
+        return mono_ms + now_wall_ms - now_mono_ms;
+    }
+
+    static uint64_t toMonotonic(uint64_t wall_ms, uint64_t now_mono_ms, uint64_t now_wall_ms) {
+        if (wall_ms == 0 || wall_ms == UINT64_MAX) {
+            return wall_ms;
+        }
+        // Already past: keep it nonzero so it still reads as used and expired
+        return wall_ms > now_wall_ms ? wall_ms - now_wall_ms + now_mono_ms : 1;
+    }
+
+public:
+    ServerStateFile()
+        : fd(-1), map(nullptr), map_size(0), header(nullptr), replay_offset(0), shards_offset(0),
+          shard_size(0), restored(false), same_boot(false) {}
+
+    ~ServerStateFile() { close(); }
+
+    ServerStateFile(const ServerStateFile&) = delete;
+    ServerStateFile& operator=(const ServerStateFile&) = delete;
+
+    // Map `file`, reusing its contents if it was written with the same
+    // layout. The file stays locked until close(), so two servers cannot
+    // share it.
+    bool open(const std::string& file, const ServerStateLayout& state_layout) {
+        path = file;
+        layout = state_layout;
+        if (layout.shards == 0 || layout.shards > kMaxShards) {
+            QLOG_ERROR("State file supports 1 to {} shards", kMaxShards);
+            return false;
+        }
+
+        fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            QLOG_ERROR("Failed to open {}: {}", path, strerror(errno));
+            return false;
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+            QLOG_ERROR("{} is in use by another server ({})", path, strerror(errno));
+            return false;
+        }
+
+        uint64_t replay_words = layout.anti_replay ? ReplayFilter::storageWords(layout.replay) : 0;
+        replay_offset = kHeaderSize;
+        shards_offset = replay_offset + pageAlign(replay_words * sizeof(uint64_t));
+        shard_size = pageAlign(layout.shard_capacity) + pageAlign(layout.shard_capacity * sizeof(TicketRecord));
+        size_t size = shards_offset + layout.shards * shard_size;
+
+        std::string boot = bootId();
+        struct stat st;
+        memset(&st, 0, sizeof(st));
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size && mapFile(size)) {
+            restored = matches();
+            if (!restored) {
+                munmap(map, map_size);
+                map = nullptr;
+            }
+        }
+        if (!restored) {
+            if (st.st_size > 0) {
+                QLOG_WARN("{} was written with another layout; starting it afresh", path);
+            }
+            if (!create(size)) {
+                return false;
+            }
+        }
+        same_boot = restored && !boot.empty() && strncmp(header->boot_id, boot.c_str(), kBootIdSize) == 0;
+        memset(header->boot_id, 0, kBootIdSize);
+        memcpy(header->boot_id, boot.data(), std::min(boot.size(), kBootIdSize - 1));
+        return true;
+    }
+
+    // Flush everything and release the file
+    void close() {
+        if (map) {
+            msync(map, map_size, MS_SYNC);
+            munmap(map, map_size);
+            map = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // True if the file held state from an earlier run with this layout
+    bool wasRestored() const { return restored; }
+
+    // True if the replay window was restored too, which needs the same boot
+    bool replayRestored() const { return restored && same_boot; }
+
+    // Age of the last checkpoint, for the log
+    uint64_t checkpointAgeMs(uint64_t now_wall_ms) const {
+        uint64_t at = header->checkpoint_wall_ms;
+        return at && now_wall_ms > at ? now_wall_ms - at : 0;
+    }
+
+    TicketTableStorage shardStorage(size_t shard) {
+        uint8_t* base = map + shards_offset + shard * shard_size;
+        return {base, reinterpret_cast<TicketRecord*>(base + pageAlign(layout.shard_capacity)),
+                layout.shard_capacity, header->shard_seeds[shard], restored};
+    }
+
+    ReplayFilterStorage replayStorage() {
+        return {reinterpret_cast<std::atomic<uint64_t>*>(map + replay_offset), &header->replay_epoch,
+                header->replay_seed, replayRestored()};
+    }
+
+    // Record the key ring; call whenever it rotates
+    void saveKeys(TicketKeyring& keys, uint64_t now_mono_ms, uint64_t now_wall_ms) {
+        TicketKeyring::Snapshot snapshot = keys.save();
+        for (auto& key : snapshot.keys) {
+            key.expires_ms = toWall(key.expires_ms, now_mono_ms, now_wall_ms);
+        }
+        snapshot.next_rotation_ms = toWall(snapshot.next_rotation_ms, now_mono_ms, now_wall_ms);
+        header->keys = snapshot;
+        header->keys_saved = 1;
+    }
+
+    // Put the saved key ring back; false if there is none
+    bool loadKeys(TicketKeyring& keys, uint64_t now_mono_ms, uint64_t now_wall_ms) const {
+        if (!restored || !header->keys_saved) {
+            return false;
+        }
+        TicketKeyring::Snapshot snapshot = header->keys;
+        for (auto& key : snapshot.keys) {
+            key.expires_ms = toMonotonic(key.expires_ms, now_mono_ms, now_wall_ms);
+        }
+        snapshot.next_rotation_ms = toMonotonic(snapshot.next_rotation_ms, now_mono_ms, now_wall_ms);
+        keys.restore(snapshot);
+        return true;
+    }
+
+    // Start writing back the pages dirtied since the last checkpoint.
+    // Does not wait for the disk.
+    void checkpoint(uint64_t now_wall_ms) {
+        header->checkpoint_wall_ms = now_wall_ms;
+        if (sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE) < 0) {
+            msync(map, map_size, MS_ASYNC);
+        }
+    }
+
+    size_t fileBytes() const { return map_size; }
+};
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <random>
+
+// Session ticket formats and the key ring for stateless tickets.
+//
+// Stored tickets:    'T' 'K' 'T' | timestamp(4) | shard(1) | client id
+// Stateless tickets: 'T' 'K' 'S' | key id(1) | timestamp(4) | client id | tag(16)
+//
+// A stateless ticket carries a SipHash-2-4-128 tag over everything before
+// it, keyed by a rotating ticket key. Validation is one MAC computation,
+// so the server keeps no per-client state.
+
+static constexpr size_t kMaxTicketSize = 63;
+static constexpr size_t kTicketHeaderSize = 8;
+static constexpr size_t kTicketTagSize = 16;
+
+// A session ticket held by value
+struct SessionTicket {
+    uint8_t len;
+    uint8_t bytes[kMaxTicketSize];
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return len; }
+};
+
+static_assert(sizeof(SessionTicket) == 64, "one ticket per cache line");
+
+inline void writeTicketTimestamp(uint8_t* out, uint32_t timestamp) {
+    out[0] = (timestamp >> 24) & 0xFF;
+    out[1] = (timestamp >> 16) & 0xFF;
+    out[2] = (timestamp >> 8) & 0xFF;
+    out[3] = timestamp & 0xFF;
+}
+
+inline uint32_t readTicketTimestamp(const uint8_t* in) {
+    return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+           (static_cast<uint32_t>(in[2]) << 8) | in[3];
+}
+
+// Build a ticket that is only valid while the issuing shard stores it
+inline SessionTicket makeStoredTicket(const uint8_t* client_id, size_t id_len,
+                                      uint8_t shard_id, uint32_t timestamp) {
+    SessionTicket ticket;
+    ticket.bytes[0] = 'T';
+    ticket.bytes[1] = 'K';
+    ticket.bytes[2] = 'T';
+    writeTicketTimestamp(ticket.bytes + 3, timestamp);
+    ticket.bytes[7] = shard_id;
+
+    id_len = id_len < kMaxTicketSize - kTicketHeaderSize ? id_len : kMaxTicketSize - kTicketHeaderSize;
+    memcpy(ticket.bytes + kTicketHeaderSize, client_id, id_len);
+    ticket.len = static_cast<uint8_t>(kTicketHeaderSize + id_len);
+    return ticket;
+}
+
+inline bool isStatelessTicket(const uint8_t* ticket, size_t len) {
+    return len >= kTicketHeaderSize + kTicketTagSize &&
+           ticket[0] == 'T' && ticket[1] == 'K' && ticket[2] == 'S';
+}
+
+// Issue time of either ticket format, in seconds since the epoch
+inline bool ticketTimestamp(const uint8_t* ticket, size_t len, uint32_t& timestamp) {
+    if (len < kTicketHeaderSize || ticket[0] != 'T' || ticket[1] != 'K') {
+        return false;
+    }
+    if (ticket[2] == 'T') {
+        timestamp = readTicketTimestamp(ticket + 3);
+        return true;
+    }
+    if (ticket[2] == 'S') {
+        timestamp = readTicketTimestamp(ticket + 4);
+        return true;
+    }
+    return false;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "sipHash128 assumes a little-endian host"
+#endif
+
+// SipHash-2-4 with 128-bit output
+inline void sipHash128(uint64_t k0, uint64_t k1, const uint8_t* data, size_t len, uint8_t out[16]) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1 ^ 0xee;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+    auto rotl = [](uint64_t x, int b) { return (x << b) | (x >> (64 - b)); };
+    auto round = [&]() {
+        v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+        v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+    };
+
+    size_t blocks = len / 8;
+    for (size_t i = 0; i < blocks; i++) {
+        uint64_t m;
+        memcpy(&m, data + i * 8, sizeof(m));
+        v3 ^= m;
+        round();
+        round();
+        v0 ^= m;
+    }
+
+    uint64_t b = static_cast<uint64_t>(len) << 56;
+    uint64_t tail = 0;
+    memcpy(&tail, data + blocks * 8, len - blocks * 8);
+    b |= tail;
+    v3 ^= b;
+    round();
+    round();
+    v0 ^= b;
+
+    v2 ^= 0xee;
+    for (int i = 0; i < 4; i++) {
+        round();
+    }
+    uint64_t h0 = v0 ^ v1 ^ v2 ^ v3;
+
+    v1 ^= 0xdd;
+    for (int i = 0; i < 4; i++) {
+        round();
+    }
+    uint64_t h1 = v0 ^ v1 ^ v2 ^ v3;
+
+    memcpy(out, &h0, 8);
+    memcpy(out + 8, &h1, 8);
+}
+
+// Rotating ticket keys. New tickets are sealed with the current key.
+// Rotated-out keys still validate for `grace_ms`, which should cover the
+// ticket lifetime. rotateIfDue() and restore() serialize on a mutex;
+// mint() and verify() may run concurrently on any thread and never take
+// it: each key slot is guarded by a sequence counter, so readers never
+// see a half-written key.
+class TicketKeyring {
+public:
+    static constexpr unsigned kKeySlots = 4;
+
+    // Every key and the rotation schedule, for carrying the keys across a
+    // restart. Times are on the caller's clock, as passed to the keyring.
+    struct Snapshot {
+        struct Key {
+            uint64_t k0;
+            uint64_t k1;
+            uint64_t expires_ms;  // 0 = never used
+            uint8_t id;
+        };
+        Key keys[kKeySlots];
+        uint64_t next_rotation_ms;
+        uint8_t current_id;
+    };
+
+private:
+    struct alignas(64) KeySlot {
+        std::atomic<uint32_t> seq{0};  // odd while being rewritten
+        std::atomic<uint64_t> k0{0};
+        std::atomic<uint64_t> k1{0};
+        std::atomic<uint64_t> expires_ms{0};  // 0 = never used
+        std::atomic<uint8_t> id{0};
+    };
+
+    KeySlot slots[kKeySlots];
+    std::atomic<uint8_t> current_id;
+    uint64_t rotation_ms;
+    uint64_t grace_ms;
+    uint64_t next_rotation_ms;
+    std::random_device rng;
+    std::mutex writer;
+
+    // Snapshot a slot's key if it is still `id` and unexpired
+    bool loadKey(uint8_t id, uint64_t now_ms, uint64_t& k0, uint64_t& k1) const {
+        const KeySlot& slot = slots[id % kKeySlots];
+        for (;;) {
+            uint32_t before = slot.seq.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            uint8_t slot_id = slot.id.load(std::memory_order_relaxed);
+            uint64_t expires = slot.expires_ms.load(std::memory_order_relaxed);
+            k0 = slot.k0.load(std::memory_order_relaxed);
+            k1 = slot.k1.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == before) {
+                return slot_id == id && expires != 0 && now_ms < expires;
+            }
+        }
+    }
+
+    void installKey(uint8_t id, uint64_t expires_ms) {
+        KeySlot& slot = slots[id % kKeySlots];
+        uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.k0.store((static_cast<uint64_t>(rng()) << 32) ^ rng(), std::memory_order_relaxed);
+        slot.k1.store((static_cast<uint64_t>(rng()) << 32) ^ rng(), std::memory_order_relaxed);
+        slot.expires_ms.store(expires_ms, std::memory_order_relaxed);
+        slot.id.store(id, std::memory_order_relaxed);
+        slot.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    void setExpiry(uint8_t id, uint64_t expires_ms) {
+        KeySlot& slot = slots[id % kKeySlots];
+        uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.expires_ms.store(expires_ms, std::memory_order_relaxed);
+        slot.seq.store(seq + 2, std::memory_order_release);
+    }
+
+public:
+    TicketKeyring(uint64_t rotation_ms, uint64_t grace_ms, uint64_t now_ms)
+        : current_id(0), rotation_ms(rotation_ms),
+          // Slots are reused round-robin, so a retired key must be gone
+          // before its slot comes around again
+          grace_ms(grace_ms < (kKeySlots - 2) * rotation_ms ? grace_ms : (kKeySlots - 2) * rotation_ms),
+          next_rotation_ms(now_ms + rotation_ms) {
+        installKey(0, UINT64_MAX);
+    }
+
+    // Returns true if a new key was installed
+    bool rotateIfDue(uint64_t now_ms) {
+        std::lock_guard<std::mutex> lock(writer);
+        if (now_ms < next_rotation_ms) {
+            return false;
+        }
+        uint8_t old_id = current_id.load(std::memory_order_relaxed);
+        uint8_t new_id = static_cast<uint8_t>(old_id + 1);
+        installKey(new_id, UINT64_MAX);
+        current_id.store(new_id, std::memory_order_release);
+        setExpiry(old_id, now_ms + grace_ms);
+        next_rotation_ms = now_ms + rotation_ms;
+        return true;
+    }
+
+    Snapshot save() {
+        std::lock_guard<std::mutex> lock(writer);
+        Snapshot snapshot;
+        for (unsigned i = 0; i < kKeySlots; i++) {
+            const KeySlot& slot = slots[i];
+            snapshot.keys[i] = {slot.k0.load(std::memory_order_relaxed), slot.k1.load(std::memory_order_relaxed),
+                                slot.expires_ms.load(std::memory_order_relaxed),
+                                slot.id.load(std::memory_order_relaxed)};
+        }
+        snapshot.next_rotation_ms = next_rotation_ms;
+        snapshot.current_id = current_id.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+
+    // Replace every key with the saved ones
+    void restore(const Snapshot& snapshot) {
+        std::lock_guard<std::mutex> lock(writer);
+        for (unsigned i = 0; i < kKeySlots; i++) {
+            KeySlot& slot = slots[i];
+            const Snapshot::Key& key = snapshot.keys[i];
+            uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+            slot.seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.k0.store(key.k0, std::memory_order_relaxed);
+            slot.k1.store(key.k1, std::memory_order_relaxed);
+            slot.expires_ms.store(key.expires_ms, std::memory_order_relaxed);
+            slot.id.store(key.id, std::memory_order_relaxed);
+            slot.seq.store(seq + 2, std::memory_order_release);
+        }
+        next_rotation_ms = snapshot.next_rotation_ms;
+        current_id.store(snapshot.current_id, std::memory_order_release);
+    }
+
+    SessionTicket mint(const uint8_t* client_id, size_t id_len, uint32_t timestamp, uint64_t now_ms) const {
+        SessionTicket ticket;
+        uint8_t id = current_id.load(std::memory_order_acquire);
+        uint64_t k0, k1;
+        loadKey(id, now_ms, k0, k1);
+
+        ticket.bytes[0] = 'T';
+        ticket.bytes[1] = 'K';
+        ticket.bytes[2] = 'S';
+        ticket.bytes[3] = id;
+        writeTicketTimestamp(ticket.bytes + 4, timestamp);
+
+        size_t max_id = kMaxTicketSize - kTicketHeaderSize - kTicketTagSize;
+        id_len = id_len < max_id ? id_len : max_id;
+        memcpy(ticket.bytes + kTicketHeaderSize, client_id, id_len);
+        size_t body_len = kTicketHeaderSize + id_len;
+
+        sipHash128(k0, k1, ticket.bytes, body_len, ticket.bytes + body_len);
+        ticket.len = static_cast<uint8_t>(body_len + kTicketTagSize);
+        return ticket;
+    }
+
+    bool verify(const uint8_t* ticket, size_t len, uint64_t now_ms) const {
+        if (!isStatelessTicket(ticket, len) || len > kMaxTicketSize) {
+            return false;
+        }
+        uint64_t k0, k1;
+        if (!loadKey(ticket[3], now_ms, k0, k1)) {
+            return false;
+        }
+
+        size_t body_len = len - kTicketTagSize;
+        uint8_t tag[kTicketTagSize];
+        sipHash128(k0, k1, ticket, body_len, tag);
+
+        // Constant-time compare
+        uint8_t diff = 0;
+        for (size_t i = 0; i < kTicketTagSize; i++) {
+            diff |= tag[i] ^ ticket[body_len + i];
+        }
+        return diff == 0;
+    }
+};
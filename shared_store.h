@@ -0,0 +1,480 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <time.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hash.h"
+#include "logger.h"
+#include "replay_filter.h"
+#include "session_ticket.h"
+#include "ticket_table.h"
+
+// Runs between an entry's bytes and its deadline; tests define it to kill
+// a writer halfway through an insert
+#ifndef SHARED_STORE_TORN_WRITE
+#define SHARED_STORE_TORN_WRITE()
+#endif
+
+// Ticket store and strike register shared by every server process on a
+// host, in one POSIX shared memory segment. With several processes behind
+// SO_REUSEPORT, a ticket issued by one validates in all of them, and an
+// early-data packet accepted by one is a replay for all of them.
+//
+// Tickets: a fixed array of buckets, each one seqlock and seven inline
+// entries. A ticket's key picks its bucket; a lookup scans the bucket
+// between two reads of the sequence and never writes. Inserts lock the
+// bucket and take the key's own entry, else an empty or expired one, else
+// the one expiring first. Entries expire lazily by their stored deadline.
+//
+// Strike register: the replay filter, with its words and epoch in the
+// segment. Inserts are one fetch_or, so it needs no lock. Rotation and
+// key rotation are done by one leader process at a time, which holds a
+// lease renewed by its timers.
+//
+// Crashes: a bucket's lock word holds the owner's pid. A writer that finds
+// it held by a process that no longer exists, or held for longer than any
+// write takes, takes it over and clears the entry the owner was writing,
+// so a crash costs at most one ticket. Pids must come from one namespace.
+
+struct SharedStoreLayout {
+    size_t ticket_capacity = 1 << 20;  // tickets for the whole host
+    bool anti_replay = false;
+    ReplayFilterConfig replay;
+};
+
+// Bucket entry; expires_s == 0 marks it empty
+struct SharedTicketEntry {
+    uint32_t expires_s;  // wall clock
+    uint8_t len;
+    uint8_t bytes[kMaxStoredTicketSize];
+};
+
+static_assert(sizeof(SharedTicketEntry) == 32, "entries pack two per cache line");
+
+class SharedStore {
+private:
+    static constexpr char kMagic[8] = {'Q', 'S', 'H', 'S', 'T', 'O', 'R', 'E'};
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kHeaderSize = 4096;
+    static constexpr size_t kBucketEntries = 7;
+    static constexpr uint8_t kNotWriting = 0xFF;
+    static constexpr unsigned kSpinsBeforeCheck = 1024;
+    static constexpr uint32_t kLockLeaseMs = 2000;   // no write holds a lock this long
+    static constexpr uint64_t kLeaderLeaseMs = 3000;  // leader timers renew at least every second
+
+    // Sequence lock that records its owner. The word is version << 32 |
+    // owner pid; the version is odd while the lock is held.
+    struct RobustLock {
+        std::atomic<uint64_t> word;
+        std::atomic<uint32_t> locked_ms;  // low bits of CLOCK_MONOTONIC when taken
+        std::atomic<uint8_t> writing;     // entry being changed, kNotWriting otherwise
+        std::atomic<uint8_t> filling;     // 1 if that entry was empty, so not yet counted
+        uint8_t reserved[2];
+    };
+
+    struct alignas(64) Bucket {
+        RobustLock lock;
+        SharedTicketEntry entries[kBucketEntries];
+    };
+    static_assert(sizeof(Bucket) == 256, "bucket is four cache lines");
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t buckets;
+        uint64_t replay_words;  // 0 without anti-replay
+        uint64_t replay_window_ms;
+        uint64_t replay_capacity;
+        double replay_fp_rate;
+        uint32_t replay_buckets;
+        uint32_t reserved2;
+        uint64_t ticket_seed;
+        uint64_t replay_seed;
+        std::atomic<uint64_t> replay_epoch;
+        std::atomic<uint64_t> leader_pid;
+        std::atomic<uint64_t> leader_heartbeat_ms;
+        std::atomic<uint64_t> tickets_used;  // entries ever filled; expired ones count until reused
+        std::atomic<uint64_t> recovered_locks;
+        std::atomic<uint32_t> processes;
+        RobustLock keys_lock;
+        std::atomic<uint64_t> keys_generation;  // 0 until a process publishes its keys
+        TicketKeyring::Snapshot keys;           // times on CLOCK_MONOTONIC, shared by the host
+    };
+    static_assert(sizeof(Header) <= kHeaderSize, "shared store header fits its page");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared memory needs lock-free atomics");
+
+    std::string name;
+    int fd;
+    uint8_t* map;
+    size_t map_size;
+    Header* header;
+    Bucket* buckets;
+    uint64_t bucket_mask;
+    uint32_t self;
+    std::atomic<uint64_t> synced_generation;  // keys generation this process has
+
+    static uint64_t clockMs() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    static bool processGone(uint32_t pid) {
+        return pid != 0 && kill(static_cast<pid_t>(pid), 0) < 0 && errno == ESRCH;
+    }
+
+    static uint64_t versionOf(uint64_t word) { return word >> 32; }
+
+    // Take over a lock whose owner died or stalled. The version moves on by
+    // two, so it stays odd (held, now by us) and readers see a change.
+    bool stealIfAbandoned(RobustLock& lock, uint64_t word, uint64_t& held) {
+        uint32_t owner = static_cast<uint32_t>(word);
+        uint32_t age = static_cast<uint32_t>(clockMs()) - lock.locked_ms.load(std::memory_order_relaxed);
+        if (!(owner != self && processGone(owner)) && age <= kLockLeaseMs) {
+            return false;
+        }
+        held = ((versionOf(word) + 2) << 32) | self;
+        if (!lock.word.compare_exchange_strong(word, held, std::memory_order_acquire)) {
+            return false;
+        }
+        lock.locked_ms.store(static_cast<uint32_t>(clockMs()), std::memory_order_relaxed);
+        header->recovered_locks.fetch_add(1, std::memory_order_relaxed);
+        QLOG_WARN("Recovered a shared store lock abandoned by process {}", owner);
+        return true;
+    }
+
+    // Returns the held word, for unlock()
+    uint64_t lock(RobustLock& lock) {
+        for (unsigned spin = 1;; spin++) {
+            uint64_t word = lock.word.load(std::memory_order_relaxed);
+            if (!(versionOf(word) & 1)) {
+                uint64_t held = ((versionOf(word) + 1) << 32) | self;
+                if (lock.word.compare_exchange_weak(word, held, std::memory_order_acquire)) {
+                    lock.locked_ms.store(static_cast<uint32_t>(clockMs()), std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+                    return held;
+                }
+                continue;
+            }
+            if (spin % kSpinsBeforeCheck == 0) {
+                uint64_t held;
+                if (stealIfAbandoned(lock, word, held)) {
+                    repair(lock);
+                    return held;
+                }
+                sched_yield();
+            }
+        }
+    }
+
+    void unlock(RobustLock& lock, uint64_t held) {
+        lock.writing.store(kNotWriting, std::memory_order_relaxed);
+        lock.word.store((versionOf(held) + 1) << 32, std::memory_order_release);
+    }
+
+    // Run `read()` until it saw a consistent state. A lock that stays held
+    // is checked for an abandoned owner, then released again.
+    template <typename Fn>
+    void readLocked(RobustLock& lock, Fn&& read) {
+        for (unsigned spin = 1;; spin++) {
+            uint64_t before = lock.word.load(std::memory_order_acquire);
+            if (versionOf(before) & 1) {
+                uint64_t held;
+                if (spin % kSpinsBeforeCheck == 0 && stealIfAbandoned(lock, before, held)) {
+                    repair(lock);
+                    unlock(lock, held);
+                }
+                continue;
+            }
+            read();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (lock.word.load(std::memory_order_relaxed) == before) {
+                return;
+            }
+        }
+    }
+
+    // Clear whatever a dead owner was halfway through writing. An entry
+    // that held a ticket before leaves tickets_used; one being filled was
+    // not counted yet, unless the owner died between counting and unlock.
+    void repair(RobustLock& lock) {
+        uint8_t writing = lock.writing.load(std::memory_order_relaxed);
+        if (&lock == &header->keys_lock || writing >= kBucketEntries) {
+            return;
+        }
+        Bucket* bucket = reinterpret_cast<Bucket*>(reinterpret_cast<uint8_t*>(&lock) - offsetof(Bucket, lock));
+        SharedTicketEntry& entry = bucket->entries[writing];
+        if (entry.len != 0 && !lock.filling.load(std::memory_order_relaxed)) {
+            header->tickets_used.fetch_sub(1, std::memory_order_relaxed);
+        }
+        entry.expires_s = 0;
+        entry.len = 0;
+        lock.writing.store(kNotWriting, std::memory_order_relaxed);
+    }
+
+    Bucket& bucketFor(const uint8_t* ticket, size_t len) const {
+        uint64_t h = hashBytes(ticket + kTicketHeaderSize, len - kTicketHeaderSize, header->ticket_seed);
+        return buckets[h & bucket_mask];
+    }
+
+    static bool sameKey(const SharedTicketEntry& entry, const uint8_t* ticket, size_t len) {
+        return entry.len == len && memcmp(entry.bytes + kTicketHeaderSize, ticket + kTicketHeaderSize,
+                                          len - kTicketHeaderSize) == 0;
+    }
+
+    bool matches(const SharedStoreLayout& layout, uint64_t bucket_count, uint64_t replay_words) const {
+        return memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 && header->version == kVersion &&
+               header->buckets == bucket_count && header->replay_words == replay_words &&
+               (!layout.anti_replay || (header->replay_window_ms == layout.replay.window_ms &&
+                                        header->replay_capacity == layout.replay.capacity &&
+                                        header->replay_fp_rate == layout.replay.fp_rate &&
+                                        header->replay_buckets == layout.replay.buckets));
+    }
+
+    bool mapSegment(size_t size) {
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mem == MAP_FAILED) {
+            QLOG_ERROR("Failed to map shared store {}: {}", name, strerror(errno));
+            return false;
+        }
+        map = static_cast<uint8_t*>(mem);
+        map_size = size;
+        header = reinterpret_cast<Header*>(map);
+        return true;
+    }
+
+    // First process on the host: lay out a zeroed segment
+    void initialize(const SharedStoreLayout& layout, uint64_t bucket_count, uint64_t replay_words,
+                    uint64_t now_ms) {
+        header->version = kVersion;
+        header->buckets = bucket_count;
+        header->replay_words = replay_words;
+        header->replay_window_ms = layout.replay.window_ms;
+        header->replay_capacity = layout.replay.capacity;
+        header->replay_fp_rate = layout.replay.fp_rate;
+        header->replay_buckets = layout.replay.buckets;
+        header->ticket_seed = randomSeed();
+        header->replay_seed = randomSeed();
+        // The filter's words are zero already; set its clock so that no
+        // process starts from epoch 0 and clears what others inserted
+        header->replay_epoch.store(now_ms / ReplayFilter::bucketMsFor(layout.replay), std::memory_order_relaxed);
+        header->keys_lock.writing.store(kNotWriting, std::memory_order_relaxed);
+        for (uint64_t i = 0; i < bucket_count; i++) {
+            buckets[i].lock.writing.store(kNotWriting, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(header->magic, kMagic, sizeof(kMagic));
+    }
+
+public:
+    SharedStore()
+        : fd(-1), map(nullptr), map_size(0), header(nullptr), buckets(nullptr), bucket_mask(0),
+          self(static_cast<uint32_t>(getpid())), synced_generation(0) {}
+
+    ~SharedStore() { close(); }
+
+    SharedStore(const SharedStore&) = delete;
+    SharedStore& operator=(const SharedStore&) = delete;
+
+    // Attach to segment `segment` (e.g. "/quic-tickets"), creating it if
+    // this is the first process. Every process must pass the same layout.
+    bool open(const std::string& segment, const SharedStoreLayout& layout, uint64_t now_ms) {
+        name = segment[0] == '/' ? segment : "/" + segment;
+        uint64_t bucket_count = 1;
+        while (bucket_count * 4 < layout.ticket_capacity) {  // about 4 of 7 entries used when full
+            bucket_count <<= 1;
+        }
+        uint64_t replay_words = layout.anti_replay ? ReplayFilter::storageWords(layout.replay) : 0;
+        size_t buckets_offset = kHeaderSize + (replay_words * sizeof(uint64_t) + kHeaderSize - 1) / kHeaderSize * kHeaderSize;
+        size_t size = buckets_offset + bucket_count * sizeof(Bucket);
+
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            QLOG_ERROR("Failed to open shared store {}: {}", name, strerror(errno));
+            return false;
+        }
+        // Held only while attaching, so one process lays the segment out
+        if (flock(fd, LOCK_EX) < 0) {
+            QLOG_ERROR("Failed to lock shared store {}: {}", name, strerror(errno));
+            return false;
+        }
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        bool create = ok && st.st_size == 0;
+        if (create && ftruncate(fd, static_cast<off_t>(size)) < 0) {
+            QLOG_ERROR("Failed to size shared store {}: {}", name, strerror(errno));
+            ok = false;
+        }
+        if (ok && !create && static_cast<size_t>(st.st_size) != size) {
+            QLOG_ERROR("Shared store {} has another layout; stop its servers or remove /dev/shm{}", name, name);
+            ok = false;
+        }
+        ok = ok && mapSegment(size);
+        if (ok) {
+            buckets = reinterpret_cast<Bucket*>(map + buckets_offset);
+            bucket_mask = bucket_count - 1;
+            if (create) {
+                initialize(layout, bucket_count, replay_words, now_ms);
+            } else if (!matches(layout, bucket_count, replay_words)) {
+                QLOG_ERROR("Shared store {} has another layout; stop its servers or remove /dev/shm{}", name, name);
+                ok = false;
+            }
+        }
+        if (ok) {
+            header->processes.fetch_add(1, std::memory_order_relaxed);
+        }
+        flock(fd, LOCK_UN);
+        if (!ok) {
+            close();
+        }
+        return ok;
+    }
+
+    void close() {
+        if (map) {
+            header->processes.fetch_sub(1, std::memory_order_relaxed);
+            uint64_t me = self;
+            header->leader_pid.compare_exchange_strong(me, 0);
+            munmap(map, map_size);
+            map = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // True if `ticket` was stored and has not expired
+    bool containsTicket(const uint8_t* ticket, size_t len, uint32_t now_s) {
+        if (len < kTicketHeaderSize || len > kMaxStoredTicketSize) {
+            return false;
+        }
+        Bucket& bucket = bucketFor(ticket, len);
+        bool found = false;
+        readLocked(bucket.lock, [&]() {
+            found = false;
+            for (const SharedTicketEntry& entry : bucket.entries) {
+                if (entry.len == len && entry.expires_s > now_s && memcmp(entry.bytes, ticket, len) == 0) {
+                    found = true;
+                    break;
+                }
+            }
+        });
+        return found;
+    }
+
+    // Store `ticket` until `expires_s`, replacing the one with the same key.
+    // `evicted` is set if a live ticket of another client made room.
+    bool insertTicket(const uint8_t* ticket, size_t len, uint32_t expires_s, uint32_t now_s, bool& evicted) {
+        evicted = false;
+        if (len < kTicketHeaderSize || len > kMaxStoredTicketSize) {
+            return false;
+        }
+        Bucket& bucket = bucketFor(ticket, len);
+        uint64_t held = lock(bucket.lock);
+
+        size_t target = 0;
+        unsigned rank = 3;  // 0 same key, 1 empty or expired, 2 live
+        for (size_t i = 0; i < kBucketEntries && rank > 0; i++) {
+            const SharedTicketEntry& entry = bucket.entries[i];
+            unsigned r = entry.expires_s != 0 && sameKey(entry, ticket, len) ? 0 : entry.expires_s <= now_s ? 1 : 2;
+            if (r < rank || (r == 2 && entry.expires_s < bucket.entries[target].expires_s)) {
+                target = i;
+                rank = r;
+            }
+        }
+        SharedTicketEntry& entry = bucket.entries[target];
+        evicted = rank == 2;
+        bool filling = entry.len == 0;
+        bucket.lock.filling.store(filling, std::memory_order_relaxed);
+        bucket.lock.writing.store(static_cast<uint8_t>(target), std::memory_order_relaxed);
+        entry.len = static_cast<uint8_t>(len);
+        memcpy(entry.bytes, ticket, len);
+        SHARED_STORE_TORN_WRITE();
+        entry.expires_s = expires_s;
+        if (filling) {
+            header->tickets_used.fetch_add(1, std::memory_order_relaxed);
+        }
+        unlock(bucket.lock, held);
+        return true;
+    }
+
+    ReplayFilterStorage replayStorage() {
+        return {reinterpret_cast<std::atomic<uint64_t>*>(map + kHeaderSize), &header->replay_epoch,
+                header->replay_seed, true};
+    }
+
+    // True if this process holds the leader lease and should rotate the
+    // shared filter and keys; takes the lease over from a leader that
+    // died or stopped renewing it. Call from one thread per process.
+    bool lead(uint64_t now_ms) {
+        uint64_t leader = header->leader_pid.load(std::memory_order_acquire);
+        if (leader == self) {
+            header->leader_heartbeat_ms.store(now_ms, std::memory_order_release);
+            return true;
+        }
+        uint64_t beat = header->leader_heartbeat_ms.load(std::memory_order_acquire);
+        if (leader != 0 && !processGone(static_cast<uint32_t>(leader)) && now_ms < beat + kLeaderLeaseMs) {
+            return false;
+        }
+        if (!header->leader_pid.compare_exchange_strong(leader, self, std::memory_order_acq_rel)) {
+            return false;
+        }
+        header->leader_heartbeat_ms.store(now_ms, std::memory_order_release);
+        QLOG_INFO("Process {} now rotates the shared replay filter and keys", self);
+        return true;
+    }
+
+    // Make `keys` the host's keys. With `only_if_unset`, do nothing if
+    // another process published first. Returns true if published.
+    bool publishKeys(TicketKeyring& keys, bool only_if_unset) {
+        TicketKeyring::Snapshot snapshot = keys.save();
+        uint64_t held = lock(header->keys_lock);
+        uint64_t generation = header->keys_generation.load(std::memory_order_relaxed);
+        bool publish = !only_if_unset || generation == 0;
+        if (publish) {
+            header->keys = snapshot;
+            header->keys_generation.store(generation + 1, std::memory_order_relaxed);
+            synced_generation.store(generation + 1, std::memory_order_relaxed);
+        }
+        unlock(header->keys_lock, held);
+        return publish;
+    }
+
+    // Bring `keys` up to the host's if another process has rotated them.
+    // Cheap when nothing changed. Returns true if the keys were replaced.
+    bool syncKeys(TicketKeyring& keys) {
+        uint64_t generation = header->keys_generation.load(std::memory_order_acquire);
+        if (generation == 0 || generation == synced_generation.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        TicketKeyring::Snapshot snapshot;
+        readLocked(header->keys_lock, [&]() {
+            generation = header->keys_generation.load(std::memory_order_relaxed);
+            snapshot = header->keys;
+        });
+        keys.restore(snapshot);
+        synced_generation.store(generation, std::memory_order_relaxed);
+        return true;
+    }
+
+    uint64_t ticketsUsed() const { return header->tickets_used.load(std::memory_order_relaxed); }
+    size_t ticketCapacity() const { return (bucket_mask + 1) * kBucketEntries; }
+    size_t segmentBytes() const { return map_size; }
+    uint64_t recoveredLocks() const { return header->recovered_locks.load(std::memory_order_relaxed); }
+    uint32_t processes() const { return header->processes.load(std::memory_order_relaxed); }
+    const std::string& segmentName() const { return name; }
+};
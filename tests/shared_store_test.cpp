@@ -0,0 +1,113 @@
+// Crash recovery of the shared ticket store: a writer killed halfway
+// through an insert must not leave a torn entry behind, whether the next
+// process to reach its bucket is a reader or a writer.
+//
+// Build: cmake --build <dir> --target shared_store_test
+// Usage: ./shared_store_test (or ctest)
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static bool crash_mid_write = false;
+#define SHARED_STORE_TORN_WRITE()   \
+    do {                            \
+        if (crash_mid_write) {      \
+            raise(SIGKILL);         \
+        }                           \
+    } while (0)
+
+#include "shared_store.h"
+
+static constexpr uint32_t kNowS = 100;
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// `header` fills the ticket's header bytes and `key` the rest, so tickets
+// with one key and another header replace each other
+static void makeTicket(uint8_t* ticket, uint8_t header, uint8_t key) {
+    memset(ticket, header, kTicketHeaderSize);
+    memset(ticket + kTicketHeaderSize, key, kMaxStoredTicketSize - kTicketHeaderSize);
+}
+
+// Insert `ticket` in a child process that dies before the entry's
+// deadline is written, so the bucket lock stays held by a dead pid
+static void insertAndDie(const std::string& segment, const SharedStoreLayout& layout, const uint8_t* ticket) {
+    pid_t child = fork();
+    if (child == 0) {
+        SharedStore store;
+        if (!store.open(segment, layout, 0)) {
+            _exit(1);
+        }
+        bool evicted;
+        crash_mid_write = true;
+        store.insertTicket(ticket, kMaxStoredTicketSize, kNowS + 1000, kNowS, evicted);
+        _exit(2);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    check(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL, "writer died mid-insert");
+}
+
+int main() {
+    std::string segment = "/quic-store-test-" + std::to_string(getpid());
+    SharedStoreLayout layout;
+    layout.ticket_capacity = 4;  // one bucket, so every ticket meets the torn one
+
+    SharedStore store;
+    if (!store.open(segment, layout, 0)) {
+        return 1;
+    }
+    uint8_t old_ticket[kMaxStoredTicketSize], new_ticket[kMaxStoredTicketSize];
+    uint8_t other[kMaxStoredTicketSize], other_new[kMaxStoredTicketSize];
+    uint8_t fill[kMaxStoredTicketSize], last[kMaxStoredTicketSize];
+    makeTicket(old_ticket, 1, 1);
+    makeTicket(new_ticket, 2, 1);
+    makeTicket(other, 3, 2);
+    makeTicket(other_new, 6, 2);
+    makeTicket(fill, 4, 3);
+    makeTicket(last, 5, 4);
+    bool evicted;
+
+    // Overwrite of a live entry; a writer comes next. The torn entry has
+    // the new bytes and the old deadline until the writer repairs it.
+    store.insertTicket(old_ticket, sizeof(old_ticket), kNowS + 500, kNowS, evicted);
+    insertAndDie(segment, layout, new_ticket);
+    check(store.insertTicket(other, sizeof(other), kNowS + 500, kNowS, evicted), "insert after a crash");
+    check(store.recoveredLocks() == 1, "writer recovered the lock");
+    check(!store.containsTicket(new_ticket, sizeof(new_ticket), kNowS), "torn entry cleared");
+    check(!store.containsTicket(old_ticket, sizeof(old_ticket), kNowS), "overwritten ticket lost");
+    check(store.containsTicket(other, sizeof(other), kNowS), "writer's ticket stored");
+    check(store.ticketsUsed() == 1, "count after a crashed overwrite");
+
+    // Fill of an empty entry; a writer comes next
+    insertAndDie(segment, layout, fill);
+    check(store.insertTicket(last, sizeof(last), kNowS + 500, kNowS, evicted), "insert after a crash");
+    check(store.recoveredLocks() == 2, "writer recovered the lock");
+    check(!store.containsTicket(fill, sizeof(fill), kNowS), "half-filled entry cleared");
+    check(store.ticketsUsed() == 2, "count after a crashed fill");
+
+    // Overwrite again; a reader comes next
+    insertAndDie(segment, layout, other_new);
+    check(!store.containsTicket(other_new, sizeof(other_new), kNowS), "reader sees no torn entry");
+    check(store.recoveredLocks() == 3, "reader recovered the lock");
+    check(store.containsTicket(last, sizeof(last), kNowS), "other tickets kept");
+    check(store.ticketsUsed() == 1, "count after a crashed overwrite");
+
+    store.close();
+    shm_unlink(segment.c_str());
+    if (failures == 0) {
+        printf("shared store crash recovery: ok\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
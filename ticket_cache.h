@@ -0,0 +1,362 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hash.h"
+#include "logger.h"
+
+// Client-side session ticket cache: one memory-mapped file holding the
+// tickets for many servers, keyed by server address and client identity.
+//
+// The file is a 64-byte header followed by a power-of-two array of
+// 128-byte slots. A key hashes to a slot and may live anywhere in the next
+// kProbeWindow slots, so a lookup touches at most a couple of pages and
+// startup costs one open() and one mmap() however many servers are cached.
+//
+// Any number of processes may map the same file. Each slot is a seqlock:
+// a writer claims it by moving the sequence from even to odd with a CAS,
+// writes, and makes it even again; readers copy the slot and retry if the
+// sequence moved. A writer that dies mid-update leaves its slot odd, and
+// that one slot is then skipped by everyone; the rest of the cache is
+// unaffected. Two processes storing the same key at once may leave two
+// copies; lookups take the most recently issued one.
+//
+// Tickets are opaque here. Expiry is the client's own view (issue time
+// plus the lifetime it was told or assumes); the server still decides.
+
+static constexpr size_t kMaxCachedTicketSize = 88;
+
+class TicketCache {
+public:
+    static constexpr size_t kDefaultSlots = size_t(1) << 16;  // 8 MiB file
+    static constexpr uint32_t kDefaultLifetimeS = 7200;
+
+private:
+    static constexpr char kMagic[8] = {'Q', 'T', 'K', 'C', 'A', 'C', 'H', 'E'};
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kProbeWindow = 16;
+    static constexpr unsigned kReadRetries = 64;
+    static constexpr unsigned kStoreRetries = 8;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t slot_size;
+        uint64_t slot_count;
+        uint64_t seed;  // hash seed, fixed for the life of the file
+        uint8_t reserved[32];
+    };
+    static_assert(sizeof(Header) == 64, "cache header layout");
+
+    struct Entry {
+        uint32_t server_ip;    // network order
+        uint16_t server_port;  // network order
+        uint8_t ticket_len;    // 0 for an empty slot
+        uint8_t reserved;
+        uint64_t identity;     // hash of the client identity
+        uint64_t issued_s;     // wall clock
+        uint64_t expires_s;
+        uint8_t ticket[kMaxCachedTicketSize];
+    };
+
+    struct Slot {
+        std::atomic<uint32_t> seq;  // odd while a writer owns the slot
+        uint32_t reserved;
+        Entry entry;
+    };
+    static_assert(sizeof(Slot) == 128, "cache slot layout");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "seqlock needs lock-free atomics in shared memory");
+
+    std::string path;
+    int fd;
+    void* map;
+    size_t map_size;
+    Header* header;
+    Slot* slots;
+    size_t mask;
+
+    static size_t fileSize(size_t slot_count) { return sizeof(Header) + slot_count * sizeof(Slot); }
+
+    uint64_t identityHash(std::string_view identity) const {
+        return hashBytes(identity.data(), identity.size(), header->seed);
+    }
+
+    size_t home(const sockaddr_in& server, uint64_t identity) const {
+        uint64_t key[2] = {(static_cast<uint64_t>(server.sin_addr.s_addr) << 16) | server.sin_port, identity};
+        return hashBytes(key, sizeof(key), header->seed) & mask;
+    }
+
+    static bool matches(const Entry& entry, const sockaddr_in& server, uint64_t identity) {
+        return entry.ticket_len != 0 && entry.server_ip == server.sin_addr.s_addr &&
+               entry.server_port == server.sin_port && entry.identity == identity;
+    }
+
+    // Consistent copy of a slot; false if a writer held it throughout
+    static bool readSlot(const Slot& slot, Entry& out, uint32_t& seq) {
+        for (unsigned i = 0; i < kReadRetries; i++) {
+            seq = slot.seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                continue;
+            }
+            memcpy(&out, &slot.entry, sizeof(out));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) == seq) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool mapFile(size_t size) {
+        map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            map = nullptr;
+            QLOG_ERROR("Failed to map {}: {}", path, strerror(errno));
+            return false;
+        }
+        map_size = size;
+        header = static_cast<Header*>(map);
+        slots = reinterpret_cast<Slot*>(static_cast<uint8_t*>(map) + sizeof(Header));
+        return true;
+    }
+
+    bool valid(size_t size) const {
+        return size >= sizeof(Header) && memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 &&
+               header->version == kVersion && header->slot_size == sizeof(Slot) &&
+               header->slot_count != 0 && (header->slot_count & (header->slot_count - 1)) == 0 &&
+               size == fileSize(header->slot_count);
+    }
+
+    // Size the file for `slot_count` slots and write a fresh header. The
+    // caller holds the file lock.
+    bool create(size_t slot_count) {
+        size_t size = fileSize(slot_count);
+        // Truncating to zero first drops any old slots, so the new file is all zeros
+        if (ftruncate(fd, 0) < 0 || ftruncate(fd, static_cast<off_t>(size)) < 0) {
+            QLOG_ERROR("Failed to size {}: {}", path, strerror(errno));
+            return false;
+        }
+        if (!mapFile(size)) {
+            return false;
+        }
+        header->version = kVersion;
+        header->slot_size = sizeof(Slot);
+        header->slot_count = slot_count;
+        header->seed = randomSeed();
+        // Magic last: a reader that sees it sees a complete header
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(header->magic, kMagic, sizeof(kMagic));
+        return true;
+    }
+
+public:
+    TicketCache() : fd(-1), map(nullptr), map_size(0), header(nullptr), slots(nullptr), mask(0) {}
+
+    ~TicketCache() { close(); }
+
+    TicketCache(const TicketCache&) = delete;
+    TicketCache& operator=(const TicketCache&) = delete;
+
+    // Map `file`, creating it with `slot_count` slots (rounded up to a power
+    // of two) if it does not exist or is not a cache of this version. An
+    // existing cache keeps its own size.
+    bool open(const std::string& file, size_t slot_count = kDefaultSlots) {
+        close();
+        path = file;
+        fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            QLOG_ERROR("Failed to open {}: {}", path, strerror(errno));
+            return false;
+        }
+        // Serialize creation against other processes opening the same file
+        if (flock(fd, LOCK_EX) < 0) {
+            QLOG_ERROR("Failed to lock {}: {}", path, strerror(errno));
+            close();
+            return false;
+        }
+
+        size_t slots_wanted = kProbeWindow;
+        while (slots_wanted < slot_count) {
+            slots_wanted <<= 1;
+        }
+
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        size_t size = ok ? static_cast<size_t>(st.st_size) : 0;
+        if (ok && size >= sizeof(Header)) {
+            ok = mapFile(size);
+            if (ok && !valid(size)) {
+                QLOG_WARN("{} is not a ticket cache of this version; starting it afresh", path);
+                munmap(map, map_size);
+                map = nullptr;
+                ok = create(slots_wanted);
+            }
+        } else if (ok) {
+            ok = create(slots_wanted);
+        }
+        flock(fd, LOCK_UN);
+        if (!ok) {
+            close();
+            return false;
+        }
+        mask = header->slot_count - 1;
+        return true;
+    }
+
+    void close() {
+        if (map) {
+            munmap(map, map_size);
+            map = nullptr;
+        }
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+        header = nullptr;
+        slots = nullptr;
+    }
+
+    bool isOpen() const { return map != nullptr; }
+    size_t capacity() const { return header ? header->slot_count : 0; }
+
+    // Remember `ticket` for `server` and `identity` until now + lifetime.
+    // Replaces the key's previous ticket; otherwise takes an empty or
+    // expired slot near the key's home, or the one that expires first.
+    bool store(const sockaddr_in& server, std::string_view identity, const uint8_t* ticket, size_t len,
+               uint32_t lifetime_s, uint64_t now_s) {
+        if (!map || len == 0 || len > kMaxCachedTicketSize) {
+            return false;
+        }
+        uint64_t id = identityHash(identity);
+        size_t start = home(server, id);
+
+        for (unsigned attempt = 0; attempt < kStoreRetries; attempt++) {
+            Slot* target = nullptr;
+            uint32_t target_seq = 0;
+            uint64_t target_rank = UINT64_MAX;
+            for (size_t i = 0; i < kProbeWindow; i++) {
+                Slot& slot = slots[(start + i) & mask];
+                Entry entry;
+                uint32_t seq;
+                if (!readSlot(slot, entry, seq)) {
+                    continue;
+                }
+                // Rank: the key itself, then empty, then expired, then soonest to expire
+                uint64_t rank;
+                if (matches(entry, server, id)) {
+                    rank = 0;
+                } else if (entry.ticket_len == 0) {
+                    rank = 1;
+                } else if (entry.expires_s <= now_s) {
+                    rank = 2;
+                } else {
+                    rank = 3 + entry.expires_s;
+                }
+                if (rank < target_rank) {
+                    target = &slot;
+                    target_seq = seq;
+                    target_rank = rank;
+                    if (rank == 0) {
+                        break;
+                    }
+                }
+            }
+            if (!target) {
+                return false;
+            }
+            // Someone else changed the slot since we looked: choose again
+            if (!target->seq.compare_exchange_strong(target_seq, target_seq + 1, std::memory_order_acquire)) {
+                continue;
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            Entry& entry = target->entry;
+            entry.server_ip = server.sin_addr.s_addr;
+            entry.server_port = server.sin_port;
+            entry.ticket_len = static_cast<uint8_t>(len);
+            entry.reserved = 0;
+            entry.identity = id;
+            entry.issued_s = now_s;
+            entry.expires_s = now_s + lifetime_s;
+            memcpy(entry.ticket, ticket, len);
+            memset(entry.ticket + len, 0, kMaxCachedTicketSize - len);
+            target->seq.store(target_seq + 2, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    // The unexpired ticket for `server` and `identity`, if there is one
+    bool lookup(const sockaddr_in& server, std::string_view identity, uint64_t now_s,
+                std::vector<uint8_t>& ticket) const {
+        if (!map) {
+            return false;
+        }
+        uint64_t id = identityHash(identity);
+        size_t start = home(server, id);
+        Entry best;
+        best.ticket_len = 0;
+        best.issued_s = 0;
+        for (size_t i = 0; i < kProbeWindow; i++) {
+            Entry entry;
+            uint32_t seq;
+            if (readSlot(slots[(start + i) & mask], entry, seq) && matches(entry, server, id) &&
+                entry.expires_s > now_s && entry.ticket_len <= kMaxCachedTicketSize &&
+                (best.ticket_len == 0 || entry.issued_s > best.issued_s)) {
+                best = entry;
+            }
+        }
+        if (best.ticket_len == 0) {
+            return false;
+        }
+        ticket.assign(best.ticket, best.ticket + best.ticket_len);
+        return true;
+    }
+
+    // Forget the ticket for `server` and `identity`, e.g. after the server
+    // rejected it
+    void erase(const sockaddr_in& server, std::string_view identity) {
+        if (!map) {
+            return;
+        }
+        uint64_t id = identityHash(identity);
+        size_t start = home(server, id);
+        for (size_t i = 0; i < kProbeWindow; i++) {
+            Slot& slot = slots[(start + i) & mask];
+            Entry entry;
+            uint32_t seq;
+            if (!readSlot(slot, entry, seq) || !matches(entry, server, id)) {
+                continue;
+            }
+            if (slot.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+                std::atomic_thread_fence(std::memory_order_release);
+                slot.entry.ticket_len = 0;
+                slot.seq.store(seq + 2, std::memory_order_release);
+            }
+        }
+    }
+
+    // Unexpired entries; walks the whole file
+    size_t liveEntries(uint64_t now_s) const {
+        size_t live = 0;
+        for (size_t i = 0; map && i <= mask; i++) {
+            Entry entry;
+            uint32_t seq;
+            if (readSlot(slots[i], entry, seq) && entry.ticket_len != 0 && entry.expires_s > now_s) {
+                live++;
+            }
+        }
+        return live;
+    }
+};
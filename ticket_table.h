@@ -0,0 +1,316 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "hash.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Session ticket store: an open-addressing hash table with inline,
+// fixed-size ticket records (SwissTable-style). One control byte per
+// slot holds a 7-bit hash tag, and probing scans 16 control bytes at a
+// time, with SSE2 where it is available. Insert and lookup never allocate.
+// The table only allocates when it grows, which doubles its size, or when
+// tombstones left by erase() pile up and it rehashes in place.
+//
+// Each record also carries a caller-owned 32-bit handle, which the server
+// uses for the ticket's expiry timer.
+//
+// A table can also live in caller-owned memory, such as a mapped state
+// file, so that it survives a restart as is. Such a table never moves:
+// it is sized up front with capacityFor(), rehashes in place, and refuses
+// inserts once it is full.
+
+static constexpr size_t kMaxStoredTicketSize = 27;
+
+struct TicketRecord {
+    uint8_t len;
+    uint8_t bytes[kMaxStoredTicketSize];
+    uint32_t timer;
+};
+
+static_assert(sizeof(TicketRecord) == 32, "two ticket records per cache line");
+
+// Memory for a table that does not own its storage
+struct TicketTableStorage {
+    uint8_t* ctrl;         // `capacity` control bytes
+    TicketRecord* slots;   // `capacity` records
+    size_t capacity;       // a power of two, at least 16
+    uint64_t seed;
+    bool restore;          // the memory already holds a table with this seed
+};
+
+class TicketTable {
+private:
+    static constexpr size_t kGroupSize = 16;
+    static constexpr uint8_t kEmpty = 0x80;
+    static constexpr uint8_t kDeleted = 0xFE;
+
+    uint8_t* ctrl;
+    TicketRecord* slots;
+    std::unique_ptr<uint8_t[]> owned_ctrl;  // empty for external storage
+    std::unique_ptr<TicketRecord[]> owned_slots;
+    size_t num_groups;  // power of two
+    size_t count;
+    size_t tombstones;
+    size_t key_offset;  // tickets are keyed on bytes [key_offset, len)
+    uint64_t seed;
+    bool external;
+
+    static uint8_t tagOf(uint64_t h) { return static_cast<uint8_t>(h & 0x7F); }
+
+    // Bitmask of positions in the group whose control byte equals `value`
+    static uint32_t matchGroup(const uint8_t* group, uint8_t value) {
+#if defined(__SSE2__)
+        __m128i ctrl_bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl_bytes, _mm_set1_epi8(value))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupSize; i++) {
+            mask |= static_cast<uint32_t>(group[i] == value) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Empty or deleted slots (both have the high bit set)
+    static uint32_t matchFree(const uint8_t* group) {
+#if defined(__SSE2__)
+        __m128i ctrl_bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl_bytes));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < kGroupSize; i++) {
+            mask |= static_cast<uint32_t>(group[i] >> 7) << i;
+        }
+        return mask;
+#endif
+    }
+
+    uint64_t hashKey(const uint8_t* ticket, size_t len) const {
+        size_t offset = len < key_offset ? len : key_offset;
+        return hashBytes(ticket + offset, len - offset, seed);
+    }
+
+    bool sameKey(const TicketRecord& record, const uint8_t* ticket, size_t len) const {
+        return record.len == len && len >= key_offset &&
+               memcmp(record.bytes + key_offset, ticket + key_offset, len - key_offset) == 0;
+    }
+
+    // Slot holding the ticket's key, or SIZE_MAX
+    size_t find(const uint8_t* ticket, size_t len, uint64_t h) const {
+        uint8_t tag = tagOf(h);
+        size_t mask = num_groups - 1;
+        size_t group = (h >> 7) & mask;
+
+        for (size_t step = 1; step <= num_groups; step++) {
+            const uint8_t* g = ctrl + group * kGroupSize;
+            for (uint32_t hits = matchGroup(g, tag); hits; hits &= hits - 1) {
+                size_t slot = group * kGroupSize + __builtin_ctz(hits);
+                if (sameKey(slots[slot], ticket, len)) {
+                    return slot;
+                }
+            }
+            if (matchGroup(g, kEmpty)) {
+                return SIZE_MAX;
+            }
+            group = (group + step) & mask;  // triangular probing visits every group
+        }
+        return SIZE_MAX;
+    }
+
+    size_t findFree(uint64_t h) const {
+        size_t mask = num_groups - 1;
+        size_t group = (h >> 7) & mask;
+        for (size_t step = 1;; step++) {
+            uint32_t free_slots = matchFree(ctrl + group * kGroupSize);
+            if (free_slots) {
+                return group * kGroupSize + __builtin_ctz(free_slots);
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    void allocate(size_t groups) {
+        num_groups = groups;
+        owned_ctrl.reset(new uint8_t[groups * kGroupSize]);
+        owned_slots.reset(new TicketRecord[groups * kGroupSize]);
+        ctrl = owned_ctrl.get();
+        slots = owned_slots.get();
+        memset(ctrl, kEmpty, groups * kGroupSize);
+        count = 0;
+        tombstones = 0;
+    }
+
+    bool overloaded() const { return (count + tombstones + 1) * 8 > num_groups * kGroupSize * 7; }
+
+    // External storage cannot move, so drop the tombstones where it is
+    void rehashInPlace() {
+        std::vector<TicketRecord> live;
+        live.reserve(count);
+        for (size_t i = 0; i < capacity(); i++) {
+            if (!(ctrl[i] & 0x80)) {
+                live.push_back(slots[i]);
+            }
+        }
+        memset(ctrl, kEmpty, capacity());
+        count = 0;
+        tombstones = 0;
+        for (const TicketRecord& record : live) {
+            uint64_t h = hashKey(record.bytes, record.len);
+            size_t slot = findFree(h);
+            ctrl[slot] = tagOf(h);
+            slots[slot] = record;
+            count++;
+        }
+    }
+
+    void rehash(size_t groups) {
+        if (external) {
+            if (tombstones > 0) {
+                rehashInPlace();
+            }
+            return;
+        }
+        std::unique_ptr<uint8_t[]> old_ctrl = std::move(owned_ctrl);
+        std::unique_ptr<TicketRecord[]> old_slots = std::move(owned_slots);
+        size_t old_capacity = num_groups * kGroupSize;
+
+        allocate(groups);
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (!(old_ctrl[i] & 0x80)) {
+                const TicketRecord& record = old_slots[i];
+                uint64_t h = hashKey(record.bytes, record.len);
+                size_t slot = findFree(h);
+                ctrl[slot] = tagOf(h);
+                slots[slot] = record;
+                count++;
+            }
+        }
+    }
+
+public:
+    // `key_offset` skips per-issue header bytes (timestamp etc.) so a
+    // client's newer ticket replaces its older one
+    explicit TicketTable(size_t key_offset, size_t initial_capacity = 1 << 16)
+        : ctrl(nullptr), slots(nullptr), num_groups(0), count(0), tombstones(0), key_offset(key_offset),
+          seed(randomSeed()), external(false) {
+        size_t groups = 1;
+        while (groups * kGroupSize < initial_capacity) {
+            groups <<= 1;
+        }
+        allocate(groups);
+    }
+
+    // A table in `storage`, which must outlive it. With `restore` set the
+    // tickets already there are kept; only the counts are recomputed.
+    TicketTable(size_t key_offset, const TicketTableStorage& storage)
+        : ctrl(storage.ctrl), slots(storage.slots), num_groups(storage.capacity / kGroupSize), count(0),
+          tombstones(0), key_offset(key_offset), seed(storage.seed), external(true) {
+        if (!storage.restore) {
+            memset(ctrl, kEmpty, capacity());
+            return;
+        }
+        for (size_t i = 0; i < capacity(); i++) {
+            if (ctrl[i] == kDeleted) {
+                tombstones++;
+            } else if (!(ctrl[i] & 0x80)) {
+                count++;
+            }
+        }
+    }
+
+    // Slots an external table needs to hold `tickets` within its load factor
+    static size_t capacityFor(size_t tickets) {
+        size_t capacity = kGroupSize;
+        while ((tickets + 1) * 8 > capacity * 7) {
+            capacity <<= 1;
+        }
+        return capacity;
+    }
+
+    // Insert or replace the ticket with the same key. Returns false if the
+    // ticket does not fit an inline record, or an external table is full.
+    // If a ticket was replaced, its handle is stored in `replaced`,
+    // otherwise UINT32_MAX.
+    bool insert(const uint8_t* ticket, size_t len, uint32_t timer = UINT32_MAX,
+                uint32_t* replaced = nullptr) {
+        if (replaced) {
+            *replaced = UINT32_MAX;
+        }
+        if (len > kMaxStoredTicketSize) {
+            return false;
+        }
+
+        uint64_t h = hashKey(ticket, len);
+        size_t slot = find(ticket, len, h);
+        if (slot != SIZE_MAX && replaced) {
+            *replaced = slots[slot].timer;
+        }
+        if (slot == SIZE_MAX) {
+            // Keep the load factor at or below 7/8, counting tombstones
+            if (overloaded()) {
+                rehash(count * 2 >= num_groups * kGroupSize ? num_groups * 2 : num_groups);
+                if (overloaded()) {
+                    return false;
+                }
+            }
+            slot = findFree(h);
+            if (ctrl[slot] == kDeleted) {
+                tombstones--;
+            }
+            ctrl[slot] = tagOf(h);
+            count++;
+        }
+        slots[slot].len = static_cast<uint8_t>(len);
+        memcpy(slots[slot].bytes, ticket, len);
+        slots[slot].timer = timer;
+        return true;
+    }
+
+    // True only if the exact ticket is stored
+    bool contains(const uint8_t* ticket, size_t len) const {
+        if (len > kMaxStoredTicketSize) {
+            return false;
+        }
+        size_t slot = find(ticket, len, hashKey(ticket, len));
+        return slot != SIZE_MAX && memcmp(slots[slot].bytes, ticket, len) == 0;
+    }
+
+    bool erase(const uint8_t* ticket, size_t len) {
+        if (len > kMaxStoredTicketSize) {
+            return false;
+        }
+        size_t slot = find(ticket, len, hashKey(ticket, len));
+        if (slot == SIZE_MAX) {
+            return false;
+        }
+        ctrl[slot] = kDeleted;
+        count--;
+        tombstones++;
+        return true;
+    }
+
+    // Call `fn(TicketRecord&)` for each ticket in slots [cursor, cursor +
+    // max_slots); `fn` may change the handle but not the ticket. Returns
+    // the slot to continue from, which is capacity() once all are visited.
+    template <typename Fn>
+    size_t visit(size_t cursor, size_t max_slots, Fn&& fn) {
+        size_t end = cursor + max_slots < capacity() ? cursor + max_slots : capacity();
+        for (; cursor < end; cursor++) {
+            if (!(ctrl[cursor] & 0x80)) {
+                fn(slots[cursor]);
+            }
+        }
+        return cursor;
+    }
+
+    size_t size() const { return count; }
+    size_t capacity() const { return num_groups * kGroupSize; }
+    size_t memoryBytes() const { return capacity() * (1 + sizeof(TicketRecord)); }
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timing wheel (Varghese & Lauck) for large numbers of
+// coarse timers, such as one expiry per stored session ticket.
+//
+// Four levels of 256 slots cover 2^32 ticks. A timer sits in the level of
+// the highest digit in which its deadline differs from the current tick,
+// so schedule() and cancel() are O(1). When a level's digit rolls over,
+// the slot for the new digit is re-placed one level down; each timer moves
+// at most once per level, so the work per timer is constant. Timers
+// further out than the wheel's range wait in the top level and are
+// re-placed when their slot comes round.
+//
+// Due timers are delivered by advance(), at most `budget` per call, so a
+// burst of expiries is spread over several calls instead of stalling the
+// caller. Nodes live in one array with a free list and are addressed by
+// index, so after warm-up scheduling does not allocate. Not thread-safe.
+
+static constexpr uint32_t kNoTimer = UINT32_MAX;
+
+template <typename T>
+class TimerWheel {
+private:
+    static constexpr unsigned kLevelBits = 8;
+    static constexpr unsigned kLevels = 4;
+    static constexpr size_t kSlots = size_t(1) << kLevelBits;
+    static constexpr uint64_t kSlotMask = kSlots - 1;
+    static constexpr size_t kDueList = kLevels * kSlots;  // fired, not yet delivered
+    static constexpr uint16_t kFree = UINT16_MAX;
+
+    struct Node {
+        T value;
+        uint64_t deadline;
+        uint32_t next;
+        uint32_t prev;
+        uint16_t list;  // slot or kDueList; kFree when unused
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> heads;  // kLevels * kSlots slots, then the due list
+    uint32_t free_head;
+    uint64_t now;
+    size_t count;
+
+    static unsigned digitOf(uint64_t tick, unsigned level) {
+        return static_cast<unsigned>((tick >> (level * kLevelBits)) & kSlotMask);
+    }
+
+    void link(uint32_t n, size_t list) {
+        Node& node = nodes[n];
+        node.list = static_cast<uint16_t>(list);
+        node.prev = kNoTimer;
+        node.next = heads[list];
+        if (node.next != kNoTimer) {
+            nodes[node.next].prev = n;
+        }
+        heads[list] = n;
+    }
+
+    void unlink(uint32_t n) {
+        Node& node = nodes[n];
+        if (node.prev != kNoTimer) {
+            nodes[node.prev].next = node.next;
+        } else {
+            heads[node.list] = node.next;
+        }
+        if (node.next != kNoTimer) {
+            nodes[node.next].prev = node.prev;
+        }
+    }
+
+    void release(uint32_t n) {
+        nodes[n].list = kFree;
+        nodes[n].next = free_head;
+        free_head = n;
+        count--;
+    }
+
+    void place(uint32_t n) {
+        uint64_t deadline = nodes[n].deadline;
+        if (deadline <= now) {
+            link(n, kDueList);
+            return;
+        }
+        unsigned level = (63 - __builtin_clzll(deadline ^ now)) / kLevelBits;
+        if (level >= kLevels) {
+            level = kLevels - 1;
+        }
+        link(n, level * kSlots + digitOf(deadline, level));
+    }
+
+    // Move everything in one slot to where it belongs now
+    void replace(size_t slot) {
+        uint32_t n = heads[slot];
+        heads[slot] = kNoTimer;
+        while (n != kNoTimer) {
+            uint32_t next = nodes[n].next;
+            place(n);
+            n = next;
+        }
+    }
+
+    void step() {
+        now++;
+        for (unsigned level = kLevels - 1; level > 0; level--) {
+            if ((now & ((uint64_t(1) << (level * kLevelBits)) - 1)) == 0) {
+                replace(level * kSlots + digitOf(now, level));
+            }
+        }
+        replace(digitOf(now, 0));
+    }
+
+public:
+    explicit TimerWheel(uint64_t now_tick)
+        : heads(kLevels * kSlots + 1, kNoTimer), free_head(kNoTimer), now(now_tick), count(0) {}
+
+    // Returns a handle for cancel(); valid until the timer fires or is cancelled
+    uint32_t schedule(uint64_t deadline, const T& value) {
+        uint32_t n = free_head;
+        if (n != kNoTimer) {
+            free_head = nodes[n].next;
+        } else {
+            n = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(Node{});
+        }
+        nodes[n].value = value;
+        nodes[n].deadline = deadline;
+        count++;
+        place(n);
+        return n;
+    }
+
+    void cancel(uint32_t handle) {
+        if (handle >= nodes.size() || nodes[handle].list == kFree) {
+            return;
+        }
+        unlink(handle);
+        release(handle);
+    }
+
+    // The value of a pending timer, or null if `handle` is not pending
+    const T* find(uint32_t handle) const {
+        if (handle >= nodes.size() || nodes[handle].list == kFree) {
+            return nullptr;
+        }
+        return &nodes[handle].value;
+    }
+
+    // Move the clock to `now_tick` and hand up to `budget` due timers to
+    // `expire(const T&)`. Returns how many were delivered; the rest stay
+    // due for the next call.
+    template <typename Fn>
+    size_t advance(uint64_t now_tick, size_t budget, Fn&& expire) {
+        while (now < now_tick) {
+            step();
+        }
+        size_t delivered = 0;
+        while (delivered < budget && heads[kDueList] != kNoTimer) {
+            uint32_t n = heads[kDueList];
+            unlink(n);
+            expire(static_cast<const T&>(nodes[n].value));
+            release(n);
+            delivered++;
+        }
+        return delivered;
+    }
+
+    // Fire up to `limit` timers ahead of time, soonest deadline first.
+    // Order is exact within the lowest level and by slot above it.
+    template <typename Fn>
+    size_t expireEarliest(size_t limit, Fn&& expire) {
+        size_t delivered = advance(now, limit, expire);
+        for (unsigned level = 0; level < kLevels && delivered < limit; level++) {
+            unsigned current = digitOf(now, level);
+            for (size_t i = 1; i <= kSlots && delivered < limit; i++) {
+                size_t slot = level * kSlots + ((current + i) & kSlotMask);
+                while (delivered < limit && heads[slot] != kNoTimer) {
+                    uint32_t n = heads[slot];
+                    unlink(n);
+                    expire(static_cast<const T&>(nodes[n].value));
+                    release(n);
+                    delivered++;
+                }
+            }
+        }
+        return delivered;
+    }
+
+    uint64_t currentTick() const { return now; }
+    size_t size() const { return count; }
+    bool hasDue() const { return heads[kDueList] != kNoTimer; }
+    size_t memoryBytes() const {
+        return nodes.capacity() * sizeof(Node) + heads.capacity() * sizeof(uint32_t);
+    }
+};
@@ -0,0 +1,510 @@
+#pragma once
+
+#include "datagram_io.h"
+
+// io_uring backend for the server, on raw syscalls (no liburing).
+//
+// One multishot IORING_OP_RECVMSG stays armed on the socket and the kernel
+// picks a buffer for every datagram from a provided buffer ring, so
+// receiving costs no syscall per datagram or per batch. Responses go out
+// as one IORING_OP_SENDMSG per datagram, all submitted with a single
+// io_uring_enter per flush. With SQPOLL a kernel thread picks up the
+// submissions as well, and an idle server only enters the kernel to
+// wake it.
+//
+// The ring fd is pollable, so the server keeps its epoll loop: it watches
+// the ring fd instead of the socket. Needs Linux 6.0 for multishot
+// recvmsg; init() fails cleanly on older kernels so the caller can fall
+// back to SocketIo.
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#else
+#define HAVE_IO_URING 0
+#endif
+
+#if HAVE_IO_URING
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// A minimal io_uring: one SQ, one CQ, single-threaded use
+class IoUring {
+private:
+    int ring_fd;
+    void* ring_ptr;
+    size_t ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    bool sqpoll;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_flags;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail;  // SQEs handed out, published by submit()
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    static int enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+public:
+    IoUring()
+        : ring_fd(-1), ring_ptr(MAP_FAILED), ring_size(0), sqes(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+          sqes_size(0), sqpoll(false), sq_local_tail(0) {}
+
+    ~IoUring() {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqes_size);
+        }
+        if (ring_ptr != MAP_FAILED) {
+            munmap(ring_ptr, ring_size);
+        }
+        if (ring_fd >= 0) {
+            close(ring_fd);
+        }
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    bool init(unsigned entries, unsigned cq_entries, bool use_sqpoll, unsigned sq_idle_ms) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = cq_entries;
+        if (use_sqpoll) {
+            params.flags |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = sq_idle_ms;
+        }
+        ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring_fd < 0) {
+            return false;
+        }
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            errno = ENOTSUP;
+            return false;
+        }
+        sqpoll = use_sqpoll;
+
+        size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        ring_size = std::max(sq_size, cq_size);
+        ring_ptr = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_fd, IORING_OFF_SQ_RING);
+        if (ring_ptr == MAP_FAILED) {
+            return false;
+        }
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = static_cast<struct io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                                      MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+
+        uint8_t* base = static_cast<uint8_t*>(ring_ptr);
+        sq_head = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+        sq_flags = reinterpret_cast<unsigned*>(base + params.sq_off.flags);
+        sq_mask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+        sq_local_tail = *sq_tail;
+        unsigned* sq_array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+        for (unsigned i = 0; i < sq_entries; i++) {
+            sq_array[i] = i;  // SQE slot i is always ring index i
+        }
+
+        cq_head = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(base + params.cq_off.cqes);
+        return true;
+    }
+
+    int fd() const { return ring_fd; }
+
+    // A zeroed SQE, or null if the SQ is full (submit() and retry)
+    struct io_uring_sqe* getSqe() {
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (sq_local_tail - head >= sq_entries) {
+            return nullptr;
+        }
+        struct io_uring_sqe* sqe = &sqes[sq_local_tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_local_tail++;
+        return sqe;
+    }
+
+    // Publish the SQEs handed out so far and, if `wait_nr` is set, block
+    // until that many completions are available
+    int submit(unsigned wait_nr = 0) {
+        unsigned published = *sq_tail;
+        unsigned to_submit = sq_local_tail - published;
+        __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        if (sqpoll) {
+            // The poller thread takes the SQEs; only wake it if it slept
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (__atomic_load_n(sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            }
+            to_submit = 0;
+            if (flags == 0) {
+                return 0;
+            }
+        } else if (to_submit == 0 && wait_nr == 0) {
+            return 0;
+        }
+
+        int ret;
+        do {
+            ret = enter(ring_fd, to_submit, wait_nr, flags);
+        } while (ret < 0 && errno == EINTR);
+        return ret;
+    }
+
+    // Oldest unconsumed completion, or null
+    struct io_uring_cqe* peek() {
+        unsigned head = *cq_head;
+        if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            return nullptr;
+        }
+        return &cqes[head & cq_mask];
+    }
+
+    void consume() {
+        __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+    }
+
+    int registerOp(unsigned opcode, void* arg, unsigned nr_args) {
+        return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+    }
+};
+
+class UringIo : public DatagramIo {
+private:
+    static constexpr uint16_t kBufferGroup = 0;
+    static constexpr size_t kBufferSize = 2048;  // recvmsg_out + name + control + one MTU
+    static constexpr size_t kRecvControlSize = CMSG_SPACE(sizeof(struct timespec));
+    static constexpr uint64_t kRecvTag = 1;
+    static constexpr uint64_t kSendTag = 2;
+    static constexpr unsigned kSqPollIdleMs = 50;
+
+    int sock_fd;
+    size_t capacity;
+    IoUring ring;
+
+    // Provided buffers: the kernel takes one per datagram from the ring,
+    // and receive() gives the previous batch's back
+    std::vector<uint8_t> buffers;
+    struct io_uring_buf_ring* buf_ring;
+    size_t buf_ring_size;
+    unsigned buf_count;
+    uint16_t buf_tail;
+    std::vector<uint16_t> held;  // buffer ids behind the current batch
+
+    struct msghdr recv_template;  // name and control sizes for every datagram
+    bool armed;
+
+    // Receive completions seen while flush() waited for its sends
+    std::vector<struct io_uring_cqe> backlog;
+    size_t backlog_pos;
+
+    std::vector<Datagram> datagrams;
+    size_t count;
+    uint64_t recv_errors;
+    BatchHistogram histogram;
+
+    // Index the entries by hand: in C++ the empty struct in front of
+    // io_uring_buf_ring::bufs takes a byte, which moves the array off
+    // the offset the kernel uses
+    void provide(uint16_t bid) {
+        struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(buf_ring) + (buf_tail & (buf_count - 1));
+        buf->addr = reinterpret_cast<uint64_t>(buffers.data() + static_cast<size_t>(bid) * kBufferSize);
+        buf->len = kBufferSize;
+        buf->bid = bid;
+        buf_tail++;
+    }
+
+    void publishBuffers() {
+        __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+    }
+
+    bool arm() {
+        struct io_uring_sqe* sqe = ring.getSqe();
+        if (!sqe) {
+            ring.submit();
+            sqe = ring.getSqe();
+            if (!sqe) {
+                return false;
+            }
+        }
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = sock_fd;
+        sqe->addr = reinterpret_cast<uint64_t>(&recv_template);
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kBufferGroup;
+        sqe->user_data = kRecvTag;
+        armed = true;
+        return true;
+    }
+
+    // Next receive completion, from the backlog first. Copies it out so
+    // the CQ slot can be released at once.
+    bool nextRecv(struct io_uring_cqe& out) {
+        if (backlog_pos < backlog.size()) {
+            out = backlog[backlog_pos++];
+            if (backlog_pos == backlog.size()) {
+                backlog.clear();
+                backlog_pos = 0;
+            }
+            return true;
+        }
+        while (struct io_uring_cqe* cqe = ring.peek()) {
+            out = *cqe;
+            ring.consume();
+            if (out.user_data == kRecvTag) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Turn one receive completion into a Datagram. Returns false if it
+    // carried no datagram.
+    bool onRecv(const struct io_uring_cqe& cqe) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            armed = false;  // multishot ended: out of buffers, CQ overflow or error
+        }
+        if (cqe.res < 0) {
+            if (cqe.res != -ENOBUFS) {
+                recv_errors++;
+                QLOG_ERROR("io_uring recvmsg failed: {}", strerror(-cqe.res));
+            }
+            return false;
+        }
+        if (!(cqe.flags & IORING_CQE_F_BUFFER)) {
+            return false;
+        }
+        uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        held.push_back(bid);
+
+        uint8_t* buf = buffers.data() + static_cast<size_t>(bid) * kBufferSize;
+        size_t headers = sizeof(struct io_uring_recvmsg_out) + recv_template.msg_namelen +
+                         recv_template.msg_controllen;
+        if (static_cast<size_t>(cqe.res) < headers) {
+            return false;
+        }
+        struct io_uring_recvmsg_out out;
+        memcpy(&out, buf, sizeof(out));
+
+        Datagram& dgram = datagrams[count++];
+        uint8_t* name = buf + sizeof(struct io_uring_recvmsg_out);
+        memset(&dgram.addr, 0, sizeof(dgram.addr));
+        memcpy(&dgram.addr, name, std::min<size_t>(out.namelen, sizeof(dgram.addr)));
+        dgram.addr_len = std::min<socklen_t>(out.namelen, sizeof(dgram.addr));
+
+        struct msghdr control;
+        memset(&control, 0, sizeof(control));
+        control.msg_control = name + recv_template.msg_namelen;
+        control.msg_controllen = std::min<size_t>(out.controllen, recv_template.msg_controllen);
+        size_t segment_size;
+        RecvBatch::readControl(control, dgram.rx_time_ns, segment_size);
+
+        dgram.data = buf + headers;
+        dgram.len = std::min<size_t>(out.payloadlen, cqe.res - headers);
+        return true;
+    }
+
+public:
+    UringIo(int sock_fd, size_t batch_size)
+        : sock_fd(sock_fd), capacity(batch_size), buf_ring(nullptr), buf_ring_size(0), buf_count(0),
+          buf_tail(0), armed(false), backlog_pos(0), datagrams(batch_size), count(0), recv_errors(0),
+          histogram(batch_size) {
+        memset(&recv_template, 0, sizeof(recv_template));
+        recv_template.msg_namelen = sizeof(struct sockaddr_in);
+        recv_template.msg_controllen = kRecvControlSize;
+    }
+
+    ~UringIo() override {
+        if (buf_ring) {
+            munmap(buf_ring, buf_ring_size);
+        }
+    }
+
+    // Set up the ring, register the buffers and arm the receive. Returns
+    // false (errno set) if the kernel cannot do any of it.
+    bool init(bool sqpoll) {
+        // Enough buffers that the kernel keeps receiving while a batch is
+        // being handled; the CQ has room for all of them plus the sends
+        buf_count = 256;
+        while (buf_count < capacity * 8 && buf_count < 32768) {
+            buf_count <<= 1;
+        }
+        unsigned sq_entries = 64;
+        while (sq_entries < capacity + 1) {
+            sq_entries <<= 1;
+        }
+        if (!ring.init(sq_entries, buf_count * 2, sqpoll, kSqPollIdleMs)) {
+            return false;
+        }
+
+        buffers.assign(static_cast<size_t>(buf_count) * kBufferSize, 0);
+        buf_ring_size = buf_count * sizeof(struct io_uring_buf);
+        void* mem = mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            return false;
+        }
+        buf_ring = static_cast<struct io_uring_buf_ring*>(mem);
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring);
+        reg.ring_entries = buf_count;
+        reg.bgid = kBufferGroup;
+        if (ring.registerOp(IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            return false;
+        }
+        for (unsigned bid = 0; bid < buf_count; bid++) {
+            provide(static_cast<uint16_t>(bid));
+        }
+        publishBuffers();
+
+        held.reserve(capacity);
+        backlog.reserve(buf_count * 2);
+
+        // Kernels without multishot recvmsg fail the request at once
+        if (!arm() || ring.submit() < 0) {
+            return false;
+        }
+        if (struct io_uring_cqe* cqe = ring.peek()) {
+            if (cqe->res < 0 && cqe->res != -ENOBUFS && !(cqe->flags & IORING_CQE_F_MORE)) {
+                errno = -cqe->res;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int pollFd() const override { return ring.fd(); }
+
+    int receive() override {
+        // The previous batch has been handled and its responses sent
+        for (uint16_t bid : held) {
+            provide(bid);
+        }
+        if (!held.empty()) {
+            publishBuffers();
+            held.clear();
+        }
+
+        count = 0;
+        size_t entries = 0;
+        struct io_uring_cqe cqe;
+        while (entries < capacity && nextRecv(cqe)) {
+            entries++;
+            onRecv(cqe);
+        }
+
+        if (!armed) {
+            if (!arm()) {
+                errno = EBUSY;
+                return -1;
+            }
+            ring.submit();
+        }
+        if (count > 0) {
+            histogram.record(count);
+        }
+        return static_cast<int>(entries);
+    }
+
+    const Datagram* begin() const override { return datagrams.data(); }
+    const Datagram* end() const override { return datagrams.data() + count; }
+    size_t size() const override { return count; }
+    size_t maxSize() const override { return capacity; }
+    size_t maxDatagrams() const override { return capacity; }
+
+    // Receive completions that flush() set aside raise no new edge
+    bool drained(int received) const override {
+        return static_cast<size_t>(received) < capacity && backlog_pos == backlog.size();
+    }
+
+    // One SENDMSG per queued datagram and a single enter for all of them.
+    // The responses point into the receive buffers, so wait until the
+    // kernel is done with them; MSG_DONTWAIT makes a full socket buffer
+    // fail the send (counted as dropped) instead of parking it.
+    void flush(SendBatch& tx) override {
+        size_t n = tx.size();
+        if (n == 0) {
+            return;
+        }
+        struct mmsghdr* msgs = tx.messages();
+        for (size_t i = 0; i < n; i++) {
+            struct io_uring_sqe* sqe = ring.getSqe();
+            while (!sqe) {
+                ring.submit();
+                sqe = ring.getSqe();
+            }
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = sock_fd;
+            sqe->addr = reinterpret_cast<uint64_t>(&msgs[i].msg_hdr);
+            sqe->len = 1;
+            sqe->msg_flags = MSG_DONTWAIT;
+            sqe->user_data = kSendTag;
+        }
+
+        size_t sent = 0;
+        size_t failed = 0;
+        bool submitted = false;
+        while (sent + failed < n) {
+            struct io_uring_cqe* cqe = ring.peek();
+            if (!cqe) {
+                // Submit on the first pass; after that only wait
+                if (ring.submit(submitted ? 1 : 0) < 0 && errno != EBUSY && errno != EAGAIN) {
+                    QLOG_ERROR("io_uring_enter failed: {}", strerror(errno));
+                    failed = n - sent;
+                    break;
+                }
+                submitted = true;
+                continue;
+            }
+            if (cqe->user_data == kSendTag) {
+                if (cqe->res < 0) {
+                    if (cqe->res != -EAGAIN) {
+                        QLOG_ERROR("Failed to send: {}", strerror(-cqe->res));
+                    }
+                    failed++;
+                } else {
+                    sent++;
+                }
+            } else {
+                backlog.push_back(*cqe);
+            }
+            ring.consume();
+        }
+        tx.completed(sent, failed);
+    }
+
+    const char* name() const override { return "io_uring recvmsg"; }
+    const BatchHistogram& recvStats() const override { return histogram; }
+    uint64_t recvErrors() const { return recv_errors; }
+};
+
+#endif  // HAVE_IO_URING